@@ -33,11 +33,44 @@ QMAKE_LIBDIR += /usr/local/lib
 LIBS += -lpiplatesio
 
 SOURCES += \
+	csbmsbusscheduler.cpp \
+	csbmscapture.cpp \
+	csbmsdaemon.cpp \
+	csbmsframebuilder.cpp \
+	csbmsframeparser.cpp \
+	csbmsiothreadpool.cpp \
+	csbmsjsonsink.cpp \
+	csbmslivechart.cpp \
+	csbmsmetrics.cpp \
+	csbmsmetricsserver.cpp \
+	csbmsnativeport.cpp \
+	csbmsreplaydevice.cpp \
+	csbmstelemetry.cpp \
+	csbmstelemetryrollup.cpp \
+	csbmstelemetrysink.cpp \
 	cssupervoltbmsdevice.cpp \
 	main.cpp \
 	mainwindow.cpp
 
 HEADERS += \
+	csbmsbusscheduler.h \
+	csbmscapture.h \
+	csbmsdaemon.h \
+	csbmsframebuilder.h \
+	csbmsframeparser.h \
+	csbmsiothreadpool.h \
+	csbmsjsonsink.h \
+	csbmslivechart.h \
+	csbmsmetrics.h \
+	csbmsmetricsserver.h \
+	csbmsnativeport.h \
+	csbmsprotocol.h \
+	csbmsreplaydevice.h \
+	csbmsring.h \
+	csbmssink.h \
+	csbmstelemetry.h \
+	csbmstelemetryrollup.h \
+	csbmstelemetrysink.h \
 	cssupervoltbmsdevice.h \
 	mainwindow.h
 
@@ -0,0 +1,83 @@
+#include <QByteArray>
+#include <QList>
+#include <QTextStream>
+#include <csbmsframeparser.h>
+#include <cssupervoltbmsdevice.h>
+#include "benchmark.h"
+
+/* distinct analog responses, decoded round robin */
+static const int BENCH_DECODE_FRAMES = 16;
+
+static QList<QByteArray> splitFrames(const QByteArray& stream)
+{
+    QList<QByteArray> result;
+    CSBmsFrameParser parser;
+    qint64 offset = 0;
+    bool complete;
+
+    while (offset < stream.size()) {
+        offset += parser.feed(stream.constData() + offset, stream.size() - offset, &complete);
+        if (complete) {
+            const QByteArray frame = parser.frame();
+            result.append(QByteArray(frame.constData(), frame.size()));
+        }
+    }
+
+    return result;
+}
+
+bool benchDecoder(qint64 frames)
+{
+    const QList<QByteArray> replies = splitFrames(benchAnalogReplies(BENCH_DECODE_FRAMES));
+    quint8 info[BMS_MAX_INFO_SIZE / 2];
+
+    if (replies.isEmpty()) {
+        QTextStream(stderr) << "no replies from the simulator engine" << Qt::endl;
+        return false;
+    }
+
+    /* raw INFO field, ASCII hex to bytes, byte by byte */
+    benchRun(QStringLiteral("hex_decode_scalar"), frames, [&](qint64 i) {
+        const QByteArray& frame = replies.at(i % replies.size());
+        const char* pos = frame.constData() + BMS_FRAME_HEADER_SIZE;
+        const qint64 count = (frame.size() - BMS_FRAME_HEADER_SIZE - BMS_FRAME_TRAILER_SIZE) / 2;
+        int bad = 0;
+
+        for (qint64 n = 0; n < count; n++, pos += 2) {
+            const int b = CSBmsProtocol::hexByte(pos);
+            bad |= b;
+            info[n] = static_cast<quint8>(b);
+        }
+        benchKeep(bad);
+        benchKeep(info[0]);
+        return count * 2;
+    });
+
+    /* same with the bulk kernel */
+    benchRun(QStringLiteral("hex_decode_vector"), frames, [&](qint64 i) {
+        const QByteArray& frame = replies.at(i % replies.size());
+        const qint64 count = (frame.size() - BMS_FRAME_HEADER_SIZE - BMS_FRAME_TRAILER_SIZE) / 2;
+
+        benchKeep(CSBmsProtocol::hexDecode(frame.constData() + BMS_FRAME_HEADER_SIZE, count, info));
+        benchKeep(info[0]);
+        return count * 2;
+    });
+
+    /* INFO to TAnalogData, as done for every analog response */
+    qint64 failed = 0;
+    benchRun(QStringLiteral("decode_analog"), frames, [&](qint64 i) {
+        const QByteArray& frame = replies.at(i % replies.size());
+        CSSuperVoltBmsDevice::TAnalogData data;
+
+        if (!CSSuperVoltBmsDevice::decodeAnalogData(frame, data)) {
+            failed++;
+        }
+        benchKeep(data.voltage);
+        return frame.size();
+    });
+
+    if (failed) {
+        QTextStream(stderr) << "decoder: " << failed << " frames failed to decode" << Qt::endl;
+    }
+    return failed == 0;
+}
@@ -0,0 +1,174 @@
+#include <QByteArray>
+#include <QTextStream>
+#include <csbmsframebuilder.h>
+#include <csbmsprotocol.h>
+#include <stdio.h>
+#include "benchmark.h"
+
+/* same bits as CSSuperVoltBmsDevice::OPT_* */
+static const quint8 OPT_SOI_BYTE_3E = 0x01;
+static const quint8 OPT_ASCII_CHKSUM = 0x04;
+static const quint8 OPT_ASCII_LENGTH = 0x08;
+
+/* ----------------------------------------------------------
+ *  Previous snprintf based encoder, kept as baseline
+ * ---------------------------------------------------------- */
+
+static void legacyHex8(const quint8 value, QByteArray& result)
+{
+    char hex[3] = {};
+    for (quint8 i = 0; i < 2; i++) {
+        quint8 nib = (i == 0 ? (value >> 4) & 0x0f : value & 0x0f);
+        snprintf(hex, 2, "%X", nib);
+        snprintf(hex, 3, "%02X", hex[0]);
+        result.append(hex);
+    }
+}
+
+static void legacyHex16(const quint16 value, QByteArray& result)
+{
+    legacyHex8((value >> 8) & 0x00ff, result);
+    legacyHex8(value & 0x00ff, result);
+}
+
+static void legacyLength(QByteArray& packet, quint16 length, uint options)
+{
+    char hex[5];
+    if (length == 0) {
+        if (options & OPT_ASCII_LENGTH) {
+            legacyHex16(0, packet);
+        }
+        else {
+            snprintf(hex, 5, "%04X", 0);
+            packet.append(hex);
+        }
+        return;
+    }
+
+    qint16 chksum = ((length >> 8) & 0x0f) + ((length >> 4) & 0x0f) + (length & 0x0f);
+    chksum = (~(chksum % 16)) + 1;
+
+    if (options & OPT_ASCII_LENGTH) {
+        snprintf(hex, 2, "%X", (chksum & 0x000f));
+        snprintf(hex, 3, "%02X", hex[0]);
+        packet.append(hex);
+        snprintf(hex, 2, "%X", ((length >> 8) & 0x000f));
+        snprintf(hex, 3, "%02X", hex[0]);
+        packet.append(hex);
+        snprintf(hex, 2, "%X", ((length >> 4) & 0x000f));
+        snprintf(hex, 3, "%02X", hex[0]);
+        packet.append(hex);
+        snprintf(hex, 2, "%X", (length & 0x000f));
+        snprintf(hex, 3, "%02X", hex[0]);
+        packet.append(hex);
+    }
+    else {
+        snprintf(hex, 2, "%X", (chksum & 0x000f));
+        packet.append(hex);
+        snprintf(hex, 4, "%03X", length & 0x0fff);
+        packet.append(hex);
+    }
+}
+
+static void legacyInfo(QByteArray& packet, quint16 info, uint options)
+{
+    char hex[5];
+    if (options & OPT_ASCII_LENGTH) {
+        legacyHex16(info, packet);
+    }
+    else {
+        snprintf(hex, 5, "%04X", info);
+        packet.append(hex);
+    }
+}
+
+static void legacyChecksum(QByteArray& packet, uint options)
+{
+    int chksum = 0;
+    for (int i = 1; i < packet.size(); i++) {
+        chksum += static_cast<quint8>(packet[i]);
+    }
+    chksum = (~(chksum % 65536)) + 1;
+
+    if (options & OPT_ASCII_CHKSUM) {
+        legacyHex8(((chksum >> 8) & 0x00ff), packet);
+        legacyHex8((chksum & 0x00ff), packet);
+    }
+    else {
+        char hex[3];
+        snprintf(hex, 3, "%02X", (chksum >> 8) & 0x00ff);
+        packet.append(hex);
+        snprintf(hex, 3, "%02X", (chksum & 0x00ff));
+        packet.append(hex);
+    }
+}
+
+static QByteArray legacyFrame(uint options, quint8 address)
+{
+    QByteArray packet = {};
+    packet.append(options & OPT_SOI_BYTE_3E ? BMS_PROTO_SOI_3E : BMS_PROTO_SOI_7E);
+    legacyHex8(BMS_PROTO_VER, packet);
+    legacyHex8(address, packet);
+    legacyHex8(BMS_CID1_LIFEPO4, packet);
+    legacyHex8(BMS_CID2_FETCH_ANALOG_DATA, packet);
+    legacyLength(packet, 2, options);
+    legacyInfo(packet, 0x00ff, options);
+    legacyChecksum(packet, options);
+    packet.append(BMS_PROTO_EOI);
+    return packet;
+}
+
+/* ----------------------------------------------------------
+ *  Fixed size frame builder, as used by CSSuperVoltBmsDevice
+ * ---------------------------------------------------------- */
+
+static qint64 builderFrame(CSBmsFrameBuilder& builder, uint options, quint8 address)
+{
+    const bool asciiLength = (options & OPT_ASCII_LENGTH);
+
+    builder.appendStart(options & OPT_SOI_BYTE_3E ? BMS_PROTO_SOI_3E : BMS_PROTO_SOI_7E);
+    builder.appendHeader(address, BMS_CID2_FETCH_ANALOG_DATA);
+    builder.appendLength(2, asciiLength);
+    builder.appendInfo(0x00ff, asciiLength);
+    builder.appendChecksum(options & OPT_ASCII_CHKSUM);
+    builder.appendEnd();
+    return builder.size();
+}
+
+bool benchEncoder(qint64 frames)
+{
+    bool ok = true;
+
+    const uint modes[2] = {
+       OPT_SOI_BYTE_3E,
+       OPT_SOI_BYTE_3E | OPT_ASCII_CHKSUM | OPT_ASCII_LENGTH,
+    };
+
+    for (uint options : modes) {
+        CSBmsFrameBuilder builder;
+        builderFrame(builder, options, 1);
+
+        /* both encoders must agree before comparing them */
+        if (legacyFrame(options, 1) != builder.view().toByteArray()) {
+            QTextStream(stderr) << "encoder mismatch for options " << options << Qt::endl;
+            ok = false;
+            continue;
+        }
+
+        const QString mode = (options & OPT_ASCII_LENGTH) ? QStringLiteral("ascii") : QStringLiteral("plain");
+
+        benchRun(QStringLiteral("encode_snprintf_%1").arg(mode), frames, [&](qint64 i) {
+            const QByteArray packet = legacyFrame(options, i & 0x0f);
+            benchKeep(packet.constData()[0]);
+            return packet.size();
+        });
+
+        benchRun(QStringLiteral("encode_builder_%1").arg(mode), frames, [&](qint64 i) {
+            const qint64 n = builderFrame(builder, options, i & 0x0f);
+            benchKeep(builder.data()[n - 1]);
+            return n;
+        });
+    }
+
+    return ok;
+}
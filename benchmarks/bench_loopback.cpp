@@ -0,0 +1,244 @@
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QIODevice>
+#include <QTextStream>
+#include <QVector>
+#include <csbmscapture.h>
+#include <csbmsreplaydevice.h>
+#include <cssupervoltbmsdevice.h>
+#include <functional>
+#include <simulator/csbmssimengine.h>
+#include <string.h>
+#include "benchmark.h"
+
+/* In-process stand-in for the serial line: every request written
+ * is answered by the simulator engine right away, readyRead() comes
+ * through the event loop like it does for a real port. */
+class CSBmsLoopback: public QIODevice
+{
+public:
+    explicit CSBmsLoopback(CSBmsSimEngine* engine)
+        : QIODevice()
+        , m_engine(engine)
+        , m_rx()
+        , m_reply()
+        , m_offset(0)
+    {
+    }
+
+    bool isSequential() const override
+    {
+        return true;
+    }
+
+    qint64 bytesAvailable() const override
+    {
+        return m_rx.size() - m_offset + QIODevice::bytesAvailable();
+    }
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override
+    {
+        const qint64 size = qMin(maxSize, m_rx.size() - m_offset);
+        memcpy(data, m_rx.constData() + m_offset, size);
+        m_offset += size;
+        if (m_offset == m_rx.size()) {
+            m_rx.resize(0);
+            m_offset = 0;
+        }
+        return size;
+    }
+
+    qint64 writeData(const char* data, qint64 size) override
+    {
+        if (m_engine->respond(data, size, m_reply)) {
+            m_rx.append(m_reply);
+            QMetaObject::invokeMethod(this, [this]() { emit readyRead(); }, Qt::QueuedConnection);
+        }
+        return size;
+    }
+
+private:
+    CSBmsSimEngine* m_engine;
+    QByteArray m_rx;
+    QByteArray m_reply;
+    qint64 m_offset;
+};
+
+bool benchLoopback(qint64 frames)
+{
+    bool ok = true;
+
+    const uint modes[2] = {
+       CSSuperVoltBmsDevice::OPT_SOI_BYTE_3E,
+       CSSuperVoltBmsDevice::OPT_SOI_BYTE_3E | CSSuperVoltBmsDevice::OPT_ASCII_CHKSUM | CSSuperVoltBmsDevice::OPT_ASCII_LENGTH,
+    };
+
+    for (uint options : modes) {
+        CSBmsSimEngine engine;
+        CSBmsSimEngine::TConfig config = engine.config();
+        config.options = options;
+        engine.setConfig(config);
+
+        CSBmsLoopback loopback(&engine);
+        CSSuperVoltBmsDevice device;
+        device.setOptions(options);
+        device.setTransport(&loopback);
+        if (!device.open()) {
+            QTextStream(stderr) << "loopback: unable to open" << Qt::endl;
+            return false;
+        }
+
+        const QString mode = (options & CSSuperVoltBmsDevice::OPT_ASCII_LENGTH) ? QStringLiteral("ascii") : QStringLiteral("plain");
+        TBenchResult r = {QStringLiteral("roundtrip_analog_%1").arg(mode), frames, 0, 0, 0};
+        QEventLoop loop;
+        QElapsedTimer timer;
+        qint64 done = 0;
+        qint64 failed = 0;
+
+        /* one request on the bus at a time, the next one is issued
+         * from the continuation of the previous */
+        std::function<void()> next = [&]() {
+            if (done == frames) {
+                loop.quit();
+                return;
+            }
+            device.fetchAnalogData()
+               .then(&device,
+                     [&](const CSSuperVoltBmsDevice::TResponse& rsp) {
+                         r.bytes += rsp.frame.size();
+                         done++;
+                         next();
+                     })
+               .onFailed(&device, [&](const CSBmsException&) {
+                   failed++;
+                   done++;
+                   next();
+               });
+        };
+
+        const quint64 allocs = benchAllocations();
+        timer.start();
+        QMetaObject::invokeMethod(&loop, next, Qt::QueuedConnection);
+        loop.exec();
+        r.elapsedNs = timer.nsecsElapsed();
+        r.allocs = benchAllocations() - allocs;
+
+        benchReport(r);
+        if (failed) {
+            QTextStream(stderr) << "loopback " << mode << ": " << failed << " requests failed" << Qt::endl;
+            ok = false;
+        }
+
+        device.close();
+    }
+
+    return ok;
+}
+
+/* characters of a coded request header byte */
+static const int BENCH_REPLAY_CODE_WIDTH = 4;
+
+/* The requests of a capture file issued again, CSBmsReplayDevice
+ * answers each with the replies captured after it: field traffic
+ * through the whole receive path, as fast as possible. One pass,
+ * at most 'frames' requests, the first captured port only. False
+ * if most replayed requests fail, the numbers would be timeouts. */
+bool benchReplay(qint64 frames, const QString& fileName)
+{
+    CSBmsCaptureReader reader;
+    CSBmsCaptureReader::TRecord record;
+    QVector<QPair<quint8, quint8>> requests; /* address, CID2 */
+    int port = -1;
+
+    if (!reader.open(fileName)) {
+        QTextStream(stderr) << "replay: unable to open capture " << fileName << Qt::endl;
+        return false;
+    }
+    while (requests.size() < frames && reader.next(record)) {
+        if (record.type != CSBmsCapture::RecordTx || (port >= 0 && record.port != port)) {
+            continue;
+        }
+        if (record.size < 1 + 4 * 2) {
+            continue;
+        }
+
+        /* SOI VER ADR CID1 CID2, coded as the device sends them or
+         * plain hex from other masters on the bus */
+        const bool codes = CSBmsProtocol::isCodedHeader(record.data + 1);
+        const int width = (codes ? BENCH_REPLAY_CODE_WIDTH : 2);
+        if (record.size < 1 + 4 * width) {
+            continue;
+        }
+        const int address = CSBmsProtocol::requestByte(record.data + 1 + width, codes);
+        const int cid2 = CSBmsProtocol::requestByte(record.data + 1 + 3 * width, codes);
+        if (address < 0 || cid2 < 0) {
+            continue;
+        }
+        port = record.port;
+        requests.append(qMakePair(quint8(address), quint8(cid2)));
+    }
+    reader.close();
+
+    if (requests.isEmpty()) {
+        QTextStream(stderr) << "replay: no requests in " << fileName << Qt::endl;
+        return false;
+    }
+
+    CSBmsReplayDevice replay;
+    replay.setCapture(fileName);
+    replay.setPort(port);
+    replay.setPacing(CSBmsReplayDevice::PacedByRequests);
+    replay.setRealTime(false);
+
+    CSSuperVoltBmsDevice device;
+    device.setTransport(&replay);
+    if (!device.open()) {
+        QTextStream(stderr) << "replay: unable to open" << Qt::endl;
+        return false;
+    }
+
+    TBenchResult r = {QStringLiteral("roundtrip_capture"), requests.size(), 0, 0, 0};
+    QEventLoop loop;
+    QElapsedTimer timer;
+    qint64 done = 0;
+    qint64 failed = 0;
+
+    std::function<void()> next = [&]() {
+        if (done == requests.size()) {
+            loop.quit();
+            return;
+        }
+
+        /* a cached reply would not write the request and the replay
+         * would fall out of step with the capture */
+        device.clearInfoCache();
+        device.execute(requests.at(done).first, requests.at(done).second)
+           .then(&device,
+                 [&](const CSSuperVoltBmsDevice::TResponse& rsp) {
+                     r.bytes += rsp.frame.size();
+                     done++;
+                     next();
+                 })
+           .onFailed(&device, [&](const CSBmsException&) {
+               failed++;
+               done++;
+               next();
+           });
+    };
+
+    const quint64 allocs = benchAllocations();
+    timer.start();
+    QMetaObject::invokeMethod(&loop, next, Qt::QueuedConnection);
+    loop.exec();
+    r.elapsedNs = timer.nsecsElapsed();
+    r.allocs = benchAllocations() - allocs;
+
+    benchReport(r);
+    if (failed) {
+        QTextStream(stderr) << "replay: " << failed << " of " << requests.size() << " requests failed" << Qt::endl;
+    }
+
+    device.close();
+    return failed * 2 <= requests.size();
+}
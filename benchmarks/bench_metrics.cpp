@@ -0,0 +1,187 @@
+#include <QEventLoop>
+#include <QHash>
+#include <QHostAddress>
+#include <QList>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QTimer>
+#include <csbmsmetrics.h>
+#include <csbmsmetricsserver.h>
+#include "benchmark.h"
+
+/* addresses and CID2 observed, one histogram per pair */
+static const int BENCH_METRICS_ADDRESSES = 4;
+static const quint8 BENCH_METRICS_CID2[2] = {0x42, 0x51};
+
+/* ms the self check waits for the scrape */
+static const int BENCH_METRICS_TIMEOUT = 5000;
+
+/* spread over all buckets, some beyond the last bound */
+static inline qint64 benchLatency(qint64 i)
+{
+    return (i % 97) * 75000000LL;
+}
+
+typedef struct {
+    QList<quint64> buckets; /* cumulative, in rendered order */
+    QByteArray lastLe;
+    double sum;
+    quint64 count;
+    bool hasSum;
+    bool hasCount;
+} TSeries;
+
+/* GET /metrics over a real socket, the body or empty */
+static QByteArray scrape(quint16 port)
+{
+    QTcpSocket socket;
+    QEventLoop loop;
+    QByteArray response;
+
+    QObject::connect(&socket, &QTcpSocket::connected, &loop, [&socket]() { socket.write("GET /metrics HTTP/1.0\r\n\r\n"); });
+    QObject::connect(&socket, &QTcpSocket::readyRead, &loop, [&]() { response.append(socket.readAll()); });
+    QObject::connect(&socket, &QTcpSocket::disconnected, &loop, &QEventLoop::quit);
+    QObject::connect(&socket, &QTcpSocket::errorOccurred, &loop, &QEventLoop::quit);
+    QTimer::singleShot(BENCH_METRICS_TIMEOUT, &loop, &QEventLoop::quit);
+
+    socket.connectToHost(QHostAddress::LocalHost, port);
+    loop.exec();
+    response.append(socket.readAll());
+
+    const qsizetype body = response.indexOf("\r\n\r\n");
+    if (!response.startsWith("HTTP/1.0 200 ") || body < 0) {
+        QTextStream(stderr) << "metrics: bad response: " << response.left(64) << Qt::endl;
+        return QByteArray();
+    }
+    return response.mid(body + 4);
+}
+
+/* Histogram families of the exposition text by series. Buckets must
+ * be cumulative and end with le="+Inf", _count must equal the +Inf
+ * bucket and every series needs _sum and _count. */
+static bool checkHistograms(const QByteArray& text, const QByteArray& name, QHash<QByteArray, TSeries>& series)
+{
+    bool ok = text.contains("# TYPE " + name + " histogram\n");
+
+    if (!ok) {
+        QTextStream(stderr) << "metrics: no histogram family " << name << Qt::endl;
+    }
+
+    foreach (const QByteArray& line, text.split('\n')) {
+        const qsizetype open = line.indexOf('{');
+        const qsizetype close = line.lastIndexOf("} ");
+        if (!line.startsWith(name) || open < 0 || close < open) {
+            continue;
+        }
+
+        const QByteArray metric = line.left(open);
+        const QByteArray value = line.mid(close + 2);
+        const QByteArray labels = line.mid(open + 1, close - open - 1);
+
+        if (metric == name + "_bucket") {
+            const qsizetype le = labels.indexOf(",le=\"");
+            if (le < 0) {
+                QTextStream(stderr) << "metrics: bucket without le: " << line << Qt::endl;
+                ok = false;
+                continue;
+            }
+
+            TSeries& s = series[labels.left(le)];
+            const quint64 cumulative = value.toULongLong();
+            if (!s.buckets.isEmpty() && cumulative < s.buckets.last()) {
+                QTextStream(stderr) << "metrics: bucket not cumulative: " << line << Qt::endl;
+                ok = false;
+            }
+            s.buckets.append(cumulative);
+            s.lastLe = labels.mid(le + 5, labels.size() - le - 6);
+        }
+        else if (metric == name + "_sum") {
+            TSeries& s = series[labels];
+            s.sum = value.toDouble();
+            s.hasSum = true;
+        }
+        else if (metric == name + "_count") {
+            TSeries& s = series[labels];
+            s.count = value.toULongLong();
+            s.hasCount = true;
+        }
+    }
+
+    for (auto it = series.constBegin(); it != series.constEnd(); it++) {
+        const TSeries& s = it.value();
+        if (s.buckets.size() != BMS_LATENCY_BUCKETS || s.lastLe != "+Inf") {
+            QTextStream(stderr) << "metrics: " << it.key() << ": " << s.buckets.size() //
+                                << " buckets, last le=" << s.lastLe << Qt::endl;
+            ok = false;
+        }
+        if (!s.hasSum || !s.hasCount) {
+            QTextStream(stderr) << "metrics: " << it.key() << ": _sum or _count missing" << Qt::endl;
+            ok = false;
+        }
+        if (!s.buckets.isEmpty() && s.count != s.buckets.last()) {
+            QTextStream(stderr) << "metrics: " << it.key() << ": _count " << s.count //
+                                << " != +Inf bucket " << s.buckets.last() << Qt::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/* Cost of recording a latency and of rendering the registry, then
+ * a self check: the registry is served on a loopback port, scraped
+ * like Prometheus would and the histograms are checked against what
+ * was observed. False if the check fails. */
+bool benchMetrics(qint64 frames)
+{
+    CSBmsMetrics metrics;
+    CSBmsPortMetrics* port = metrics.addPort(QStringLiteral("BUS-0"), QStringLiteral("/dev/ttyBENCH"));
+    const int histograms = BENCH_METRICS_ADDRESSES * 2;
+    quint64 expectedCount = 0;
+    double expectedSum = 0;
+
+    /* enough to touch every histogram */
+    benchRun(QStringLiteral("metrics_observe"), qMax<qint64>(frames, histograms), [&](qint64 i) {
+        const qint64 latency = benchLatency(i);
+        port->observeLatency(quint8(1 + i % BENCH_METRICS_ADDRESSES), BENCH_METRICS_CID2[(i / BENCH_METRICS_ADDRESSES) % 2], latency);
+        expectedCount++;
+        expectedSum += latency / 1e9;
+        return 0;
+    });
+
+    /* rendering allocates, keep it short */
+    benchRun(QStringLiteral("metrics_render"), qMax(1LL, frames / 10000), [&](qint64) {
+        const QByteArray text = metrics.render();
+        return text.size();
+    });
+
+    CSBmsMetricsServer server(&metrics);
+    if (!server.listen(QHostAddress::LocalHost, 0)) {
+        return false;
+    }
+
+    const QByteArray text = scrape(server.serverPort());
+    server.close();
+
+    QHash<QByteArray, TSeries> series;
+    bool ok = !text.isEmpty() && checkHistograms(text, "svbms_request_latency_seconds", series);
+
+    quint64 count = 0;
+    double sum = 0;
+    foreach (const TSeries& s, series) {
+        count += s.count;
+        sum += s.sum;
+    }
+    if (series.size() != histograms || count != expectedCount || qAbs(sum - expectedSum) > expectedSum * 1e-6) {
+        QTextStream(stderr) << "metrics: scraped " << series.size() << " series, count " << count << ", sum " << sum //
+                            << "; observed " << histograms << " series, count " << expectedCount << ", sum " << expectedSum << Qt::endl;
+        ok = false;
+    }
+
+    QTextStream(stdout) << QStringLiteral("{\"bench\":\"metrics_scrape\",\"bytes\":%1,\"series\":%2,\"count\":%3,\"ok\":%4}")
+                              .arg(text.size())
+                              .arg(series.size())
+                              .arg(count)
+                              .arg(QLatin1String(ok ? "true" : "false"))
+                        << Qt::endl;
+    return ok;
+}
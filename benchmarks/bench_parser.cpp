@@ -0,0 +1,189 @@
+#include <QByteArray>
+#include <QTextStream>
+#include <csbmscapture.h>
+#include <csbmsframeparser.h>
+#include <csbmsprotocol.h>
+#include <simulator/csbmssimengine.h>
+#include "benchmark.h"
+
+/* bytes per read, roughly what a serial port hands out at 9600 baud */
+static const qint64 BENCH_READ_CHUNK = 32;
+
+/* frames in the receive stream, replayed round robin */
+static const int BENCH_STREAM_FRAMES = 64;
+
+/* plain ASCII hex request, as the simulator engine accepts it */
+static qint64 analogRequest(char* frame, quint8 address)
+{
+    char* pos = frame;
+    *pos++ = BMS_PROTO_SOI_7E;
+    pos = CSBmsProtocol::putHex8(pos, BMS_PROTO_VER);
+    pos = CSBmsProtocol::putHex8(pos, address);
+    pos = CSBmsProtocol::putHex8(pos, BMS_CID1_LIFEPO4);
+    pos = CSBmsProtocol::putHex8(pos, BMS_CID2_FETCH_ANALOG_DATA);
+    pos = CSBmsProtocol::putHex16(pos, (CSBmsProtocol::lengthChecksum(2) << 12) | 2);
+    pos = CSBmsProtocol::putHex16(pos, 0x00ff);
+    pos = CSBmsProtocol::putHex16(pos, CSBmsProtocol::checksum(frame + 1, pos - frame - 1));
+    *pos++ = BMS_PROTO_EOI;
+    return pos - frame;
+}
+
+QByteArray benchAnalogReplies(int count)
+{
+    CSBmsSimEngine engine;
+    CSBmsSimEngine::TConfig config = engine.config();
+    QByteArray stream;
+    QByteArray reply;
+    char request[BMS_MAX_REQUEST_SIZE];
+
+    config.options = 0;
+    engine.setConfig(config);
+
+    const qint64 size = analogRequest(request, config.addresses.first());
+    for (int i = 0; i < count; i++) {
+        if (engine.respond(request, size, reply)) {
+            stream.append(reply);
+        }
+    }
+
+    return stream;
+}
+
+/* version, LENGTH and CHKSUM of a complete response frame */
+static inline bool validFrame(const char* frame, qint64 size)
+{
+    if (CSBmsProtocol::hexByte(frame + BMS_FRAME_VER_OFFSET) != BMS_PROTO_VER) {
+        return false;
+    }
+
+    const int hi = CSBmsProtocol::hexByte(frame + BMS_FRAME_LENGTH_OFFSET);
+    const int lo = CSBmsProtocol::hexByte(frame + BMS_FRAME_LENGTH_OFFSET + 2);
+    const quint16 lenid = ((hi << 8) | lo) & 0x0fff;
+    if (hi < 0 || lo < 0 || (hi >> 4) != CSBmsProtocol::lengthChecksum(lenid)) {
+        return false;
+    }
+    if (size != BMS_FRAME_HEADER_SIZE + lenid + BMS_FRAME_TRAILER_SIZE) {
+        return false;
+    }
+
+    const char* chksum = frame + size - BMS_FRAME_TRAILER_SIZE;
+    const int chi = CSBmsProtocol::hexByte(chksum);
+    const int clo = CSBmsProtocol::hexByte(chksum + 2);
+    return chi >= 0 && clo >= 0 && ((chi << 8) | clo) == CSBmsProtocol::checksum(frame + 1, chksum - frame - 1);
+}
+
+bool benchParser(qint64 frames)
+{
+    const QByteArray stream = benchAnalogReplies(BENCH_STREAM_FRAMES);
+    const char* data = stream.constData();
+    const qint64 size = stream.size();
+    CSBmsFrameParser parser;
+    qint64 offset = 0;
+    qint64 invalid = 0;
+
+    if (stream.isEmpty()) {
+        QTextStream(stderr) << "no replies from the simulator engine" << Qt::endl;
+        return false;
+    }
+
+    /* one iteration extracts and validates one frame, fed in
+     * serial port sized chunks */
+    benchRun(QStringLiteral("parse_validate_analog"), frames, [&](qint64) {
+        bool complete = false;
+        while (!complete) {
+            offset += parser.feed(data + offset, qMin(BENCH_READ_CHUNK, size - offset), &complete);
+            if (offset == size) {
+                offset = 0;
+            }
+        }
+
+        const QByteArray frame = parser.frame();
+        if (!validFrame(frame.constData(), frame.size())) {
+            invalid++;
+        }
+        return frame.size();
+    });
+
+    /* CHKSUM over one analog reply, byte loop against vector kernel */
+    const qint64 frameSize = size / BENCH_STREAM_FRAMES;
+    const qint64 sumSize = frameSize - 1 - BMS_FRAME_TRAILER_SIZE;
+
+    benchRun(QStringLiteral("checksum_scalar"), frames, [&](qint64 i) {
+        const char* frame = data + (i % BENCH_STREAM_FRAMES) * frameSize;
+        benchKeep(CSBmsProtocol::byteSumScalar(frame + 1, sumSize));
+        return sumSize;
+    });
+
+    benchRun(QStringLiteral("checksum_vector"), frames, [&](qint64 i) {
+        const char* frame = data + (i % BENCH_STREAM_FRAMES) * frameSize;
+        benchKeep(CSBmsProtocol::byteSum(frame + 1, sumSize));
+        return sumSize;
+    });
+
+    if (invalid || parser.discarded()) {
+        QTextStream(stderr) << "parser: " << invalid << " invalid frames, " //
+                            << parser.discarded() << " bytes discarded" << Qt::endl;
+    }
+    return invalid == 0 && parser.discarded() == 0;
+}
+
+/* Received traffic of a capture file, fed in the chunks the port
+ * delivered them. Passes over the file are repeated until 'frames'
+ * frames have been extracted and validated. Field traffic may hold
+ * the odd garbled reply; false if there are no frames or most of
+ * them are invalid. */
+bool benchParserCapture(qint64 frames, const QString& fileName)
+{
+    CSBmsCaptureReader reader;
+    CSBmsCaptureReader::TRecord record;
+    CSBmsFrameParser parser;
+    TBenchResult r = {QStringLiteral("parse_validate_capture"), 0, 0, 0, 0};
+    QElapsedTimer timer;
+    qint64 invalid = 0;
+
+    if (!reader.open(fileName)) {
+        QTextStream(stderr) << "parser: unable to open capture " << fileName << Qt::endl;
+        return false;
+    }
+
+    const quint64 allocs = benchAllocations();
+    timer.start();
+    while (r.frames < frames) {
+        const qint64 before = r.frames;
+
+        while (r.frames < frames && reader.next(record)) {
+            if (record.type != CSBmsCapture::RecordRx) {
+                continue;
+            }
+
+            qint64 offset = 0;
+            while (offset < record.size) {
+                bool complete = false;
+                offset += parser.feed(record.data + offset, record.size - offset, &complete);
+                if (complete) {
+                    const QByteArray frame = parser.frame();
+                    if (!validFrame(frame.constData(), frame.size())) {
+                        invalid++;
+                    }
+                    r.frames++;
+                }
+            }
+            r.bytes += record.size;
+        }
+
+        /* not a single reply in the file */
+        if (r.frames == before) {
+            break;
+        }
+        reader.rewind();
+    }
+    r.elapsedNs = timer.nsecsElapsed();
+    r.allocs = benchAllocations() - allocs;
+
+    benchReport(r);
+    if (invalid || parser.discarded()) {
+        QTextStream(stderr) << "parser capture: " << invalid << " invalid frames, " //
+                            << parser.discarded() << " bytes discarded" << Qt::endl;
+    }
+    return r.frames > 0 && invalid * 2 <= r.frames;
+}
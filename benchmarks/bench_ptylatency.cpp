@@ -0,0 +1,171 @@
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
+#include <cssupervoltbmsdevice.h>
+#include <functional>
+#include <simulator/csbmssimulator.h>
+#include <time.h>
+#include "benchmark.h"
+
+/* ms to watch the event loop after a hangup */
+static const int BENCH_HANGUP_WAIT = 500;
+
+static inline QString backendName(CSSuperVoltBmsDevice::PortBackend backend)
+{
+    return (backend == CSSuperVoltBmsDevice::NativePort) ? QStringLiteral("native") : QStringLiteral("qserialport");
+}
+
+static inline void setupDevice(CSSuperVoltBmsDevice& device, const QString& portName, CSSuperVoltBmsDevice::PortBackend backend)
+{
+    CSSuperVoltBmsDevice::TPortConfig config = device.config();
+    config.portName = portName;
+    config.baudRate = QSerialPort::Baud115200;
+    config.dataBits = QSerialPort::Data8;
+    config.stopBits = QSerialPort::OneStop;
+    config.parity = QSerialPort::NoParity;
+    config.flowCtrl = QSerialPort::NoFlowControl;
+    config.backend = backend;
+    config.lowLatency = true;
+    device.setConfig(config);
+}
+
+/* Request to reply latency over a pseudo terminal, the simulator
+ * on the master side, the device on the slave side through either
+ * port backend. Both run in this thread, so absolute numbers carry
+ * the simulator's share; the difference between the backends is
+ * what counts. With 'frameGap' the gap timer runs on every partial
+ * read, the CPU time shows what it costs. */
+static bool runBackend(CSBmsSimulator& sim, CSSuperVoltBmsDevice::PortBackend backend, qreal frameGap, qint64 frames)
+{
+    CSSuperVoltBmsDevice device;
+    setupDevice(device, sim.slaveName(), backend);
+    device.setFrameGap(frameGap);
+
+    if (!device.open()) {
+        QTextStream(stderr) << "ptylatency: unable to open " << sim.slaveName() << Qt::endl;
+        return false;
+    }
+
+    const QString name = backendName(backend) + (frameGap > 0 ? QStringLiteral("_gap") : QString());
+    TBenchResult r = {QStringLiteral("pty_roundtrip_%1").arg(name), frames, 0, 0, 0};
+    QVector<qint64> latency;
+    QEventLoop loop;
+    QElapsedTimer timer;
+    qint64 done = 0;
+    qint64 failed = 0;
+
+    latency.reserve(frames);
+
+    std::function<void()> next = [&]() {
+        if (done == frames) {
+            loop.quit();
+            return;
+        }
+        device.fetchAnalogData()
+           .then(&device,
+                 [&](const CSSuperVoltBmsDevice::TResponse& rsp) {
+                     latency.append(rsp.latencyNs);
+                     r.bytes += rsp.frame.size();
+                     done++;
+                     next();
+                 })
+           .onFailed(&device, [&](const CSBmsException&) {
+               failed++;
+               done++;
+               next();
+           });
+    };
+
+    const quint64 allocs = benchAllocations();
+    const clock_t cpu = clock();
+    timer.start();
+    QMetaObject::invokeMethod(&loop, next, Qt::QueuedConnection);
+    loop.exec();
+    r.elapsedNs = timer.nsecsElapsed();
+    r.allocs = benchAllocations() - allocs;
+    const qint64 cpuMs = qint64(clock() - cpu) * 1000 / CLOCKS_PER_SEC;
+
+    benchReport(r);
+    benchReportLatency(r.name, latency);
+    QTextStream(stdout) << QStringLiteral("{\"bench\":\"%1_cpu\",\"cpu_ms\":%2,\"wall_ms\":%3}")
+                              .arg(r.name)
+                              .arg(cpuMs)
+                              .arg(r.elapsedNs / 1000000)
+                        << Qt::endl;
+    if (failed) {
+        QTextStream(stderr) << "ptylatency " << name << ": " << failed << " requests failed" << Qt::endl;
+    }
+
+    device.close();
+    return failed == 0;
+}
+
+/* The adapter goes away while the device is open: the master side
+ * closes, which hangs up every slave descriptor. The device must
+ * report 'disconnected' once, and the event loop must go idle
+ * instead of spinning on a dead descriptor; the CPU time spent in
+ * the wait window shows which one it did. */
+static bool runHangup(CSSuperVoltBmsDevice::PortBackend backend)
+{
+    CSBmsSimulator sim;
+    CSSuperVoltBmsDevice device;
+    QEventLoop loop;
+    int disconnected = 0;
+
+    if (!sim.open()) {
+        QTextStream(stderr) << "ptyhangup: no pseudo terminal" << Qt::endl;
+        return false;
+    }
+
+    setupDevice(device, sim.slaveName(), backend);
+    if (!device.open()) {
+        QTextStream(stderr) << "ptyhangup: unable to open " << sim.slaveName() << Qt::endl;
+        return false;
+    }
+
+    QObject::connect(&device, &CSSuperVoltBmsDevice::disconnected, &loop, [&disconnected]() { disconnected++; });
+
+    const clock_t cpu = clock();
+    QTimer::singleShot(0, &loop, [&sim]() { sim.close(); });
+    QTimer::singleShot(BENCH_HANGUP_WAIT, &loop, &QEventLoop::quit);
+    loop.exec();
+    const qint64 cpuMs = qint64(clock() - cpu) * 1000 / CLOCKS_PER_SEC;
+
+    QTextStream(stdout) << QStringLiteral("{\"bench\":\"pty_hangup_%1\",\"disconnected\":%2,\"wait_ms\":%3,\"cpu_ms\":%4}")
+                              .arg(backendName(backend))
+                              .arg(disconnected)
+                              .arg(BENCH_HANGUP_WAIT)
+                              .arg(cpuMs)
+                        << Qt::endl;
+    const bool ok = (disconnected == 1 && cpuMs <= BENCH_HANGUP_WAIT / 2);
+    if (!ok) {
+        QTextStream(stderr) << "ptyhangup " << backendName(backend) << ": hangup not handled" << Qt::endl;
+    }
+
+    device.close();
+    return ok;
+}
+
+bool benchPtyLatency(qint64 frames)
+{
+    CSBmsSimulator sim;
+    sim.setLatency(0, 0);
+
+    if (!sim.open()) {
+        QTextStream(stderr) << "ptylatency: no pseudo terminal" << Qt::endl;
+        return false;
+    }
+
+    bool ok = runBackend(sim, CSSuperVoltBmsDevice::QtSerialPort, 0.0, frames);
+    ok = runBackend(sim, CSSuperVoltBmsDevice::NativePort, 0.0, frames) && ok;
+
+    /* the frame gap before / after, 3.5 character times (floored) */
+    ok = runBackend(sim, CSSuperVoltBmsDevice::NativePort, 3.5, frames) && ok;
+
+    ok = runHangup(CSSuperVoltBmsDevice::QtSerialPort) && ok;
+    ok = runHangup(CSSuperVoltBmsDevice::NativePort) && ok;
+    return ok;
+}
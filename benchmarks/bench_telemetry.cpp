@@ -0,0 +1,116 @@
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <csbmstelemetry.h>
+#include <csbmstelemetryrollup.h>
+#include <limits>
+#include <string.h>
+#include "benchmark.h"
+
+/* packs appended round robin, like a full rack on one store */
+static const int BENCH_TELEMETRY_PACKS = 16;
+/* buckets a chart of the whole range may show */
+static const int BENCH_TELEMETRY_POINTS = 720;
+
+/* slowly drifting cells, a noisy current, 1 s scan interval */
+static void benchTelemetryPacks(CSSuperVoltBmsDevice::TAnalogData* packs)
+{
+    for (int p = 0; p < BENCH_TELEMETRY_PACKS; p++) {
+        CSSuperVoltBmsDevice::TAnalogData& data = packs[p];
+        memset(&data, 0, sizeof(data));
+        data.address = p + 1;
+        data.cellCount = 16;
+        data.tempCount = 4;
+        data.voltage = 53200;
+        data.totalCapacity = 100000;
+        data.remainCapacity = 60000;
+        data.soc = 60;
+        for (int c = 0; c < data.cellCount; c++) {
+            data.cellVoltage[c] = 3320 + c;
+        }
+        for (int t = 0; t < data.tempCount; t++) {
+            data.temperature[t] = 250 + t;
+        }
+    }
+}
+
+static CSSuperVoltBmsDevice::TAnalogData& benchTelemetryRow(CSSuperVoltBmsDevice::TAnalogData* packs, qint64 i)
+{
+    static const qint64 start = 1700000000000LL;
+    CSSuperVoltBmsDevice::TAnalogData& data = packs[i % BENCH_TELEMETRY_PACKS];
+    const qint64 step = i / BENCH_TELEMETRY_PACKS;
+
+    data.timestamp = start + step * 1000 + (step * 7) % 5;
+    data.cellVoltage[step % data.cellCount] += (step & 1) ? 1 : -1;
+    data.current = -12000 + int((step * 7919) % 400);
+    return data;
+}
+
+bool benchTelemetry(qint64 frames)
+{
+    QTemporaryDir dir;
+    CSBmsTelemetryStore store;
+
+    if (!dir.isValid() || !store.open(dir.path())) {
+        QTextStream(stderr) << "telemetry: unable to open a store" << Qt::endl;
+        return false;
+    }
+
+    CSSuperVoltBmsDevice::TAnalogData packs[BENCH_TELEMETRY_PACKS];
+    benchTelemetryPacks(packs);
+
+    qint64 failed = 0;
+    benchRun(QStringLiteral("telemetry_append"), frames, [&](qint64 i) {
+        if (!store.append(QStringLiteral("BUS-0"), benchTelemetryRow(packs, i))) {
+            failed++;
+        }
+        return qint64(sizeof(CSSuperVoltBmsDevice::TAnalogData));
+    });
+    store.seal(0);
+
+    if (failed) {
+        QTextStream(stderr) << "telemetry: " << failed << " rows not stored" << Qt::endl;
+    }
+
+    const CSBmsTelemetryStore::TStatistics s = store.statistics();
+    QTextStream(stdout) << QStringLiteral("{\"bench\":\"telemetry_size\",\"rows\":%1,\"raw_bytes\":%2,\"stored_bytes\":%3,\"bytes_per_row\":%4}")
+                              .arg(s.rows)
+                              .arg(s.rawBytes)
+                              .arg(s.storedBytes)
+                              .arg(s.rows ? double(s.storedBytes) / s.rows : 0.0, 0, 'f', 2)
+                        << Qt::endl;
+
+    /* decode everything of one pack, blocks mapped from disk */
+    const qint64 queries = qMax(1LL, frames / (BENCH_TELEMETRY_PACKS * 1000));
+    benchRun(QStringLiteral("telemetry_query_pack"), queries, [&](qint64 i) {
+        const auto rows = store.query(QStringLiteral("BUS-0"), quint8(1 + i % BENCH_TELEMETRY_PACKS), 0, std::numeric_limits<qint64>::max());
+        benchKeep(rows.size());
+        return qint64(rows.size() * sizeof(CSSuperVoltBmsDevice::TAnalogData));
+    });
+
+    /* the same rows into the rollup tiers */
+    CSBmsTelemetryRollup rollup;
+    if (!rollup.open(dir.path() + QStringLiteral("/rollup"))) {
+        QTextStream(stderr) << "telemetry: unable to open the rollups" << Qt::endl;
+        return false;
+    }
+
+    benchTelemetryPacks(packs);
+    benchRun(QStringLiteral("telemetry_rollup_append"), frames, [&](qint64 i) {
+        rollup.append(QStringLiteral("BUS-0"), benchTelemetryRow(packs, i));
+        return qint64(sizeof(CSSuperVoltBmsDevice::TAnalogData));
+    });
+    rollup.seal(0);
+
+    /* cell imbalance of the whole rack over the whole range */
+    benchRun(QStringLiteral("telemetry_rollup_rack_spread"), queries, [&](qint64) {
+        qint64 points = 0;
+        for (int p = 0; p < BENCH_TELEMETRY_PACKS; p++) {
+            const auto spread = rollup.query(QStringLiteral("BUS-0"), quint8(1 + p), CSBmsTelemetryRollup::MtCellSpread, 0, 0, std::numeric_limits<qint64>::max() / 2, BENCH_TELEMETRY_POINTS);
+            points += spread.size();
+        }
+        benchKeep(points);
+        return qint64(points * sizeof(CSBmsTelemetryRollup::TPoint));
+    });
+
+    return failed == 0;
+}
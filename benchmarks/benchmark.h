@@ -0,0 +1,105 @@
+#pragma once
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QString>
+#include <QTextStream>
+#include <QVector>
+#include <algorithm>
+
+/* Tiny benchmark harness. Every result is printed as one JSON
+ * object per line so runs can be compared by scripts. */
+
+/* heap allocations so far, counted by the operator new in main.cpp */
+quint64 benchAllocations();
+
+/* keep the optimizer from dropping benchmarked work */
+template <typename T>
+inline void benchKeep(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+typedef struct {
+    QString name;
+    qint64 frames;
+    qint64 bytes;
+    qint64 elapsedNs;
+    quint64 allocs;
+} TBenchResult;
+
+inline void benchReport(const TBenchResult& r)
+{
+    QTextStream out(stdout);
+    const double nsPerFrame = r.frames ? double(r.elapsedNs) / r.frames : 0.0;
+    const double framesPerSec = r.elapsedNs ? r.frames * 1e9 / r.elapsedNs : 0.0;
+    const double allocsPerFrame = r.frames ? double(r.allocs) / r.frames : 0.0;
+
+    out << QStringLiteral("{\"bench\":\"%1\",\"frames\":%2,\"bytes\":%3," //
+                          "\"ns_per_frame\":%4,\"frames_per_s\":%5,\"allocs_per_frame\":%6}")
+              .arg(r.name)
+              .arg(r.frames)
+              .arg(r.bytes)
+              .arg(nsPerFrame, 0, 'f', 2)
+              .arg(framesPerSec, 0, 'f', 0)
+              .arg(allocsPerFrame, 0, 'f', 2)
+        << Qt::endl;
+}
+
+/* percentiles of per request latencies, one more JSON line */
+inline void benchReportLatency(const QString& name, QVector<qint64> samples)
+{
+    if (samples.isEmpty()) {
+        return;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    const auto at = [&samples](double p) { return samples.at(qMin<qsizetype>(samples.size() - 1, qsizetype(samples.size() * p))); };
+
+    QTextStream(stdout) << QStringLiteral("{\"bench\":\"%1\",\"samples\":%2,\"p50_ns\":%3,\"p99_ns\":%4,\"max_ns\":%5}")
+                              .arg(name + QStringLiteral("_latency"))
+                              .arg(samples.size())
+                              .arg(at(0.50))
+                              .arg(at(0.99))
+                              .arg(samples.last())
+                        << Qt::endl;
+}
+
+/* run 'fn' for 'frames' iterations and report */
+template <typename F>
+inline TBenchResult benchRun(const QString& name, qint64 frames, F fn)
+{
+    TBenchResult r = {name, frames, 0, 0, 0};
+    QElapsedTimer timer;
+    const quint64 allocs = benchAllocations();
+
+    timer.start();
+    for (qint64 i = 0; i < frames; i++) {
+        r.bytes += fn(i);
+    }
+    r.elapsedNs = timer.nsecsElapsed();
+    r.allocs = benchAllocations() - allocs;
+
+    benchReport(r);
+    return r;
+}
+
+/* Every benchmark also checks what it measured (encoders agree,
+ * frames parse and decode, requests get replies, ...) and returns
+ * false if that fails, svbmsbench then exits with 1. */
+bool benchEncoder(qint64 frames);
+bool benchParser(qint64 frames);
+bool benchDecoder(qint64 frames);
+bool benchLoopback(qint64 frames);
+bool benchPtyLatency(qint64 frames);
+bool benchTelemetry(qint64 frames);
+
+/* also a self check of the /metrics endpoint */
+bool benchMetrics(qint64 frames);
+
+/* the same paths on the recorded traffic of a capture file, both
+ * fail if most frames are invalid or most requests get no reply */
+bool benchParserCapture(qint64 frames, const QString& fileName);
+bool benchReplay(qint64 frames, const QString& fileName);
+
+/* back to back analog data replies of a simulated pack */
+QByteArray benchAnalogReplies(int count);
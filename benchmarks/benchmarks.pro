@@ -0,0 +1,57 @@
+QT = core
+QT += serialport
+QT += network
+
+CONFIG += c++17
+CONFIG += console
+CONFIG += release
+CONFIG -= app_bundle
+
+TARGET = svbmsbench
+
+INCLUDEPATH += \
+	.. \
+	/usr/local/include
+
+QMAKE_LIBDIR += /usr/local/lib
+
+LIBS += -lpiplatesio
+
+SOURCES += \
+	../csbmscapture.cpp \
+	../csbmsframebuilder.cpp \
+	../csbmsframeparser.cpp \
+	../csbmsmetrics.cpp \
+	../csbmsmetricsserver.cpp \
+	../csbmsnativeport.cpp \
+	../csbmsreplaydevice.cpp \
+	../csbmstelemetry.cpp \
+	../csbmstelemetryrollup.cpp \
+	../cssupervoltbmsdevice.cpp \
+	../simulator/csbmssimengine.cpp \
+	../simulator/csbmssimulator.cpp \
+	bench_decoder.cpp \
+	bench_encoder.cpp \
+	bench_loopback.cpp \
+	bench_metrics.cpp \
+	bench_parser.cpp \
+	bench_ptylatency.cpp \
+	bench_telemetry.cpp \
+	main.cpp
+
+HEADERS += \
+	../csbmscapture.h \
+	../csbmsframebuilder.h \
+	../csbmsframeparser.h \
+	../csbmsmetrics.h \
+	../csbmsmetricsserver.h \
+	../csbmsnativeport.h \
+	../csbmsprotocol.h \
+	../csbmsreplaydevice.h \
+	../csbmsring.h \
+	../csbmstelemetry.h \
+	../csbmstelemetryrollup.h \
+	../cssupervoltbmsdevice.h \
+	../simulator/csbmssimengine.h \
+	../simulator/csbmssimulator.h \
+	benchmark.h
@@ -0,0 +1,108 @@
+#include <QCoreApplication>
+#include <QStringList>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include "benchmark.h"
+
+/* ----------------------------------------------------------
+ *  Allocation counter, every heap allocation of the process
+ *  goes through these
+ * ---------------------------------------------------------- */
+
+static std::atomic<quint64> g_allocations(0);
+
+quint64 benchAllocations()
+{
+    return g_allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+/* svbmsbench [frames] [encoder|parser|decoder|loopback|ptylatency|telemetry|metrics ...]
+ *            [capture=<file>]   parser and loopback also on recorded traffic
+ * Exits with 1 if a self check of any benchmark failed. */
+int main(int argc, char* argv[])
+{
+    QCoreApplication a(argc, argv);
+    qint64 frames = 1000000;
+
+    QStringList args = a.arguments();
+    args.removeFirst();
+    if (!args.isEmpty()) {
+        frames = qMax(1LL, args.takeFirst().toLongLong());
+    }
+
+    QString capture;
+    for (int i = args.size() - 1; i >= 0; i--) {
+        if (args.at(i).startsWith(QStringLiteral("capture="))) {
+            capture = args.takeAt(i).mid(8);
+        }
+    }
+
+    const bool all = args.isEmpty();
+    bool ok = true;
+    if (all || args.contains("encoder")) {
+        ok = benchEncoder(frames) && ok;
+    }
+    if (all || args.contains("parser")) {
+        ok = benchParser(frames) && ok;
+        if (!capture.isEmpty()) {
+            ok = benchParserCapture(frames, capture) && ok;
+        }
+    }
+    if (all || args.contains("decoder")) {
+        ok = benchDecoder(frames) && ok;
+    }
+    if (all || args.contains("loopback")) {
+        /* goes through the event loop, keep it short */
+        ok = benchLoopback(qMax(1LL, frames / 10)) && ok;
+        if (!capture.isEmpty()) {
+            ok = benchReplay(qMax(1LL, frames / 10), capture) && ok;
+        }
+    }
+    if (all || args.contains("ptylatency")) {
+        /* real syscalls per round trip */
+        ok = benchPtyLatency(qMax(1LL, frames / 100)) && ok;
+    }
+    if (all || args.contains("telemetry")) {
+        ok = benchTelemetry(frames) && ok;
+    }
+    if (all || args.contains("metrics")) {
+        ok = benchMetrics(frames) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
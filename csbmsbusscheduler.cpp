@@ -0,0 +1,356 @@
+#include <QDebug>
+#include <csbmsbusscheduler.h>
+#include <limits>
+
+/* ms overdue per priority level gained */
+static const qint64 BUS_AGING_STEP = 1000;
+
+/* due of a once per start task that was sent */
+static const qint64 BUS_DUE_NEVER = std::numeric_limits<qint64>::max();
+
+CSBmsBusScheduler::CSBmsBusScheduler(CSSuperVoltBmsDevice* device, QObject* parent)
+    : QObject(parent)
+    , m_device(device)
+    , m_addresses()
+    , m_commands()
+    , m_tasks()
+    , m_state()
+    , m_clock()
+    , m_window()
+    , m_pollTimer(this)
+    , m_rateTimer(this)
+    , m_minFrameGap(0)
+    , m_portErrors(0)
+    , m_policy({2, 250, 4000, 10000})
+    , m_running(false)
+    , m_busy(false)
+{
+    m_pollTimer.setSingleShot(true);
+    m_pollTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_pollTimer, &QTimer::timeout, this, &CSBmsBusScheduler::onPollTimer);
+
+    m_rateTimer.setInterval(1000);
+    connect(&m_rateTimer, &QTimer::timeout, this, &CSBmsBusScheduler::onRateTimer);
+
+    m_clock.start();
+}
+
+CSBmsBusScheduler::~CSBmsBusScheduler()
+{
+    stop();
+}
+
+CSSuperVoltBmsDevice* CSBmsBusScheduler::device() const
+{
+    return m_device;
+}
+
+void CSBmsBusScheduler::setAddresses(const QList<quint8>& addresses)
+{
+    m_addresses = addresses;
+    rebuildTasks();
+}
+
+QList<quint8> CSBmsBusScheduler::addresses() const
+{
+    return m_addresses;
+}
+
+void CSBmsBusScheduler::setCommands(const QList<TCommand>& commands)
+{
+    m_commands = commands;
+    rebuildTasks();
+}
+
+void CSBmsBusScheduler::addCommand(quint8 cid2, int interval, int priority)
+{
+    m_commands.append({cid2, interval, priority});
+    rebuildTasks();
+}
+
+QList<CSBmsBusScheduler::TCommand> CSBmsBusScheduler::commands() const
+{
+    return m_commands;
+}
+
+void CSBmsBusScheduler::setMinFrameGap(int msecs)
+{
+    m_minFrameGap = qMax(0, msecs);
+}
+
+int CSBmsBusScheduler::minFrameGap() const
+{
+    return m_minFrameGap;
+}
+
+void CSBmsBusScheduler::setRetryPolicy(const TRetryPolicy& policy)
+{
+    m_policy.retries = qMax(0, policy.retries);
+    m_policy.backoffBase = qMax(0, policy.backoffBase);
+    m_policy.backoffMax = qMax(m_policy.backoffBase, policy.backoffMax);
+    m_policy.probeInterval = qMax(0, policy.probeInterval);
+}
+
+CSBmsBusScheduler::TRetryPolicy CSBmsBusScheduler::retryPolicy() const
+{
+    return m_policy;
+}
+
+void CSBmsBusScheduler::setBackoff(int baseMsecs, int maxMsecs)
+{
+    m_policy.backoffBase = qMax(0, baseMsecs);
+    m_policy.backoffMax = qMax(m_policy.backoffBase, maxMsecs);
+}
+
+CSBmsBusScheduler::Health CSBmsBusScheduler::health(quint8 address) const
+{
+    return m_state.value(address).health;
+}
+
+double CSBmsBusScheduler::scanRate(quint8 address) const
+{
+    return m_state.value(address).rate;
+}
+
+void CSBmsBusScheduler::start()
+{
+    if (m_running) {
+        return;
+    }
+
+    /* once per start tasks, the device dropped its cache on open */
+    for (int i = 0; i < m_tasks.size(); i++) {
+        if (m_tasks.at(i).due == BUS_DUE_NEVER) {
+            m_tasks[i].due = 0;
+        }
+    }
+
+    m_running = true;
+    m_portErrors = 0;
+    m_window.start();
+    m_rateTimer.start();
+    pollNext();
+}
+
+void CSBmsBusScheduler::stop()
+{
+    m_running = false;
+    m_pollTimer.stop();
+    m_rateTimer.stop();
+}
+
+bool CSBmsBusScheduler::isRunning() const
+{
+    return m_running;
+}
+
+void CSBmsBusScheduler::onPollTimer()
+{
+    pollNext();
+}
+
+void CSBmsBusScheduler::onRateTimer()
+{
+    const qint64 elapsed = m_window.restart();
+    if (elapsed <= 0) {
+        return;
+    }
+
+    for (auto it = m_state.begin(); it != m_state.end(); it++) {
+        it->rate = it->windowResponses * 1000.0 / elapsed;
+        it->windowResponses = 0;
+        emit scanRateChanged(it.key(), it->rate);
+    }
+}
+
+/* one task per (address, command), all due immediately */
+inline void CSBmsBusScheduler::rebuildTasks()
+{
+    m_tasks.clear();
+    m_tasks.reserve(m_addresses.size() * m_commands.size());
+
+    foreach (quint8 address, m_addresses) {
+        foreach (const TCommand& cmd, m_commands) {
+            m_tasks.append({address, cmd.cid2, cmd.interval, cmd.priority, 0});
+        }
+        if (!m_state.contains(address)) {
+            m_state.insert(address, {Online, 0, 0, 0, 0, 0, 0, 0, 0.0});
+        }
+    }
+
+    foreach (quint8 address, m_state.keys()) {
+        if (!m_addresses.contains(address)) {
+            m_state.remove(address);
+        }
+    }
+}
+
+/* a once per start task got no reply, due again (after the backoff) */
+inline void CSBmsBusScheduler::rearm(quint8 address, quint8 cid2)
+{
+    for (int i = 0; i < m_tasks.size(); i++) {
+        TTask& task = m_tasks[i];
+        if (task.address == address && task.cid2 == cid2 && task.due == BUS_DUE_NEVER) {
+            task.due = m_clock.elapsed();
+        }
+    }
+}
+
+inline void CSBmsBusScheduler::pollNext()
+{
+    if (!m_running || m_busy || m_tasks.isEmpty()) {
+        return;
+    }
+
+    const qint64 now = m_clock.elapsed();
+    qint64 wait = -1;
+    qint64 bestPriority = 0;
+    qint64 bestDue = 0;
+    int next = -1;
+
+    for (int i = 0; i < m_tasks.size(); i++) {
+        const TTask& task = m_tasks.at(i);
+        if (task.due == BUS_DUE_NEVER) {
+            continue;
+        }
+
+        const qint64 due = qMax(task.due, m_state.value(task.address).skipUntil);
+        if (due > now) {
+            wait = (wait < 0 ? due - now : qMin(wait, due - now));
+            continue;
+        }
+
+        /* aging: one level more per step overdue */
+        const qint64 priority = task.priority + (now - due) / BUS_AGING_STEP;
+        if (next < 0 || priority > bestPriority || (priority == bestPriority && due < bestDue)) {
+            next = i;
+            bestPriority = priority;
+            bestDue = due;
+        }
+    }
+
+    /* nothing due, sleep until the earliest task */
+    if (next < 0) {
+        if (wait >= 0) {
+            m_pollTimer.start(wait);
+        }
+        return;
+    }
+
+    TTask& task = m_tasks[next];
+    const quint8 address = task.address;
+    const quint8 cid2 = task.cid2;
+
+    const bool once = (task.interval <= 0 && CSSuperVoltBmsDevice::isStaticInfo(cid2));
+    task.due = (once ? BUS_DUE_NEVER : now + task.interval);
+    m_busy = true;
+
+    /* probe time for an offline address, this request is the probe */
+    auto it = m_state.find(address);
+    if (it != m_state.end() && it->health == Offline) {
+        setHealth(address, *it, Probing);
+    }
+
+    m_device->execute(address, cid2)
+       .then(this,
+             [this, address](const CSSuperVoltBmsDevice::TResponse& rsp) {
+                 if (rsp.cached) {
+                     /* served from the device's info cache, the bus was
+                      * not used: no health or scan rate update */
+                     m_busy = false;
+                     if (m_running) {
+                         m_pollTimer.start(m_minFrameGap);
+                     }
+                 }
+                 else {
+                     completed(address, CSSuperVoltBmsDevice::NoError, true);
+                 }
+                 emit responseReceived(rsp);
+             })
+       .onFailed(this, [this, address, cid2](const CSBmsException& e) {
+           /* a pack that rejects the command won't change its mind */
+           if (!e.replied()) {
+               rearm(address, cid2);
+           }
+           completed(address, e.error(), e.replied());
+           emit requestFailed(address, cid2, e.error());
+       });
+}
+
+inline void CSBmsBusScheduler::completed(quint8 address, CSSuperVoltBmsDevice::BmsError error, bool replied)
+{
+    auto it = m_state.find(address);
+    if (it != m_state.end()) {
+        if (replied) {
+            /* a decoded reply, even with an RTN error code, means the
+             * pack is there; only data counts towards the scan rate */
+            it->misses = 0;
+            it->skipUntil = 0;
+            if (error == CSSuperVoltBmsDevice::NoError) {
+                it->responses++;
+                it->windowResponses++;
+            }
+            else {
+                it->rejected++;
+            }
+            setHealth(address, *it, Online);
+        }
+        else if (error == CSSuperVoltBmsDevice::TimeoutError || error < CSSuperVoltBmsDevice::UserErrorFirst) {
+            /* no reply or one garbled on the line: both are misses */
+            it->misses++;
+            if (error == CSSuperVoltBmsDevice::TimeoutError) {
+                it->timeouts++;
+            }
+            else {
+                it->garbled++;
+            }
+
+            if (it->health == Probing || it->misses > m_policy.retries) {
+                /* nobody home, keep the circuit open until the next probe */
+                it->skipUntil = m_clock.elapsed() + m_policy.probeInterval;
+                setHealth(address, *it, Offline);
+            }
+            else {
+                it->skipUntil = m_clock.elapsed() + backoff(it->misses);
+                setHealth(address, *it, Retrying);
+            }
+        }
+    }
+
+    /* The port itself failed (write error, not open, ...). It may
+     * fail the same way right away, back off the whole bus instead
+     * of polling in a loop. */
+    qint64 gap = m_minFrameGap;
+    if (!replied && error >= CSSuperVoltBmsDevice::UserErrorFirst && error != CSSuperVoltBmsDevice::TimeoutError) {
+        m_portErrors++;
+        gap = qMax(gap, backoff(m_portErrors));
+    }
+    else {
+        m_portErrors = 0;
+    }
+
+    m_busy = false;
+
+    if (m_running) {
+        m_pollTimer.start(int(gap));
+    }
+}
+
+/* base, 2 * base, 4 * base ... up to the limit */
+inline qint64 CSBmsBusScheduler::backoff(int misses) const
+{
+    const int shift = qBound(0, misses - 1, 16);
+    return qMin<qint64>(m_policy.backoffMax, qint64(m_policy.backoffBase) << shift);
+}
+
+inline void CSBmsBusScheduler::setHealth(quint8 address, TAddressState& state, Health health)
+{
+    if (state.health == health) {
+        return;
+    }
+
+    state.health = health;
+    qDebug() << "BMSBUS: Address" << address << "is" << health //
+             << (state.skipUntil ? QStringLiteral("(next try in %1 ms)").arg(state.skipUntil - m_clock.elapsed()) : QString());
+    emit healthChanged(address, health);
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <cssupervoltbmsdevice.h>
+
+/* Polls a set of addresses on one RS485 bus. Every address gets
+ * every command; a command is due again 'interval' ms after it was
+ * sent (0 = as often as possible). Static info the device caches
+ * (CSSuperVoltBmsDevice::isStaticInfo()) with interval 0 is fetched
+ * once per start() instead, repeats would only hit the cache; a
+ * fetch without reply is retried like any other. When several are
+ * due the highest priority wins, ties go to the longest waiting
+ * one. A due command gains one priority level per second it is
+ * overdue, so a busy higher priority delays lower ones but never
+ * starves them. Only one request is in flight, followed by at least
+ * the minimum frame gap. The scheduler must live in the thread of
+ * its device.
+ *
+ * Every address has a health state. A timeout or a garbled reply
+ * (framing or checksum error) is retried after an exponential
+ * backoff; once the retries are used up the address is Offline
+ * (circuit open) and only probed every probe interval, so a missing
+ * pack costs one timeout per probe instead of one per poll. A valid
+ * reply, data or an RTN error code, brings it back Online. Local
+ * port errors (write failed, port not open, ...) don't touch the
+ * address health, the whole bus backs off instead. */
+class CSBmsBusScheduler: public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef struct {
+        quint8 cid2;
+        int interval; /* ms */
+        int priority;
+    } TCommand;
+
+    enum Health {
+        Online = 0,
+        Retrying, /* missed a reply, within the retry budget */
+        Offline,  /* circuit open, waiting for the next probe */
+        Probing,  /* one request on its way to an offline address */
+    };
+    Q_ENUM(Health)
+
+    typedef struct {
+        int retries;     /* misses in a row before going offline */
+        int backoffBase; /* ms after the first timeout, doubled per retry */
+        int backoffMax;  /* ms, upper limit of the retry backoff */
+        int probeInterval; /* ms between probes of an offline address */
+    } TRetryPolicy;
+
+    explicit CSBmsBusScheduler(CSSuperVoltBmsDevice* device, QObject* parent = nullptr);
+    ~CSBmsBusScheduler();
+
+    CSSuperVoltBmsDevice* device() const;
+
+    void setAddresses(const QList<quint8>& addresses);
+    QList<quint8> addresses() const;
+
+    void setCommands(const QList<TCommand>& commands);
+    void addCommand(quint8 cid2, int interval, int priority);
+    QList<TCommand> commands() const;
+
+    void setMinFrameGap(int msecs);
+    int minFrameGap() const;
+
+    void setRetryPolicy(const TRetryPolicy& policy);
+    TRetryPolicy retryPolicy() const;
+
+    /* shorthand for the backoff part of the retry policy */
+    void setBackoff(int baseMsecs, int maxMsecs);
+
+    Health health(quint8 address) const;
+
+    /* successful bus transactions per second over the last report
+     * period, replies from the device's info cache don't count */
+    double scanRate(quint8 address) const;
+
+    void start();
+    void stop();
+    bool isRunning() const;
+
+signals:
+    void responseReceived(const CSSuperVoltBmsDevice::TResponse&);
+    void requestFailed(quint8 address, quint8 cid2, CSSuperVoltBmsDevice::BmsError);
+    void scanRateChanged(quint8 address, double rate);
+    void healthChanged(quint8 address, CSBmsBusScheduler::Health health);
+
+private slots:
+    void onPollTimer();
+    void onRateTimer();
+
+private:
+    typedef struct {
+        quint8 address;
+        quint8 cid2;
+        int interval;
+        int priority;
+        qint64 due;
+    } TTask;
+
+    typedef struct {
+        Health health;
+        int misses;
+        qint64 skipUntil;
+        quint64 responses; /* successful transactions */
+        quint64 rejected;  /* valid replies with an RTN error code */
+        quint64 timeouts;
+        quint64 garbled;   /* framing, checksum or decode errors */
+        quint64 windowResponses;
+        double rate;
+    } TAddressState;
+
+    CSSuperVoltBmsDevice* m_device;
+    QList<quint8> m_addresses;
+    QList<TCommand> m_commands;
+    QVector<TTask> m_tasks;
+    QHash<quint8, TAddressState> m_state;
+    QElapsedTimer m_clock;
+    QElapsedTimer m_window;
+    QTimer m_pollTimer;
+    QTimer m_rateTimer;
+    int m_minFrameGap;
+    int m_portErrors; /* local port errors in a row */
+    TRetryPolicy m_policy;
+    bool m_running;
+    bool m_busy;
+
+private:
+    inline void rebuildTasks();
+    inline void rearm(quint8 address, quint8 cid2);
+    inline void pollNext();
+    inline void completed(quint8 address, CSSuperVoltBmsDevice::BmsError error, bool replied);
+    inline void setHealth(quint8 address, TAddressState& state, Health health);
+    inline qint64 backoff(int misses) const;
+};
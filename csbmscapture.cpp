@@ -0,0 +1,228 @@
+#include <QDateTime>
+#include <QDebug>
+#include <QMutexLocker>
+#include <csbmscapture.h>
+#include <string.h>
+
+/* ----------------------------------------------------------
+ *  Writer
+ * ---------------------------------------------------------- */
+
+CSBmsCaptureWriter::CSBmsCaptureWriter()
+    : m_mutex()
+    , m_file()
+    , m_clock()
+    , m_ports()
+{
+}
+
+CSBmsCaptureWriter::~CSBmsCaptureWriter()
+{
+    close();
+}
+
+bool CSBmsCaptureWriter::open(const QString& fileName)
+{
+    QMutexLocker lock(&m_mutex);
+
+    if (m_file.isOpen()) {
+        m_file.close();
+    }
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "BMSCAP: Unable to create" << fileName << m_file.errorString();
+        return false;
+    }
+
+    CSBmsCapture::TFileHeader header = {};
+    memcpy(header.magic, BMS_CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = BMS_CAPTURE_VERSION;
+    header.headerSize = sizeof(header);
+    header.startTime = QDateTime::currentMSecsSinceEpoch();
+
+    m_ports.clear();
+    m_clock.start();
+    return m_file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+}
+
+void CSBmsCaptureWriter::close()
+{
+    QMutexLocker lock(&m_mutex);
+
+    if (m_file.isOpen()) {
+        m_file.flush();
+        m_file.close();
+    }
+}
+
+bool CSBmsCaptureWriter::isOpen() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_file.isOpen();
+}
+
+quint16 CSBmsCaptureWriter::registerPort(const QString& portName)
+{
+    QMutexLocker lock(&m_mutex);
+
+    auto it = m_ports.constFind(portName);
+    if (it != m_ports.constEnd()) {
+        return it.value();
+    }
+
+    const quint16 port = m_ports.size();
+    const QByteArray name = portName.toUtf8();
+    m_ports.insert(portName, port);
+
+    if (m_file.isOpen()) {
+        append(port, CSBmsCapture::RecordPort, 0, name.constData(), name.size());
+    }
+    return port;
+}
+
+void CSBmsCaptureWriter::write(quint16 port, CSBmsCapture::RecordType type, quint8 address, const char* data, qint64 size)
+{
+    QMutexLocker lock(&m_mutex);
+
+    if (m_file.isOpen()) {
+        append(port, type, address, data, size);
+    }
+}
+
+/* QFile buffers, one record is a few small writes into memory */
+inline void CSBmsCaptureWriter::append(quint16 port, quint8 type, quint8 address, const char* data, qint64 size)
+{
+    static const char padding[8] = {};
+
+    CSBmsCapture::TRecordHeader header;
+    header.timestamp = m_clock.nsecsElapsed();
+    header.length = size;
+    header.port = port;
+    header.type = type;
+    header.address = address;
+
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_file.write(data, size);
+    m_file.write(padding, CSBmsCapture::padded(size) - size);
+}
+
+/* ----------------------------------------------------------
+ *  Reader
+ * ---------------------------------------------------------- */
+
+CSBmsCaptureReader::CSBmsCaptureReader()
+    : m_file()
+    , m_map(nullptr)
+    , m_size(0)
+    , m_pos(0)
+    , m_startTime(0)
+    , m_ports()
+{
+}
+
+CSBmsCaptureReader::~CSBmsCaptureReader()
+{
+    close();
+}
+
+bool CSBmsCaptureReader::open(const QString& fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qWarning() << "BMSCAP: Unable to open" << fileName << m_file.errorString();
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(CSBmsCapture::TFileHeader))) {
+        close();
+        return false;
+    }
+
+    if (!(m_map = m_file.map(0, m_size))) {
+        qWarning() << "BMSCAP: Unable to map" << fileName << m_file.errorString();
+        close();
+        return false;
+    }
+
+    const CSBmsCapture::TFileHeader* header = reinterpret_cast<const CSBmsCapture::TFileHeader*>(m_map);
+    if (memcmp(header->magic, BMS_CAPTURE_MAGIC, sizeof(header->magic)) != 0 //
+        || header->version != BMS_CAPTURE_VERSION
+        || header->headerSize < sizeof(CSBmsCapture::TFileHeader)) {
+        qWarning() << "BMSCAP: Not a capture file" << fileName;
+        close();
+        return false;
+    }
+
+    m_startTime = header->startTime;
+    rewind();
+    return true;
+}
+
+void CSBmsCaptureReader::close()
+{
+    if (m_map) {
+        m_file.unmap(const_cast<uchar*>(m_map));
+        m_map = nullptr;
+    }
+    if (m_file.isOpen()) {
+        m_file.close();
+    }
+    m_size = 0;
+    m_pos = 0;
+    m_ports.clear();
+}
+
+bool CSBmsCaptureReader::isOpen() const
+{
+    return m_map != nullptr;
+}
+
+qint64 CSBmsCaptureReader::startTime() const
+{
+    return m_startTime;
+}
+
+QString CSBmsCaptureReader::portName(quint16 port) const
+{
+    return m_ports.value(port);
+}
+
+void CSBmsCaptureReader::rewind()
+{
+    m_pos = m_map ? reinterpret_cast<const CSBmsCapture::TFileHeader*>(m_map)->headerSize : 0;
+}
+
+bool CSBmsCaptureReader::next(TRecord& record)
+{
+    while (m_map && m_pos + qint64(sizeof(CSBmsCapture::TRecordHeader)) <= m_size) {
+        const CSBmsCapture::TRecordHeader* header = //
+           reinterpret_cast<const CSBmsCapture::TRecordHeader*>(m_map + m_pos);
+        const qint64 payload = m_pos + sizeof(CSBmsCapture::TRecordHeader);
+
+        /* truncated tail of a capture that was not closed */
+        if (payload + header->length > m_size) {
+            return false;
+        }
+
+        m_pos = payload + CSBmsCapture::padded(header->length);
+
+        if (header->type == CSBmsCapture::RecordPort) {
+            m_ports.insert(header->port, QString::fromUtf8(reinterpret_cast<const char*>(m_map + payload), header->length));
+            continue;
+        }
+
+        record.timestamp = header->timestamp;
+        record.port = header->port;
+        record.type = static_cast<CSBmsCapture::RecordType>(header->type);
+        record.address = header->address;
+        record.data = reinterpret_cast<const char*>(m_map + payload);
+        record.size = header->length;
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+/* Capture file of raw BMS traffic, append only.
+ *
+ * File:   TFileHeader, then records back to back.
+ * Record: TRecordHeader, payload, zero padding to 8 bytes.
+ *
+ * All fields are host (little) endian and 8 byte aligned, so a
+ * mapped file can be scanned in place. Timestamps are monotonic
+ * nanoseconds since the capture was opened. Port names are stored
+ * once as RecordPort records, RX/TX records refer to their index. */
+
+static const char BMS_CAPTURE_MAGIC[8] = {'S', 'V', 'B', 'M', 'S', 'C', 'A', 'P'};
+static const quint32 BMS_CAPTURE_VERSION = 1;
+
+class CSBmsCapture
+{
+public:
+    enum RecordType : quint8 {
+        RecordRx = 0,
+        RecordTx = 1,
+        RecordPort = 2,
+    };
+
+    typedef struct {
+        char magic[8];
+        quint32 version;
+        quint32 headerSize;
+        qint64 startTime; /* ms since epoch */
+        quint64 reserved;
+    } TFileHeader;
+
+    typedef struct {
+        quint64 timestamp; /* ns since startTime */
+        quint32 length;    /* payload bytes without padding */
+        quint16 port;
+        quint8 type;
+        quint8 address; /* request address in flight, 0 if none */
+    } TRecordHeader;
+
+    static_assert(sizeof(TFileHeader) == 32, "capture file header layout");
+    static_assert(sizeof(TRecordHeader) == 16, "capture record header layout");
+
+    static inline qint64 padded(qint64 length) { return (length + 7) & ~qint64(7); }
+};
+
+/* Thread safe writer, shared by all devices of a process */
+class CSBmsCaptureWriter
+{
+public:
+    CSBmsCaptureWriter();
+    ~CSBmsCaptureWriter();
+
+    bool open(const QString& fileName);
+    void close();
+    bool isOpen() const;
+
+    /* returns the index RX/TX records of this port refer to */
+    quint16 registerPort(const QString& portName);
+
+    void write(quint16 port, CSBmsCapture::RecordType type, quint8 address, const char* data, qint64 size);
+
+private:
+    mutable QMutex m_mutex;
+    QFile m_file;
+    QElapsedTimer m_clock;
+    QHash<QString, quint16> m_ports;
+
+private:
+    inline void append(quint16 port, quint8 type, quint8 address, const char* data, qint64 size);
+};
+
+/* Maps a capture file and walks its records without copying */
+class CSBmsCaptureReader
+{
+public:
+    typedef struct {
+        quint64 timestamp;
+        quint16 port;
+        CSBmsCapture::RecordType type;
+        quint8 address;
+        const char* data;
+        qint64 size;
+    } TRecord;
+
+    CSBmsCaptureReader();
+    ~CSBmsCaptureReader();
+
+    bool open(const QString& fileName);
+    void close();
+    bool isOpen() const;
+
+    qint64 startTime() const;
+    QString portName(quint16 port) const;
+
+    /* RX/TX records in file order, port records are consumed */
+    bool next(TRecord& record);
+    void rewind();
+
+private:
+    QFile m_file;
+    const uchar* m_map;
+    qint64 m_size;
+    qint64 m_pos;
+    qint64 m_startTime;
+    QHash<quint16, QString> m_ports;
+};
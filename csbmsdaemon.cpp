@@ -0,0 +1,330 @@
+#include <QCoreApplication>
+#include <QDebug>
+#include <csbmsdaemon.h>
+#include <csbmsjsonsink.h>
+#include <csbmstelemetrysink.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* self pipe, the signal handler only writes one byte */
+static int s_signalFd[2] = {-1, -1};
+
+static void signalHandler(int)
+{
+    char c = 1;
+    if (::write(s_signalFd[0], &c, sizeof(c)) < 0) {
+        /* nothing to do in a signal handler */
+    }
+}
+
+/* runs in the device thread, retries until the port opens */
+static void openDevice(CSSuperVoltBmsDevice* device, int retryMsecs)
+{
+    if (device->isOpen() || device->open()) {
+        return;
+    }
+    QTimer::singleShot(retryMsecs, device, [device, retryMsecs]() { openDevice(device, retryMsecs); });
+}
+
+CSBmsDaemon::CSBmsDaemon(const QString& configFile, QObject* parent)
+    : QObject(parent)
+    , m_settings(configFile, QSettings::IniFormat, this)
+    , m_ioThreads(nullptr)
+    , m_buses()
+    , m_sinks()
+    , m_metrics()
+    , m_metricsServer(nullptr)
+    , m_capture()
+    , m_flushTimer(this)
+    , m_signalNotifier(nullptr)
+    , m_reconnect(5000)
+{
+    connect(&m_flushTimer, &QTimer::timeout, this, &CSBmsDaemon::onFlushTimer);
+}
+
+CSBmsDaemon::~CSBmsDaemon()
+{
+    stop();
+}
+
+bool CSBmsDaemon::start()
+{
+    if (m_settings.status() != QSettings::NoError) {
+        qDebug() << "BMSD: Unable to read" << m_settings.fileName();
+        return false;
+    }
+
+    m_settings.beginGroup("DAEMON");
+    const int threads = m_settings.value("threads", 0).toInt();
+    m_flushTimer.setInterval(qMax(10, m_settings.value("flushInterval", 1000).toInt()));
+    m_reconnect = qMax(100, m_settings.value("reconnect", 5000).toInt());
+    const QString capture = m_settings.value("capture", "").toString();
+    m_settings.endGroup();
+
+    installSignalHandlers();
+
+    if (!capture.isEmpty() && !m_capture.open(capture)) {
+        qDebug() << "BMSD: Unable to open capture file" << capture;
+        return false;
+    }
+
+    if (!loadSinks()) {
+        return false;
+    }
+
+    if (!startMetrics()) {
+        stop();
+        return false;
+    }
+
+    m_ioThreads = new CSBmsIoThreadPool(threads, this);
+    if (!loadBuses()) {
+        stop();
+        return false;
+    }
+
+    m_flushTimer.start();
+    qDebug() << "BMSD: Polling" << m_buses.size() << "buses on" << m_ioThreads->threadCount() << "threads";
+    return true;
+}
+
+void CSBmsDaemon::stop()
+{
+    m_flushTimer.stop();
+
+    m_buses.clear();
+
+    /* closing a device stops its scheduler, both are deleted
+     * with their thread */
+    if (m_ioThreads) {
+        m_ioThreads->shutdown();
+        delete m_ioThreads;
+        m_ioThreads = nullptr;
+    }
+
+    /* no device writes to it any more */
+    m_capture.close();
+
+    if (m_metricsServer) {
+        delete m_metricsServer;
+        m_metricsServer = nullptr;
+    }
+
+    /* results still queued to us are dropped, flush what arrived */
+    foreach (CSBmsSink* sink, m_sinks) {
+        sink->close();
+        delete sink;
+    }
+    m_sinks.clear();
+}
+
+void CSBmsDaemon::onFlushTimer()
+{
+    foreach (CSBmsSink* sink, m_sinks) {
+        sink->flush();
+    }
+}
+
+void CSBmsDaemon::onSignal()
+{
+    char c;
+    if (::read(s_signalFd[1], &c, sizeof(c)) < 0) {
+        return;
+    }
+
+    qDebug() << "BMSD: Shutting down";
+    stop();
+    QCoreApplication::quit();
+}
+
+inline void CSBmsDaemon::installSignalHandlers()
+{
+    if (s_signalFd[0] >= 0) {
+        return;
+    }
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, s_signalFd) < 0) {
+        qDebug() << "BMSD: No signal socket, SIGTERM kills the daemon";
+        return;
+    }
+
+    m_signalNotifier = new QSocketNotifier(s_signalFd[1], QSocketNotifier::Read, this);
+    connect(m_signalNotifier, &QSocketNotifier::activated, this, &CSBmsDaemon::onSignal);
+
+    struct sigaction action = {};
+    action.sa_handler = signalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+inline bool CSBmsDaemon::loadSinks()
+{
+    foreach (const QString& group, m_settings.childGroups()) {
+        if (!group.startsWith("SINK")) {
+            continue;
+        }
+
+        m_settings.beginGroup(group);
+        const QString type = m_settings.value("type", "jsonl").toString();
+        const QString path = m_settings.value("path", "-").toString();
+        const int bufferSize = m_settings.value("bufferSize", 65536).toInt();
+        const qint64 segmentSize = m_settings.value("segmentSize", BMS_TELEMETRY_SEGMENT_SIZE).toLongLong();
+        const int sealAge = m_settings.value("sealAge", 60000).toInt();
+        m_settings.endGroup();
+
+        CSBmsSink* sink = nullptr;
+        if (type == QStringLiteral("jsonl")) {
+            sink = new CSBmsJsonSink(path, bufferSize);
+        }
+        else if (type == QStringLiteral("telemetry")) {
+            sink = new CSBmsTelemetrySink(path, segmentSize, sealAge);
+        }
+        else {
+            qDebug() << "BMSD:" << group << "unknown sink type" << type;
+            continue;
+        }
+
+        if (!sink->open()) {
+            delete sink;
+            return false;
+        }
+        m_sinks.append(sink);
+    }
+
+    if (m_sinks.isEmpty()) {
+        qDebug() << "BMSD: No sink configured, results go nowhere";
+    }
+    return true;
+}
+
+inline bool CSBmsDaemon::startMetrics()
+{
+    m_settings.beginGroup("METRICS");
+    const quint16 port = m_settings.value("port", 0).toUInt();
+    const QHostAddress address(m_settings.value("bind", "127.0.0.1").toString());
+    m_settings.endGroup();
+
+    if (port == 0) {
+        return true;
+    }
+
+    m_metricsServer = new CSBmsMetricsServer(&m_metrics, this);
+    return m_metricsServer->listen(address, port);
+}
+
+inline bool CSBmsDaemon::loadBuses()
+{
+    foreach (const QString& group, m_settings.childGroups()) {
+        if (group.startsWith("BUS") && !startBus(group)) {
+            return false;
+        }
+    }
+
+    if (m_buses.isEmpty()) {
+        qDebug() << "BMSD: No bus configured in" << m_settings.fileName();
+        return false;
+    }
+    return true;
+}
+
+inline bool CSBmsDaemon::startBus(const QString& group)
+{
+    CSSuperVoltBmsDevice::TPortConfig config = {};
+    CSBmsBusScheduler::TRetryPolicy policy;
+    QList<CSBmsBusScheduler::TCommand> commands;
+    QList<quint8> addresses;
+    bool ok;
+
+    m_settings.beginGroup(group);
+    config.portName = m_settings.value("port", "").toString();
+    config.baudRate = m_settings.value("baudRate", QSerialPort::Baud9600).value<QSerialPort::BaudRate>();
+    config.dataBits = m_settings.value("dataBits", QSerialPort::Data8).value<QSerialPort::DataBits>();
+    config.stopBits = m_settings.value("stopBits", QSerialPort::OneStop).value<QSerialPort::StopBits>();
+    config.parity = m_settings.value("parity", QSerialPort::NoParity).value<QSerialPort::Parity>();
+    config.flowCtrl = m_settings.value("flowCtrl", QSerialPort::NoFlowControl).value<QSerialPort::FlowControl>();
+    config.traceFlags = m_settings.value("traceFlags", CSSuperVoltBmsDevice::TRACE_ERRORS).toUInt();
+    config.backend = m_settings.value("backend", CSSuperVoltBmsDevice::NativePort).value<CSSuperVoltBmsDevice::PortBackend>();
+    config.lowLatency = m_settings.value("lowLatency", false).toBool();
+    config.frameGap = m_settings.value("frameGap", 0.0).toDouble();
+    config.options = m_settings
+                        .value("options",
+                               CSSuperVoltBmsDevice::OPT_SOI_BYTE_3E //
+                                  | CSSuperVoltBmsDevice::OPT_ASCII_CHKSUM
+                                  | CSSuperVoltBmsDevice::OPT_ASCII_LENGTH)
+                        .toUInt();
+
+    /* a comma separated INI value reads back as a string list */
+    foreach (const QString& value, m_settings.value("addresses").toStringList()) {
+        const uint address = value.trimmed().toUInt(&ok, 0);
+        if (ok && address <= 0xff) {
+            addresses.append(address);
+        }
+    }
+    foreach (const QString& value, m_settings.value("commands", "42:1000:0").toStringList()) {
+        const QStringList fields = value.trimmed().split(':');
+        const uint cid2 = fields.value(0).toUInt(&ok, 16);
+        if (ok && cid2 <= 0xff) {
+            commands.append({quint8(cid2), fields.value(1, "0").toInt(), fields.value(2, "0").toInt()});
+        }
+    }
+
+    const int minFrameGap = m_settings.value("minFrameGap", 0).toInt();
+    policy.retries = m_settings.value("retries", 2).toInt();
+    policy.backoffBase = m_settings.value("backoffBase", 250).toInt();
+    policy.backoffMax = m_settings.value("backoffMax", 4000).toInt();
+    policy.probeInterval = m_settings.value("probeInterval", 10000).toInt();
+    m_settings.endGroup();
+
+    if (config.portName.isEmpty() || addresses.isEmpty() || commands.isEmpty()) {
+        qDebug() << "BMSD:" << group << "needs port, addresses and commands";
+        return false;
+    }
+    config.address = addresses.first();
+
+    CSSuperVoltBmsDevice* device = m_ioThreads->createDevice(config);
+    CSBmsBusScheduler* scheduler = new CSBmsBusScheduler(device);
+    m_ioThreads->attach(scheduler, device);
+
+    /* the registry and the capture writer outlive the I/O threads */
+    CSBmsPortMetrics* metrics = m_metrics.addPort(group, config.portName);
+    CSBmsCaptureWriter* capture = m_capture.isOpen() ? &m_capture : nullptr;
+
+    /* poll only while the port is open, reopen a lost port */
+    const int reconnect = m_reconnect;
+    connect(device, &CSSuperVoltBmsDevice::connected, scheduler, &CSBmsBusScheduler::start);
+    connect(device, &CSSuperVoltBmsDevice::disconnected, scheduler, &CSBmsBusScheduler::stop);
+    connect(device, &CSSuperVoltBmsDevice::disconnected, device, [device, reconnect]() {
+        QTimer::singleShot(reconnect, device, [device, reconnect]() { openDevice(device, reconnect); });
+    });
+
+    /* results arrive queued in this thread */
+    const QString name = group;
+    connect(scheduler, &CSBmsBusScheduler::responseReceived, this, [this, name](const CSSuperVoltBmsDevice::TResponse& rsp) {
+        foreach (CSBmsSink* sink, m_sinks) {
+            sink->publish(name, rsp);
+        }
+    });
+    connect(scheduler, &CSBmsBusScheduler::requestFailed, this, [this, name](quint8 address, quint8 cid2, CSSuperVoltBmsDevice::BmsError error) {
+        foreach (CSBmsSink* sink, m_sinks) {
+            sink->publishError(name, address, cid2, error);
+        }
+    });
+    connect(scheduler, &CSBmsBusScheduler::healthChanged, this, [name](quint8 address, CSBmsBusScheduler::Health health) {
+        qDebug() << "BMSD:" << name << "address" << address << "is" << health;
+    });
+
+    QMetaObject::invokeMethod(scheduler, [scheduler, device, metrics, capture, addresses, commands, minFrameGap, policy, reconnect]() {
+        device->setMetrics(metrics);
+        device->setCapture(capture);
+        scheduler->setAddresses(addresses);
+        scheduler->setCommands(commands);
+        scheduler->setMinFrameGap(minFrameGap);
+        scheduler->setRetryPolicy(policy);
+        openDevice(device, reconnect);
+    });
+
+    m_buses.append({group, device, scheduler});
+    return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <QList>
+#include <QObject>
+#include <QSettings>
+#include <QSocketNotifier>
+#include <QString>
+#include <QTimer>
+#include <csbmsbusscheduler.h>
+#include <csbmscapture.h>
+#include <csbmsiothreadpool.h>
+#include <csbmsmetrics.h>
+#include <csbmsmetricsserver.h>
+#include <csbmssink.h>
+
+/* Headless poller. Reads a poll configuration (INI), creates one
+ * device and bus scheduler per [BUS-*] group on the I/O thread
+ * pool and hands every result to the sinks of the [SINK-*] groups.
+ * Runs on a QCoreApplication event loop, no widgets involved.
+ *
+ *   [DAEMON]
+ *   threads=0           I/O threads, 0 = one per bus
+ *   flushInterval=1000  ms between sink flushes
+ *   reconnect=5000      ms between reopen attempts of a lost port
+ *   capture=            raw traffic of all buses to this file, see
+ *                       CSBmsCaptureWriter; empty = off
+ *
+ *   [BUS-0]
+ *   port=/dev/ttyUSB0
+ *   baudRate=9600, dataBits, stopBits, parity, flowCtrl, backend,
+ *   lowLatency, frameGap, traceFlags, options: as in the GUI settings
+ *   addresses=1,2,3
+ *   commands=42:1000:10,51:3600000:0   CID2(hex):interval(ms):priority,
+ *                       static info (51, 4F, 50) with interval 0 is
+ *                       fetched once per connect
+ *   minFrameGap=0, retries, backoffBase, backoffMax, probeInterval
+ *
+ *   [METRICS]
+ *   port=9464           HTTP port of GET /metrics, 0 = off
+ *   bind=127.0.0.1
+ *
+ *   [SINK-0]
+ *   type=jsonl
+ *   path=/var/log/svbms.jsonl   "-" = stdout
+ *
+ *   [SINK-1]
+ *   type=telemetry      columnar store, see CSBmsTelemetryStore, with
+ *                       rollups in path/rollup (CSBmsTelemetryRollup)
+ *   path=/var/lib/svbms
+ *   segmentSize=8388608, sealAge=60000 (ms)
+ *
+ * SIGINT / SIGTERM stop the daemon cleanly. */
+class CSBmsDaemon: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CSBmsDaemon(const QString& configFile, QObject* parent = nullptr);
+    ~CSBmsDaemon();
+
+    bool start();
+    void stop();
+
+private slots:
+    void onFlushTimer();
+    void onSignal();
+
+private:
+    typedef struct {
+        QString name;
+        CSSuperVoltBmsDevice* device;
+        CSBmsBusScheduler* scheduler;
+    } TBus;
+
+    QSettings m_settings;
+    CSBmsIoThreadPool* m_ioThreads;
+    QList<TBus> m_buses;
+    QList<CSBmsSink*> m_sinks;
+    CSBmsMetrics m_metrics;
+    CSBmsMetricsServer* m_metricsServer;
+    CSBmsCaptureWriter m_capture;
+    QTimer m_flushTimer;
+    QSocketNotifier* m_signalNotifier;
+    int m_reconnect;
+
+private:
+    inline bool loadSinks();
+    inline bool startMetrics();
+    inline bool loadBuses();
+    inline bool startBus(const QString& group);
+    inline void installSignalHandlers();
+};
@@ -0,0 +1,179 @@
+#include <csbmsframebuilder.h>
+
+/* protocol error codes, same values as the device's BmsError */
+static const quint8 BUILD_INVALID_CHKSUM = 0x02;
+static const quint8 BUILD_INVALID_FORMAT = 0x05;
+static const quint8 BUILD_INVALID_DATA = 0x06;
+
+CSBmsFrameBuilder::CSBmsFrameBuilder()
+    : m_size(0)
+    , m_error(0)
+{
+}
+
+void CSBmsFrameBuilder::clear()
+{
+    m_size = 0;
+    m_error = 0;
+}
+
+bool CSBmsFrameBuilder::isValid() const
+{
+    return !m_error && m_size > 0;
+}
+
+quint8 CSBmsFrameBuilder::error() const
+{
+    return m_error;
+}
+
+const char* CSBmsFrameBuilder::data() const
+{
+    return m_data;
+}
+
+qint64 CSBmsFrameBuilder::size() const
+{
+    return m_size;
+}
+
+QByteArrayView CSBmsFrameBuilder::view() const
+{
+    return QByteArrayView(m_data, m_size);
+}
+
+inline void CSBmsFrameBuilder::fail(quint8 error)
+{
+    if (!m_error) {
+        m_error = error;
+    }
+}
+
+/* room for 'count' more characters, fails the frame otherwise */
+inline bool CSBmsFrameBuilder::reserve(int count)
+{
+    if (m_error) {
+        return false;
+    }
+    if (m_size + count > BMS_MAX_REQUEST_SIZE) {
+        fail(BUILD_INVALID_FORMAT);
+        return false;
+    }
+    return true;
+}
+
+/* SOI as byte */
+void CSBmsFrameBuilder::appendStart(quint8 soi)
+{
+    clear();
+    m_data[m_size++] = static_cast<char>(soi);
+}
+
+void CSBmsFrameBuilder::appendHeader(quint8 address, quint8 cid2)
+{
+    if (!reserve(16)) {
+        return;
+    }
+
+    char* pos = m_data + m_size;
+
+    /* ASCIIhex Protocol Version */
+    pos = CSBmsProtocol::putCode8(pos, BMS_PROTO_VER);
+
+    /* ASCIIhex Device address */
+    pos = CSBmsProtocol::putCode8(pos, address);
+
+    /* ASCIIhex CID1 -> Device identification code */
+    pos = CSBmsProtocol::putCode8(pos, BMS_CID1_LIFEPO4);
+
+    /* ASCIIhex CID2 -> Control Identification Code */
+    pos = CSBmsProtocol::putCode8(pos, cid2);
+
+    m_size = pos - m_data;
+}
+
+/* LENGTH consists of 2 bytes, composed of LENID and LCHKSUM.
+ * LENID represents the number of ASCII bytes in the INFO item.
+ * When LENID=0, INFO is empty, meaning there is no such item.
+ * LENGTH is split into four ASCII bytes, with the high byte first
+ * and the low byte last. The calculation of the
+ * checksum is: D11D10D9D8 + D7D6D5D4 + D3D2D1D0, after summing, take
+ * the modulo 16, negate it, and add 1.
+ * The ASCII byte count of the INFO field is 18 (in decimal), which
+ * is equivalent to LENID=000000010010B.
+ * D11D10D9D8 + D7D6D5D4 + D3D2D1D0 = 0000B + 0001B + 0010B = 0011B.
+ * The remainder modulo 16 is 0011B. The complement of 0011B plus 1
+ * is 1101B, which is LCHKSUM. Therefore, LENGTH is 1101000000010010B,
+ * which is equivalent to D012H.
+ *
+ * NOTE: Length CANNOT exceed 12bit !!!!!
+ * NOTE: 4 bit reserved for LCHKSUM
+ * NOTE: LENID=0 yields LCHKSUM=0, so the empty LENGTH is "0000"
+ */
+void CSBmsFrameBuilder::appendLength(quint16 length, bool ascii)
+{
+    /* check value bit size. */
+    if ((length & 0xf000) > 0) {
+        fail(BUILD_INVALID_FORMAT);
+        return;
+    }
+    if (!reserve(ascii ? 8 : 4)) {
+        return;
+    }
+
+    const quint16 value = (CSBmsProtocol::lengthChecksum(length) << 12) | length;
+    char* pos = m_data + m_size;
+
+    pos = (ascii ? CSBmsProtocol::putCode16(pos, value) : CSBmsProtocol::putHex16(pos, value));
+    m_size = pos - m_data;
+}
+
+/* Add the INFO field. LENID must not be 0x00 ! */
+void CSBmsFrameBuilder::appendInfo(quint16 info, bool ascii)
+{
+    if (!reserve(ascii ? 8 : 4)) {
+        return;
+    }
+
+    char* pos = m_data + m_size;
+    pos = (ascii ? CSBmsProtocol::putCode16(pos, info) : CSBmsProtocol::putHex16(pos, info));
+    m_size = pos - m_data;
+}
+
+/* The calculation of CHKSUM is to add up the characters other
+ * than SOI, EOI, and CHKSUM according to their ASCII values,
+ * and then take the modulo 65536 of the sum, invert it, and add 1.
+ * CHKSUM is transmitted as four separate ASCII codes, first the
+ * high byte and then the low byte.
+ * Test: "20014043E00200" sums up to 0x02c5 -> CHKSUM 0xFD3B */
+void CSBmsFrameBuilder::appendChecksum(bool ascii)
+{
+    /* skip SOI byte */
+    if (m_size < 2) {
+        fail(BUILD_INVALID_DATA);
+        return;
+    }
+    if (!reserve(ascii ? 8 : 4)) {
+        return;
+    }
+
+    const quint16 chksum = CSBmsProtocol::checksum(m_data + 1, m_size - 1);
+    if (!chksum) {
+        fail(BUILD_INVALID_CHKSUM);
+        return;
+    }
+
+    /* high and low byte */
+    char* pos = m_data + m_size;
+    pos = (ascii ? CSBmsProtocol::putCode16(pos, chksum) : CSBmsProtocol::putHex16(pos, chksum));
+    m_size = pos - m_data;
+}
+
+/* EOI as byte */
+void CSBmsFrameBuilder::appendEnd()
+{
+    if (!reserve(1)) {
+        return;
+    }
+    m_data[m_size++] = static_cast<char>(BMS_PROTO_EOI);
+}
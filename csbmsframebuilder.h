@@ -0,0 +1,43 @@
+#pragma once
+#include <QByteArrayView>
+#include <csbmsprotocol.h>
+
+/* Request frame built in place in a fixed buffer, no heap involved.
+ * Fields are appended in protocol order:
+ * SOI VER ADR CID1 CID2 LENGTH [INFO] CHKSUM EOI
+ * Header fields always go out as ASCII codes of the hex digits,
+ * LENGTH/INFO and CHKSUM optionally (the device's OPT_ASCII_*).
+ * A failed step leaves the builder invalid, the rest is ignored;
+ * error() tells why, with the RTN codes of the protocol (0x02
+ * CHKSUM, 0x05 format, 0x06 data), as used by BmsError. */
+class CSBmsFrameBuilder
+{
+public:
+    CSBmsFrameBuilder();
+
+    void clear();
+
+    void appendStart(quint8 soi);
+    void appendHeader(quint8 address, quint8 cid2);
+    void appendLength(quint16 length, bool ascii);
+    void appendInfo(quint16 info, bool ascii);
+    void appendChecksum(bool ascii);
+    void appendEnd();
+
+    bool isValid() const;
+    quint8 error() const;
+    const char* data() const;
+    qint64 size() const;
+
+    /* the frame as span, valid as long as the builder lives */
+    QByteArrayView view() const;
+
+private:
+    char m_data[BMS_MAX_REQUEST_SIZE];
+    qint32 m_size;
+    quint8 m_error;
+
+private:
+    inline bool reserve(int count);
+    inline void fail(quint8 error);
+};
@@ -0,0 +1,121 @@
+#include <csbmsframeparser.h>
+
+CSBmsFrameParser::CSBmsFrameParser()
+    : m_state(WaitSoi)
+    , m_size(0)
+    , m_expected(0)
+    , m_discarded(0)
+{
+}
+
+void CSBmsFrameParser::reset()
+{
+    drop(pending());
+}
+
+CSBmsFrameParser::State CSBmsFrameParser::state() const
+{
+    return m_state;
+}
+
+qint64 CSBmsFrameParser::pending() const
+{
+    return m_state == WaitSoi ? 0 : m_size;
+}
+
+quint64 CSBmsFrameParser::discarded() const
+{
+    return m_discarded;
+}
+
+QByteArray CSBmsFrameParser::frame() const
+{
+    /* no copy, refers to our frame buffer */
+    return QByteArray::fromRawData(m_frame, m_size);
+}
+
+inline void CSBmsFrameParser::start(char soi)
+{
+    m_frame[0] = soi;
+    m_size = 1;
+    m_expected = BMS_FRAME_HEADER_SIZE;
+    m_state = Header;
+}
+
+inline void CSBmsFrameParser::drop(qint64 count)
+{
+    m_discarded += count;
+    m_size = 0;
+    m_expected = 0;
+    m_state = WaitSoi;
+}
+
+qint64 CSBmsFrameParser::feed(const char* data, qint64 size, bool* complete)
+{
+    qint64 i = 0;
+
+    *complete = false;
+
+    /* previous call delivered a frame, start over */
+    if (m_state == WaitSoi) {
+        m_size = 0;
+    }
+
+    while (i < size) {
+        const char c = data[i++];
+
+        switch (m_state) {
+            case WaitSoi: {
+                if (CSBmsProtocol::isSoi(c)) {
+                    start(c);
+                }
+                else {
+                    m_discarded++;
+                }
+                break;
+            }
+            case Header:
+            case Body: {
+                /* SOI is never part of the ASCII hex payload, so it
+                 * always starts a new frame. No rescan needed. */
+                if (CSBmsProtocol::isSoi(c)) {
+                    drop(m_size);
+                    start(c);
+                    break;
+                }
+
+                /* last byte must be EOI */
+                if (m_size == m_expected - 1 && m_state == Body) {
+                    if (static_cast<quint8>(c) != BMS_PROTO_EOI) {
+                        drop(m_size + 1);
+                        break;
+                    }
+                    m_frame[m_size++] = c;
+                    m_state = WaitSoi;
+                    *complete = true;
+                    return i;
+                }
+
+                if (CSBmsProtocol::hexValue(c) > 0x0f) {
+                    drop(m_size + 1);
+                    break;
+                }
+
+                m_frame[m_size++] = c;
+
+                /* LENGTH complete: LCHKSUM(1) + LENID(3) */
+                if (m_state == Header && m_size == BMS_FRAME_HEADER_SIZE) {
+                    const char* length = m_frame + BMS_FRAME_HEADER_SIZE - 3;
+                    qint64 lenid = (CSBmsProtocol::hexValue(length[0]) << 8) //
+                                   | (CSBmsProtocol::hexValue(length[1]) << 4)
+                                   | CSBmsProtocol::hexValue(length[2]);
+                    m_expected = BMS_FRAME_HEADER_SIZE + lenid + BMS_FRAME_TRAILER_SIZE;
+                    m_state = Body;
+                }
+                break;
+            }
+        }
+    }
+
+    return i;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <QByteArray>
+#include <csbmsprotocol.h>
+
+/* Resumable receive state machine. Bytes are pushed in whatever
+ * chunks the port delivers them; every byte is looked at once.
+ * A frame starts at SOI, its end is known as soon as the LENGTH
+ * field has been received. Anything that doesn't fit the frame
+ * layout is discarded and the parser resyncs on the next SOI. */
+class CSBmsFrameParser
+{
+public:
+    enum State {
+        WaitSoi = 0,
+        Header,
+        Body,
+    };
+
+    CSBmsFrameParser();
+
+    void reset();
+
+    /* Consume bytes until a frame is complete or the input is
+     * exhausted. Returns the number of bytes consumed; 'complete'
+     * is set when frame() holds a full frame. */
+    qint64 feed(const char* data, qint64 size, bool* complete);
+
+    /* the last completed frame, valid until the next feed() */
+    QByteArray frame() const;
+
+    State state() const;
+    qint64 pending() const;
+    quint64 discarded() const;
+
+private:
+    State m_state;
+    qint64 m_size;
+    qint64 m_expected;
+    quint64 m_discarded;
+    char m_frame[BMS_MAX_FRAME_SIZE];
+
+private:
+    inline void start(char soi);
+    inline void drop(qint64 count);
+};
@@ -0,0 +1,143 @@
+#include <QDebug>
+#include <csbmsiothreadpool.h>
+
+CSBmsIoThreadPool::CSBmsIoThreadPool(int maxThreads, QObject* parent)
+    : QObject(parent)
+    , m_maxThreads(qMax(0, maxThreads))
+    , m_workers()
+    , m_devices()
+    , m_attached()
+{
+    /* everything crossing the thread boundary in a queued signal */
+    qRegisterMetaType<CSSuperVoltBmsDevice::BmsError>();
+    qRegisterMetaType<CSSuperVoltBmsDevice::TPortConfig>();
+    qRegisterMetaType<CSSuperVoltBmsDevice::TAnalogData>();
+    qRegisterMetaType<CSSuperVoltBmsDevice::TResponse>();
+}
+
+CSBmsIoThreadPool::~CSBmsIoThreadPool()
+{
+    shutdown();
+}
+
+inline QThread* CSBmsIoThreadPool::acquireThread()
+{
+    TWorker* worker = nullptr;
+
+    if (m_maxThreads == 0 || m_workers.size() < m_maxThreads) {
+        QThread* thread = new QThread(this);
+        thread->setObjectName(QStringLiteral("bms-io-%1").arg(m_workers.size()));
+        thread->start();
+        m_workers.append({thread, 0});
+        worker = &m_workers.last();
+    }
+    else {
+        worker = &m_workers.first();
+        for (int i = 1; i < m_workers.size(); i++) {
+            if (m_workers[i].devices < worker->devices) {
+                worker = &m_workers[i];
+            }
+        }
+    }
+
+    worker->devices++;
+    return worker->thread;
+}
+
+CSSuperVoltBmsDevice* CSBmsIoThreadPool::createDevice(const CSSuperVoltBmsDevice::TPortConfig& config)
+{
+    /* no parent, an object with a parent cannot change threads */
+    CSSuperVoltBmsDevice* device = new CSSuperVoltBmsDevice();
+    QThread* thread = acquireThread();
+
+    device->setConfig(config);
+    device->moveToThread(thread);
+    connect(thread, &QThread::finished, device, &QObject::deleteLater);
+    m_devices.insert(device, thread);
+
+    qDebug() << "BMSIO: Device" << config.portName << "runs on" << thread->objectName();
+    return device;
+}
+
+void CSBmsIoThreadPool::releaseDevice(CSSuperVoltBmsDevice* device)
+{
+    QThread* thread = m_devices.take(device);
+    if (!thread) {
+        return;
+    }
+
+    teardown(device, thread);
+
+    for (int i = 0; i < m_workers.size(); i++) {
+        if (m_workers[i].thread == thread) {
+            m_workers[i].devices--;
+        }
+    }
+}
+
+/* Close the device and delete its attached objects in the device
+ * thread and wait for it: their timers, the port and its notifier
+ * belong to that thread and must not outlive the device there. The
+ * device follows with deleteLater(), still in its thread. */
+inline void CSBmsIoThreadPool::teardown(CSSuperVoltBmsDevice* device, QThread* thread)
+{
+    const QList<QPointer<QObject>> attached = m_attached.take(device);
+
+    auto close = [device, attached]() {
+        /* attached objects still see disconnected() */
+        device->close();
+        foreach (const QPointer<QObject>& object, attached) {
+            delete object.data();
+        }
+        device->deleteLater();
+    };
+
+    if (thread->isRunning()) {
+        QMetaObject::invokeMethod(device, close, Qt::BlockingQueuedConnection);
+        return;
+    }
+
+    /* nothing runs there any more, the objects are ours */
+    device->close();
+    foreach (const QPointer<QObject>& object, attached) {
+        delete object.data();
+    }
+    delete device;
+}
+
+bool CSBmsIoThreadPool::attach(QObject* object, CSSuperVoltBmsDevice* device)
+{
+    QThread* thread = m_devices.value(device);
+    if (!thread || object->parent()) {
+        return false;
+    }
+
+    object->moveToThread(thread);
+    connect(thread, &QThread::finished, object, &QObject::deleteLater);
+    m_attached[device].append(object);
+    return true;
+}
+
+int CSBmsIoThreadPool::threadCount() const
+{
+    return m_workers.size();
+}
+
+/* close every device in its thread, then stop the threads; the
+ * devices are deleted when their thread finishes */
+void CSBmsIoThreadPool::shutdown()
+{
+    for (auto it = m_devices.constBegin(); it != m_devices.constEnd(); it++) {
+        teardown(it.key(), it.value());
+    }
+    m_devices.clear();
+
+    foreach (const TWorker& worker, m_workers) {
+        worker.thread->quit();
+    }
+    foreach (const TWorker& worker, m_workers) {
+        worker.thread->wait();
+        delete worker.thread;
+    }
+    m_workers.clear();
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QThread>
+#include <cssupervoltbmsdevice.h>
+
+/* Owns the I/O threads the BMS devices run on. Each device is
+ * created here and moved, together with its serial port, to a
+ * worker thread: one per device, or the least loaded of at most
+ * 'maxThreads' threads. Talk to a device through queued calls
+ * (QMetaObject::invokeMethod) and its signals only.
+ *
+ * Releasing a device, or shutting the pool down, waits until the
+ * device is closed and its attached objects are deleted in their
+ * thread, so no timer or notifier of it is left on a reused thread.
+ * Don't call either from an I/O thread. */
+class CSBmsIoThreadPool: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* maxThreads = 0: one thread per device */
+    explicit CSBmsIoThreadPool(int maxThreads = 0, QObject* parent = nullptr);
+    ~CSBmsIoThreadPool();
+
+    CSSuperVoltBmsDevice* createDevice(const CSSuperVoltBmsDevice::TPortConfig& config);
+    void releaseDevice(CSSuperVoltBmsDevice* device);
+
+    /* Move a helper object (e.g. a bus scheduler) to the thread of
+     * 'device'. It is deleted before the device is released. */
+    bool attach(QObject* object, CSSuperVoltBmsDevice* device);
+
+    int threadCount() const;
+    void shutdown();
+
+private:
+    typedef struct {
+        QThread* thread;
+        int devices;
+    } TWorker;
+
+    int m_maxThreads;
+    QList<TWorker> m_workers;
+    QHash<CSSuperVoltBmsDevice*, QThread*> m_devices;
+    QHash<CSSuperVoltBmsDevice*, QList<QPointer<QObject>>> m_attached;
+
+private:
+    inline QThread* acquireThread();
+    inline void teardown(CSSuperVoltBmsDevice* device, QThread* thread);
+};
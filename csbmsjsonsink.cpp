@@ -0,0 +1,147 @@
+#include <QDateTime>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <csbmsjsonsink.h>
+#include <stdio.h>
+
+CSBmsJsonSink::CSBmsJsonSink(const QString& path, int bufferSize, QObject* parent)
+    : CSBmsSink(parent)
+    , m_path(path)
+    , m_file()
+    , m_buffer()
+    , m_bufferSize(qMax(0, bufferSize))
+{
+    m_buffer.reserve(m_bufferSize + 1024);
+}
+
+CSBmsJsonSink::~CSBmsJsonSink()
+{
+    close();
+}
+
+bool CSBmsJsonSink::open()
+{
+    if (m_file.isOpen()) {
+        return true;
+    }
+
+    bool success;
+    if (m_path == QStringLiteral("-")) {
+        success = m_file.open(stdout, QIODevice::WriteOnly | QIODevice::Unbuffered);
+    }
+    else {
+        m_file.setFileName(m_path);
+        success = m_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered);
+    }
+
+    if (!success) {
+        qDebug() << "BMSSINK: Unable to open" << m_path << m_file.errorString();
+    }
+    return success;
+}
+
+void CSBmsJsonSink::close()
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+
+    flush();
+    m_file.close();
+}
+
+void CSBmsJsonSink::publish(const QString& bus, const CSSuperVoltBmsDevice::TResponse& rsp)
+{
+    QJsonObject record;
+
+    record.insert("bus", bus);
+    record.insert("addr", rsp.address);
+    record.insert("cid2", rsp.cid2);
+
+    switch (rsp.cid2) {
+        case BMS_CID2_FETCH_ANALOG_DATA:
+        case BMS_CID2_FETCH_ANALOG_DATA + 1: {
+            const CSSuperVoltBmsDevice::TAnalogData& a = rsp.analog;
+            QJsonArray cells;
+            QJsonArray temps;
+
+            for (int i = 0; i < a.cellCount; i++) {
+                cells.append(a.cellVoltage[i]);
+            }
+            for (int i = 0; i < a.tempCount; i++) {
+                temps.append(a.temperature[i] / 10.0);
+            }
+
+            record.insert("ts", a.timestamp);
+            record.insert("cells_mv", cells);
+            record.insert("temps_c", temps);
+            record.insert("current_ma", a.current);
+            record.insert("voltage_mv", qint64(a.voltage));
+            record.insert("remain_mah", qint64(a.remainCapacity));
+            record.insert("total_mah", qint64(a.totalCapacity));
+            record.insert("cycles", a.cycles);
+            record.insert("soc", a.soc);
+            break;
+        }
+        case BMS_CID2_FETCH_MANUFACTURER: {
+            const CSSuperVoltBmsDevice::TManufacturerInfo& m = rsp.manufacturer;
+
+            record.insert("ts", QDateTime::currentMSecsSinceEpoch());
+            record.insert("battery", QString::fromLatin1(m.batteryName));
+            record.insert("manufacturer", QString::fromLatin1(m.manufacturer));
+            record.insert("software", QStringLiteral("%1.%2").arg(m.softwareMajor).arg(m.softwareMinor));
+            break;
+        }
+        case BMS_CID2_FETCH_PROTO_VER: {
+            record.insert("ts", QDateTime::currentMSecsSinceEpoch());
+            record.insert("version", rsp.version);
+            break;
+        }
+        default: {
+            record.insert("ts", QDateTime::currentMSecsSinceEpoch());
+            record.insert("frame", QString::fromLatin1(rsp.frame.mid(1, rsp.frame.size() - 2)));
+            break;
+        }
+    }
+
+    record.insert("latency_us", rsp.latencyNs / 1000);
+    append(QJsonDocument(record).toJson(QJsonDocument::Compact));
+}
+
+void CSBmsJsonSink::publishError(const QString& bus, quint8 address, quint8 cid2, CSSuperVoltBmsDevice::BmsError error)
+{
+    QJsonObject record;
+
+    record.insert("ts", QDateTime::currentMSecsSinceEpoch());
+    record.insert("bus", bus);
+    record.insert("addr", address);
+    record.insert("cid2", cid2);
+    record.insert("error", int(error));
+
+    append(QJsonDocument(record).toJson(QJsonDocument::Compact));
+}
+
+void CSBmsJsonSink::flush()
+{
+    if (m_buffer.isEmpty() || !m_file.isOpen()) {
+        return;
+    }
+
+    if (m_file.write(m_buffer) != m_buffer.size()) {
+        qDebug() << "BMSSINK: Write to" << m_path << "failed:" << m_file.errorString();
+    }
+    /* keeps the capacity, clear() would free it */
+    m_buffer.resize(0);
+}
+
+inline void CSBmsJsonSink::append(const QByteArray& line)
+{
+    m_buffer.append(line);
+    m_buffer.append('\n');
+
+    if (m_buffer.size() >= m_bufferSize) {
+        flush();
+    }
+}
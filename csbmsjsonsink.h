@@ -0,0 +1,34 @@
+#pragma once
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <csbmssink.h>
+
+/* One JSON object per line, appended to a file or written to
+ * stdout (path "-"). Records are collected in memory and written
+ * on flush() or when 'bufferSize' bytes are pending. */
+class CSBmsJsonSink: public CSBmsSink
+{
+    Q_OBJECT
+
+public:
+    explicit CSBmsJsonSink(const QString& path, int bufferSize = 65536, QObject* parent = nullptr);
+    ~CSBmsJsonSink();
+
+    bool open() override;
+    void close() override;
+
+    void publish(const QString& bus, const CSSuperVoltBmsDevice::TResponse& rsp) override;
+    void publishError(const QString& bus, quint8 address, quint8 cid2, CSSuperVoltBmsDevice::BmsError error) override;
+
+    void flush() override;
+
+private:
+    QString m_path;
+    QFile m_file;
+    QByteArray m_buffer;
+    int m_bufferSize;
+
+private:
+    inline void append(const QByteArray& line);
+};
@@ -0,0 +1,338 @@
+#include <QDateTime>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QVBoxLayout>
+#include <csbmslivechart.h>
+#include <string.h>
+
+/* rows kept per pack before the older half is thinned */
+static const int CHART_HISTORY_ROWS = 16384;
+/* at most one redraw per frame interval (ms) */
+static const int CHART_FRAME_INTERVAL = 200;
+/* points per series after downsampling, about one per pixel */
+static const int CHART_MIN_POINTS = 100;
+static const int CHART_MAX_POINTS = 2000;
+
+/* Largest triangle three buckets: 'threshold' points of 'count'.
+ * First and last point stay, every bucket in between contributes the
+ * point spanning the largest triangle with the previous pick and the
+ * mean of the next bucket, which keeps peaks and the visual shape. */
+static void lttb(const qint64* time, const qint32* value, int count, int threshold, qreal scale, QList<QPointF>& out)
+{
+    out.clear();
+    if (count <= 0) {
+        return;
+    }
+
+    if (threshold >= count || threshold < 3) {
+        out.reserve(count);
+        for (int i = 0; i < count; i++) {
+            out.append(QPointF(time[i], value[i] * scale));
+        }
+        return;
+    }
+
+    /* relative times, ms since epoch squared would lose precision */
+    const qint64 base = time[0];
+    const double every = double(count - 2) / (threshold - 2);
+    int a = 0;
+
+    out.reserve(threshold);
+    out.append(QPointF(time[0], value[0] * scale));
+
+    for (int i = 0; i < threshold - 2; i++) {
+        const int rangeStart = int(i * every) + 1;
+        const int rangeEnd = int((i + 1) * every) + 1;
+        const int avgEnd = qMin(int((i + 2) * every) + 1, count);
+
+        double avgX = 0;
+        double avgY = 0;
+        for (int j = rangeEnd; j < avgEnd; j++) {
+            avgX += time[j] - base;
+            avgY += value[j];
+        }
+        if (avgEnd > rangeEnd) {
+            avgX /= avgEnd - rangeEnd;
+            avgY /= avgEnd - rangeEnd;
+        }
+        else {
+            avgX = time[count - 1] - base;
+            avgY = value[count - 1];
+        }
+
+        const double ax = time[a] - base;
+        const double ay = value[a];
+        double maxArea = -1;
+        int pick = rangeStart;
+
+        for (int j = rangeStart; j < rangeEnd; j++) {
+            const double area = qAbs((ax - avgX) * (value[j] - ay) - (ax - (time[j] - base)) * (avgY - ay));
+            if (area > maxArea) {
+                maxArea = area;
+                pick = j;
+            }
+        }
+
+        out.append(QPointF(time[pick], value[pick] * scale));
+        a = pick;
+    }
+
+    out.append(QPointF(time[count - 1], value[count - 1] * scale));
+}
+
+CSBmsLiveChart::CSBmsLiveChart(QWidget* parent)
+    : QWidget(parent)
+    , m_cbxPack(new QComboBox(this))
+    , m_tabs(new QTabWidget(this))
+    , m_plots()
+    , m_history()
+    , m_address(-1)
+    , m_frameTimer(this)
+    , m_points()
+{
+    QHBoxLayout* header = new QHBoxLayout();
+    header->addWidget(new QLabel(tr("Pack"), this));
+    header->addWidget(m_cbxPack);
+    header->addStretch();
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addLayout(header);
+    layout->addWidget(m_tabs);
+
+    setupPlot(PlotCells, tr("Cell voltage [mV]"), tr("Cell"), 1.0);
+    setupPlot(PlotCurrent, tr("Current [A]"), tr("Current"), 0.001);
+    setupPlot(PlotTemps, tr("Temperature [°C]"), tr("Temp"), 0.1);
+
+    m_frameTimer.setSingleShot(true);
+    m_frameTimer.setInterval(CHART_FRAME_INTERVAL);
+    connect(&m_frameTimer, &QTimer::timeout, this, &CSBmsLiveChart::onFrame);
+
+    connect(m_cbxPack, qOverload<int>(&QComboBox::activated), this, &CSBmsLiveChart::onPackSelected);
+    connect(m_tabs, &QTabWidget::currentChanged, this, &CSBmsLiveChart::onTabChanged);
+}
+
+CSBmsLiveChart::~CSBmsLiveChart()
+{
+}
+
+inline void CSBmsLiveChart::setupPlot(TPlotType type, const QString& title, const QString& prefix, qreal scale)
+{
+    TPlot& plot = m_plots[type];
+
+    plot.chart = new QChart();
+    plot.chart->legend()->setAlignment(Qt::AlignRight);
+    plot.chart->setMargins(QMargins(4, 4, 4, 4));
+
+    plot.axisX = new QDateTimeAxis(plot.chart);
+    plot.axisX->setFormat(QStringLiteral("hh:mm:ss"));
+    plot.axisX->setTickCount(6);
+    plot.chart->addAxis(plot.axisX, Qt::AlignBottom);
+
+    plot.axisY = new QValueAxis(plot.chart);
+    plot.chart->addAxis(plot.axisY, Qt::AlignLeft);
+
+    plot.prefix = prefix;
+    plot.scale = scale;
+
+    /* the view owns the chart */
+    plot.view = new QChartView(plot.chart, m_tabs);
+    plot.view->setRenderHint(QPainter::Antialiasing, false);
+    m_tabs->addTab(plot.view, title);
+}
+
+/* series are kept across redraws, only added or removed when the
+ * layout of the shown pack differs */
+inline void CSBmsLiveChart::setSeriesCount(TPlot& plot, int count)
+{
+    while (plot.series.size() > count) {
+        QLineSeries* series = plot.series.takeLast();
+        plot.chart->removeSeries(series);
+        delete series;
+    }
+
+    while (plot.series.size() < count) {
+        QLineSeries* series = new QLineSeries(plot.chart);
+        plot.chart->addSeries(series);
+        series->attachAxis(plot.axisX);
+        series->attachAxis(plot.axisY);
+        plot.series.append(series);
+    }
+
+    for (int i = 0; i < count; i++) {
+        plot.series.at(i)->setName(count > 1 ? QStringLiteral("%1 %2").arg(plot.prefix).arg(i + 1) : plot.prefix);
+    }
+    plot.chart->legend()->setVisible(count > 1);
+}
+
+void CSBmsLiveChart::append(const CSSuperVoltBmsDevice::TAnalogData& data)
+{
+    const quint8 cells = qMin<quint8>(data.cellCount, BMS_MAX_CELLS);
+    const quint8 temps = qMin<quint8>(data.tempCount, BMS_MAX_TEMPS);
+
+    auto it = m_history.find(data.address);
+    if (it == m_history.end()) {
+        it = m_history.insert(data.address, THistory());
+
+        /* keep the selector ordered by address */
+        int index = 0;
+        while (index < m_cbxPack->count() && m_cbxPack->itemData(index).toInt() < data.address) {
+            index++;
+        }
+        m_cbxPack->insertItem(index, tr("#%1").arg(data.address), data.address);
+        if (m_address < 0) {
+            m_cbxPack->setCurrentIndex(index);
+            m_address = data.address;
+        }
+    }
+
+    THistory& history = it.value();
+
+    /* another layout, start over */
+    if (history.rows > 0 && (history.cells != cells || history.temps != temps)) {
+        history.rows = 0;
+    }
+
+    if (history.rows == 0) {
+        history.cells = cells;
+        history.temps = temps;
+        history.time.resize(CHART_HISTORY_ROWS);
+        history.values.resize((1 + cells + temps) * CHART_HISTORY_ROWS);
+    }
+    else if (history.rows == CHART_HISTORY_ROWS) {
+        compact(history);
+    }
+
+    const int row = history.rows++;
+    qint32* column = history.values.data() + row;
+
+    history.time[row] = data.timestamp;
+    *column = data.current;
+    for (int i = 0; i < cells; i++) {
+        column += CHART_HISTORY_ROWS;
+        *column = data.cellVoltage[i];
+    }
+    for (int i = 0; i < temps; i++) {
+        column += CHART_HISTORY_ROWS;
+        *column = data.temperature[i];
+    }
+
+    if (data.address == m_address) {
+        schedule();
+    }
+}
+
+/* every second row of the older half, the newer half as it is */
+inline void CSBmsLiveChart::compact(THistory& history)
+{
+    const int half = CHART_HISTORY_ROWS / 2;
+    const int columns = 1 + history.cells + history.temps;
+
+    for (int c = -1; c < columns; c++) {
+        if (c < 0) {
+            qint64* time = history.time.data();
+            for (int i = 0; i < half / 2; i++) {
+                time[i] = time[2 * i];
+            }
+            memmove(time + half / 2, time + half, half * sizeof(qint64));
+        }
+        else {
+            qint32* values = history.values.data() + c * CHART_HISTORY_ROWS;
+            for (int i = 0; i < half / 2; i++) {
+                values[i] = values[2 * i];
+            }
+            memmove(values + half / 2, values + half, half * sizeof(qint32));
+        }
+    }
+    history.rows = half / 2 + half;
+}
+
+void CSBmsLiveChart::clear()
+{
+    m_history.clear();
+    m_cbxPack->clear();
+    m_address = -1;
+
+    for (int p = 0; p < PlotCount; p++) {
+        setSeriesCount(m_plots[p], 0);
+    }
+}
+
+inline void CSBmsLiveChart::schedule()
+{
+    if (!m_frameTimer.isActive()) {
+        m_frameTimer.start();
+    }
+}
+
+void CSBmsLiveChart::onPackSelected(int index)
+{
+    m_address = m_cbxPack->itemData(index).toInt();
+    schedule();
+}
+
+void CSBmsLiveChart::onTabChanged(int)
+{
+    schedule();
+}
+
+/* only the visible chart is redrawn, the others on their tab change */
+void CSBmsLiveChart::onFrame()
+{
+    auto it = m_history.constFind(quint8(m_address));
+    if (m_address < 0 || it == m_history.constEnd()) {
+        return;
+    }
+
+    const THistory& history = it.value();
+
+    switch (m_tabs->currentIndex()) {
+        case PlotCells: {
+            redraw(m_plots[PlotCells], history, 1, history.cells);
+            break;
+        }
+        case PlotCurrent: {
+            redraw(m_plots[PlotCurrent], history, 0, 1);
+            break;
+        }
+        case PlotTemps: {
+            redraw(m_plots[PlotTemps], history, 1 + history.cells, history.temps);
+            break;
+        }
+    }
+}
+
+inline void CSBmsLiveChart::redraw(TPlot& plot, const THistory& history, int column, int count)
+{
+    const int threshold = qBound(CHART_MIN_POINTS, int(plot.chart->plotArea().width()), CHART_MAX_POINTS);
+    qreal low = 0;
+    qreal high = 0;
+
+    setSeriesCount(plot, count);
+    if (history.rows == 0) {
+        return;
+    }
+
+    for (int s = 0; s < count; s++) {
+        const qint32* values = history.values.constData() + (column + s) * CHART_HISTORY_ROWS;
+
+        lttb(history.time.constData(), values, history.rows, threshold, plot.scale, m_points);
+        for (int i = 0; i < m_points.size(); i++) {
+            const qreal y = m_points.at(i).y();
+            if ((s == 0 && i == 0) || y < low) {
+                low = y;
+            }
+            if ((s == 0 && i == 0) || y > high) {
+                high = y;
+            }
+        }
+
+        /* one change signal per series instead of one per point */
+        plot.series.at(s)->replace(m_points);
+    }
+
+    const qreal margin = high > low ? (high - low) * 0.05 : plot.scale;
+    plot.axisY->setRange(low - margin, high + margin);
+    plot.axisX->setRange(QDateTime::fromMSecsSinceEpoch(history.time.at(0)), //
+                         QDateTime::fromMSecsSinceEpoch(history.time.at(history.rows - 1)));
+}
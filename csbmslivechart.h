@@ -0,0 +1,84 @@
+#pragma once
+#include <QChart>
+#include <QChartView>
+#include <QComboBox>
+#include <QDateTimeAxis>
+#include <QHash>
+#include <QLineSeries>
+#include <QList>
+#include <QPointF>
+#include <QTabWidget>
+#include <QTimer>
+#include <QValueAxis>
+#include <QVector>
+#include <QWidget>
+#include <cssupervoltbmsdevice.h>
+
+/* Live charts of the decoded analog data: cell voltages, current and
+ * temperatures of one pack, selected by address.
+ *
+ * Records are kept per pack in a capped history; when it is full the
+ * older half is thinned to every second row, so the charts cover
+ * hours at full resolution of the recent rows. Nothing is drawn per
+ * record: append() marks the charts dirty and a frame timer redraws
+ * the visible chart once, each series reduced with largest triangle
+ * three buckets (LTTB) to about one point per pixel and handed over
+ * with a single replace(). */
+class CSBmsLiveChart: public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit CSBmsLiveChart(QWidget* parent = nullptr);
+    ~CSBmsLiveChart();
+
+    void append(const CSSuperVoltBmsDevice::TAnalogData& data);
+    void clear();
+
+private slots:
+    void onFrame();
+    void onPackSelected(int index);
+    void onTabChanged(int index);
+
+private:
+    enum TPlotType : quint8 {
+        PlotCells = 0,
+        PlotCurrent,
+        PlotTemps,
+        PlotCount,
+    };
+
+    /* columns: current, cells, temperatures */
+    typedef struct {
+        quint8 cells;
+        quint8 temps;
+        int rows;
+        QVector<qint64> time;
+        QVector<qint32> values; /* column * CHART_HISTORY_ROWS + row */
+    } THistory;
+
+    typedef struct {
+        QChart* chart;
+        QChartView* view;
+        QDateTimeAxis* axisX;
+        QValueAxis* axisY;
+        QList<QLineSeries*> series;
+        QString prefix; /* series name, numbered if more than one */
+        qreal scale;    /* raw value to axis unit */
+    } TPlot;
+
+    QComboBox* m_cbxPack;
+    QTabWidget* m_tabs;
+    TPlot m_plots[PlotCount];
+    QHash<quint8, THistory> m_history;
+    int m_address; /* -1 = none yet */
+    QTimer m_frameTimer;
+    QList<QPointF> m_points;
+
+private:
+    inline void setupPlot(TPlotType type, const QString& title, const QString& prefix, qreal scale);
+    inline void setSeriesCount(TPlot& plot, int count);
+    inline void redraw(TPlot& plot, const THistory& history, int column, int count);
+    inline void schedule();
+    inline static void compact(THistory& history);
+};
@@ -0,0 +1,384 @@
+#include <QMetaEnum>
+#include <QMutexLocker>
+#include <csbmsmetrics.h>
+#include <functional>
+
+/* label value, escaped as the exposition format wants it */
+static inline void appendEscaped(QByteArray& out, const QString& value)
+{
+    foreach (char c, value.toUtf8()) {
+        switch (c) {
+            case '\\': {
+                out.append("\\\\");
+                break;
+            }
+            case '"': {
+                out.append("\\\"");
+                break;
+            }
+            case '\n': {
+                out.append("\\n");
+                break;
+            }
+            default: {
+                out.append(c);
+                break;
+            }
+        }
+    }
+}
+
+static inline void appendFamily(QByteArray& out, const char* name, const char* type, const char* help)
+{
+    out.append("# HELP ").append(name).append(' ').append(help).append('\n');
+    out.append("# TYPE ").append(name).append(' ').append(type).append('\n');
+}
+
+/* name{bus="..",port=".." */
+static inline void appendSample(QByteArray& out, const char* name, const QString& bus, const QString& port)
+{
+    out.append(name).append("{bus=\"");
+    appendEscaped(out, bus);
+    out.append("\",port=\"");
+    appendEscaped(out, port);
+    out.append('"');
+}
+
+static inline void appendValue(QByteArray& out, quint64 value)
+{
+    out.append("} ").append(QByteArray::number(value)).append('\n');
+}
+
+static inline void appendValue(QByteArray& out, double value)
+{
+    out.append("} ").append(QByteArray::number(value, 'g', 10)).append('\n');
+}
+
+/* ----------------------------------------------------------
+ *  Port metrics, producer side
+ * ---------------------------------------------------------- */
+
+CSBmsPortMetrics::CSBmsPortMetrics(const QString& bus, const QString& portName)
+    : m_bus(bus)
+    , m_portName(portName)
+    , m_txFrames(0)
+    , m_txBytes(0)
+    , m_rxFrames(0)
+    , m_rxBytes(0)
+    , m_latencyDropped(0)
+{
+    for (int i = 0; i < BMS_ERROR_CODES; i++) {
+        m_errors[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < 256; i++) {
+        m_addresses[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+CSBmsPortMetrics::~CSBmsPortMetrics()
+{
+    for (int i = 0; i < 256; i++) {
+        delete m_addresses[i].load(std::memory_order_relaxed);
+    }
+}
+
+void CSBmsPortMetrics::countTx(qint64 bytes)
+{
+    m_txFrames.fetch_add(1, std::memory_order_relaxed);
+    m_txBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void CSBmsPortMetrics::countRx(qint64 bytes)
+{
+    m_rxBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void CSBmsPortMetrics::countFrame()
+{
+    m_rxFrames.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CSBmsPortMetrics::countError(int code)
+{
+    if (code > 0 && code < BMS_ERROR_CODES) {
+        m_errors[code].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/* allocated on first use, published to the scraper with release */
+inline CSBmsPortMetrics::TAddress* CSBmsPortMetrics::address(quint8 address)
+{
+    TAddress* entry = m_addresses[address].load(std::memory_order_relaxed);
+
+    if (!entry) {
+        entry = new TAddress();
+        m_addresses[address].store(entry, std::memory_order_release);
+    }
+    return entry;
+}
+
+void CSBmsPortMetrics::observeLatency(quint8 address, quint8 cid2, qint64 latencyNs)
+{
+    TAddress* entry = this->address(address);
+    const quint32 key = 0x100 | cid2;
+    THistogram* histogram = nullptr;
+
+    /* the device is the only writer, a free slot can't be taken
+     * behind our back */
+    for (int i = 0; i < BMS_LATENCY_SLOTS; i++) {
+        const quint32 slot = entry->latency[i].key.load(std::memory_order_relaxed);
+        if (slot == key || slot == 0) {
+            histogram = &entry->latency[i];
+            if (slot == 0) {
+                histogram->key.store(key, std::memory_order_release);
+            }
+            break;
+        }
+    }
+    if (!histogram) {
+        m_latencyDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    int bucket = 0;
+    while (bucket < BMS_LATENCY_BUCKETS - 1 && latencyNs > BMS_LATENCY_BOUNDS[bucket]) {
+        bucket++;
+    }
+
+    histogram->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram->sumNs.fetch_add(qMax(0LL, latencyNs), std::memory_order_relaxed);
+}
+
+void CSBmsPortMetrics::updatePack(const CSSuperVoltBmsDevice::TAnalogData& data)
+{
+    TAddress* entry = address(data.address);
+    const quint8 cells = qMin<quint8>(data.cellCount, BMS_MAX_CELLS);
+    const quint8 temps = qMin<quint8>(data.tempCount, BMS_MAX_TEMPS);
+
+    for (int i = 0; i < cells; i++) {
+        entry->cellVoltage[i].store(data.cellVoltage[i], std::memory_order_relaxed);
+    }
+    for (int i = 0; i < temps; i++) {
+        entry->temperature[i].store(data.temperature[i], std::memory_order_relaxed);
+    }
+    entry->current.store(data.current, std::memory_order_relaxed);
+    entry->voltage.store(data.voltage, std::memory_order_relaxed);
+    entry->remainCapacity.store(data.remainCapacity, std::memory_order_relaxed);
+    entry->totalCapacity.store(data.totalCapacity, std::memory_order_relaxed);
+    entry->cycles.store(data.cycles, std::memory_order_relaxed);
+    entry->cellCount.store(cells, std::memory_order_relaxed);
+    entry->tempCount.store(temps, std::memory_order_relaxed);
+    entry->soc.store(data.soc, std::memory_order_relaxed);
+    entry->timestamp.store(data.timestamp, std::memory_order_release);
+}
+
+/* ----------------------------------------------------------
+ *  Registry, consumer side
+ * ---------------------------------------------------------- */
+
+CSBmsMetrics::CSBmsMetrics()
+    : m_mutex()
+    , m_ports()
+{
+}
+
+CSBmsMetrics::~CSBmsMetrics()
+{
+    qDeleteAll(m_ports);
+}
+
+CSBmsPortMetrics* CSBmsMetrics::addPort(const QString& bus, const QString& portName)
+{
+    QMutexLocker locker(&m_mutex);
+    CSBmsPortMetrics* port = new CSBmsPortMetrics(bus, portName);
+
+    m_ports.append(port);
+    return port;
+}
+
+QByteArray CSBmsMetrics::render() const
+{
+    QMutexLocker locker(&m_mutex);
+    QByteArray out;
+
+    out.reserve(16384);
+    renderCounters(out);
+    renderErrors(out);
+    renderLatency(out);
+    renderPacks(out);
+    return out;
+}
+
+inline void CSBmsMetrics::renderCounters(QByteArray& out) const
+{
+    typedef struct {
+        const char* name;
+        const char* help;
+        std::atomic<quint64> CSBmsPortMetrics::*counter;
+    } TCounter;
+
+    static const TCounter counters[] = {
+       {"svbms_tx_frames_total", "Request frames written", &CSBmsPortMetrics::m_txFrames},
+       {"svbms_tx_bytes_total", "Request bytes written", &CSBmsPortMetrics::m_txBytes},
+       {"svbms_rx_frames_total", "Complete response frames received", &CSBmsPortMetrics::m_rxFrames},
+       {"svbms_rx_bytes_total", "Bytes read from the port", &CSBmsPortMetrics::m_rxBytes},
+    };
+
+    for (const TCounter& counter : counters) {
+        appendFamily(out, counter.name, "counter", counter.help);
+        foreach (const CSBmsPortMetrics* port, m_ports) {
+            appendSample(out, counter.name, port->m_bus, port->m_portName);
+            appendValue(out, (port->*counter.counter).load(std::memory_order_relaxed));
+        }
+    }
+}
+
+inline void CSBmsMetrics::renderErrors(QByteArray& out) const
+{
+    const QMetaEnum errors = QMetaEnum::fromType<CSSuperVoltBmsDevice::BmsError>();
+
+    appendFamily(out, "svbms_errors_total", "counter", "Errors by BmsError code");
+    foreach (const CSBmsPortMetrics* port, m_ports) {
+        for (int code = 1; code < BMS_ERROR_CODES; code++) {
+            const quint64 value = port->m_errors[code].load(std::memory_order_relaxed);
+            if (!value) {
+                continue;
+            }
+
+            const char* key = errors.valueToKey(code);
+            appendSample(out, "svbms_errors_total", port->m_bus, port->m_portName);
+            out.append(",code=\"").append(QByteArray::number(code)).append("\",error=\"");
+            out.append(key ? key : "Unknown").append('"');
+            appendValue(out, value);
+        }
+    }
+
+    appendFamily(out, "svbms_timeouts_total", "counter", "Requests without a reply in time");
+    foreach (const CSBmsPortMetrics* port, m_ports) {
+        appendSample(out, "svbms_timeouts_total", port->m_bus, port->m_portName);
+        appendValue(out, port->m_errors[CSSuperVoltBmsDevice::TimeoutError].load(std::memory_order_relaxed));
+    }
+
+    appendFamily(out, "svbms_latency_dropped_total", "counter", "Latencies not recorded, histogram slots of the address used up");
+    foreach (const CSBmsPortMetrics* port, m_ports) {
+        appendSample(out, "svbms_latency_dropped_total", port->m_bus, port->m_portName);
+        appendValue(out, port->m_latencyDropped.load(std::memory_order_relaxed));
+    }
+}
+
+inline void CSBmsMetrics::renderLatency(QByteArray& out) const
+{
+    static const char* name = "svbms_request_latency_seconds";
+
+    appendFamily(out, name, "histogram", "Request written to response complete");
+    foreach (const CSBmsPortMetrics* port, m_ports) {
+        for (int a = 0; a < 256; a++) {
+            const CSBmsPortMetrics::TAddress* entry = port->m_addresses[a].load(std::memory_order_acquire);
+            if (!entry) {
+                continue;
+            }
+
+            for (int i = 0; i < BMS_LATENCY_SLOTS; i++) {
+                const CSBmsPortMetrics::THistogram& h = entry->latency[i];
+                const quint32 key = h.key.load(std::memory_order_acquire);
+                if (!key) {
+                    break;
+                }
+
+                QByteArray labels = ",address=\"";
+                labels.append(QByteArray::number(a)).append("\",cid2=\"0x");
+                labels.append(QByteArray::number(key & 0xff, 16).rightJustified(2, '0')).append('"');
+
+                quint64 cumulative = 0;
+                for (int b = 0; b < BMS_LATENCY_BUCKETS; b++) {
+                    cumulative += h.buckets[b].load(std::memory_order_relaxed);
+                    appendSample(out, "svbms_request_latency_seconds_bucket", port->m_bus, port->m_portName);
+                    out.append(labels).append(",le=\"");
+                    if (b < BMS_LATENCY_BUCKETS - 1) {
+                        out.append(QByteArray::number(BMS_LATENCY_BOUNDS[b] / 1e9, 'g', 6));
+                    }
+                    else {
+                        out.append("+Inf");
+                    }
+                    out.append('"');
+                    appendValue(out, cumulative);
+                }
+
+                appendSample(out, "svbms_request_latency_seconds_sum", port->m_bus, port->m_portName);
+                out.append(labels);
+                appendValue(out, h.sumNs.load(std::memory_order_relaxed) / 1e9);
+
+                /* the bucket sum, a scrape must not see count < +Inf */
+                appendSample(out, "svbms_request_latency_seconds_count", port->m_bus, port->m_portName);
+                out.append(labels);
+                appendValue(out, cumulative);
+            }
+        }
+    }
+}
+
+inline void CSBmsMetrics::renderPacks(QByteArray& out) const
+{
+    typedef std::function<void(QByteArray&, const QByteArray&, const CSBmsPortMetrics::TAddress*)> TGauge;
+
+    /* one family per gauge, every address with data */
+    auto family = [&](const char* name, const char* help, const TGauge& gauge) {
+        appendFamily(out, name, "gauge", help);
+        foreach (const CSBmsPortMetrics* port, m_ports) {
+            for (int a = 0; a < 256; a++) {
+                const CSBmsPortMetrics::TAddress* entry = port->m_addresses[a].load(std::memory_order_acquire);
+                if (!entry || !entry->timestamp.load(std::memory_order_acquire)) {
+                    continue;
+                }
+
+                QByteArray prefix;
+                appendSample(prefix, name, port->m_bus, port->m_portName);
+                prefix.append(",address=\"").append(QByteArray::number(a)).append('"');
+                gauge(out, prefix, entry);
+            }
+        }
+    };
+
+    family("svbms_pack_updated_timestamp_seconds", "Time of the latest analog data", [](QByteArray& out, const QByteArray& prefix, const CSBmsPortMetrics::TAddress* e) {
+        out.append(prefix);
+        appendValue(out, e->timestamp.load(std::memory_order_relaxed) / 1000.0);
+    });
+    family("svbms_pack_voltage_volts", "Pack voltage", [](QByteArray& out, const QByteArray& prefix, const CSBmsPortMetrics::TAddress* e) {
+        out.append(prefix);
+        appendValue(out, e->voltage.load(std::memory_order_relaxed) / 1000.0);
+    });
+    family("svbms_pack_current_amperes", "Pack current, negative when discharging", [](QByteArray& out, const QByteArray& prefix, const CSBmsPortMetrics::TAddress* e) {
+        out.append(prefix);
+        appendValue(out, e->current.load(std::memory_order_relaxed) / 1000.0);
+    });
+    family("svbms_pack_soc_percent", "State of charge", [](QByteArray& out, const QByteArray& prefix, const CSBmsPortMetrics::TAddress* e) {
+        out.append(prefix);
+        appendValue(out, quint64(e->soc.load(std::memory_order_relaxed)));
+    });
+    family("svbms_pack_remain_capacity_ah", "Remaining capacity", [](QByteArray& out, const QByteArray& prefix, const CSBmsPortMetrics::TAddress* e) {
+        out.append(prefix);
+        appendValue(out, e->remainCapacity.load(std::memory_order_relaxed) / 1000.0);
+    });
+    family("svbms_pack_total_capacity_ah", "Full charge capacity", [](QByteArray& out, const QByteArray& prefix, const CSBmsPortMetrics::TAddress* e) {
+        out.append(prefix);
+        appendValue(out, e->totalCapacity.load(std::memory_order_relaxed) / 1000.0);
+    });
+    family("svbms_pack_cycles", "Charge cycles", [](QByteArray& out, const QByteArray& prefix, const CSBmsPortMetrics::TAddress* e) {
+        out.append(prefix);
+        appendValue(out, quint64(e->cycles.load(std::memory_order_relaxed)));
+    });
+    family("svbms_cell_voltage_volts", "Cell voltage", [](QByteArray& out, const QByteArray& prefix, const CSBmsPortMetrics::TAddress* e) {
+        const int cells = e->cellCount.load(std::memory_order_relaxed);
+        for (int i = 0; i < cells; i++) {
+            out.append(prefix).append(",cell=\"").append(QByteArray::number(i + 1)).append('"');
+            appendValue(out, e->cellVoltage[i].load(std::memory_order_relaxed) / 1000.0);
+        }
+    });
+    family("svbms_temperature_celsius", "Temperature sensor", [](QByteArray& out, const QByteArray& prefix, const CSBmsPortMetrics::TAddress* e) {
+        const int temps = e->tempCount.load(std::memory_order_relaxed);
+        for (int i = 0; i < temps; i++) {
+            out.append(prefix).append(",sensor=\"").append(QByteArray::number(i + 1)).append('"');
+            appendValue(out, e->temperature[i].load(std::memory_order_relaxed) / 10.0);
+        }
+    });
+}
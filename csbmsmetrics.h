@@ -0,0 +1,104 @@
+#pragma once
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <cssupervoltbmsdevice.h>
+
+/* Prometheus style metrics of the BMS buses.
+ *
+ * Every port has one CSBmsPortMetrics, updated by its device in
+ * the I/O thread with relaxed atomics only: no lock, no allocation
+ * except the first time an address shows up. CSBmsMetrics renders
+ * the text exposition format from any thread; a scrape reads the
+ * counters while they move, each value on its own is consistent. */
+
+/* request to reply latency bucket bounds (ns), +Inf is implicit */
+static const qint64 BMS_LATENCY_BOUNDS[] = {
+   5000000LL,   10000000LL,  25000000LL,  50000000LL,   100000000LL,
+   250000000LL, 500000000LL, 1000000000LL, 2500000000LL, 5000000000LL,
+};
+static const int BMS_LATENCY_BUCKETS = sizeof(BMS_LATENCY_BOUNDS) / sizeof(BMS_LATENCY_BOUNDS[0]) + 1;
+
+/* BmsError codes end at UserErrorLast + QSerialPort::NotOpenError */
+static const int BMS_ERROR_CODES = 0x110;
+
+/* distinct CID2 with a latency histogram per address */
+static const int BMS_LATENCY_SLOTS = 8;
+
+class CSBmsPortMetrics
+{
+public:
+    CSBmsPortMetrics(const QString& bus, const QString& portName);
+    ~CSBmsPortMetrics();
+
+    /* producer side, the device thread only */
+    void countTx(qint64 bytes);
+    void countRx(qint64 bytes);
+    void countFrame();
+    void countError(int code);
+    void observeLatency(quint8 address, quint8 cid2, qint64 latencyNs);
+    void updatePack(const CSSuperVoltBmsDevice::TAnalogData& data);
+
+private:
+    friend class CSBmsMetrics;
+
+    typedef struct {
+        std::atomic<quint32> key; /* 0x100 | cid2, 0 = unused */
+        std::atomic<quint64> buckets[BMS_LATENCY_BUCKETS];
+        std::atomic<quint64> sumNs;
+    } THistogram;
+
+    /* latest decoded analog data, one field per atomic */
+    typedef struct {
+        std::atomic<qint64> timestamp; /* ms since epoch, 0 = none yet */
+        std::atomic<quint16> cellVoltage[BMS_MAX_CELLS];
+        std::atomic<qint16> temperature[BMS_MAX_TEMPS];
+        std::atomic<qint32> current;
+        std::atomic<quint32> voltage;
+        std::atomic<quint32> remainCapacity;
+        std::atomic<quint32> totalCapacity;
+        std::atomic<quint16> cycles;
+        std::atomic<quint8> cellCount;
+        std::atomic<quint8> tempCount;
+        std::atomic<quint8> soc;
+        THistogram latency[BMS_LATENCY_SLOTS];
+    } TAddress;
+
+    const QString m_bus;
+    const QString m_portName;
+    std::atomic<quint64> m_txFrames;
+    std::atomic<quint64> m_txBytes;
+    std::atomic<quint64> m_rxFrames;
+    std::atomic<quint64> m_rxBytes;
+    std::atomic<quint64> m_latencyDropped;
+    std::atomic<quint64> m_errors[BMS_ERROR_CODES];
+    std::atomic<TAddress*> m_addresses[256];
+
+private:
+    inline TAddress* address(quint8 address);
+};
+
+/* Registry of all ports, renders the exposition text */
+class CSBmsMetrics
+{
+public:
+    CSBmsMetrics();
+    ~CSBmsMetrics();
+
+    /* owned by the registry, valid until it is destroyed */
+    CSBmsPortMetrics* addPort(const QString& bus, const QString& portName);
+
+    QByteArray render() const;
+
+private:
+    mutable QMutex m_mutex; /* port list only, never taken by a device */
+    QList<CSBmsPortMetrics*> m_ports;
+
+private:
+    inline void renderCounters(QByteArray& out) const;
+    inline void renderErrors(QByteArray& out) const;
+    inline void renderLatency(QByteArray& out) const;
+    inline void renderPacks(QByteArray& out) const;
+};
@@ -0,0 +1,99 @@
+#include <QDebug>
+#include <QTimer>
+#include <csbmsmetricsserver.h>
+
+/* a request line and a few headers, anything longer is not a scraper */
+static const int METRICS_MAX_REQUEST = 4096;
+/* ms a client may take to send its request */
+static const int METRICS_REQUEST_TIMEOUT = 5000;
+
+CSBmsMetricsServer::CSBmsMetricsServer(CSBmsMetrics* metrics, QObject* parent)
+    : QObject(parent)
+    , m_metrics(metrics)
+    , m_server(this)
+{
+    connect(&m_server, &QTcpServer::newConnection, this, &CSBmsMetricsServer::onNewConnection);
+}
+
+CSBmsMetricsServer::~CSBmsMetricsServer()
+{
+    close();
+}
+
+bool CSBmsMetricsServer::listen(const QHostAddress& address, quint16 port)
+{
+    if (!m_server.listen(address, port)) {
+        qDebug() << "BMSMETRICS: Unable to listen on" << address << port << m_server.errorString();
+        return false;
+    }
+
+    qDebug() << "BMSMETRICS: Listening on" << m_server.serverAddress() << m_server.serverPort();
+    return true;
+}
+
+void CSBmsMetricsServer::close()
+{
+    m_server.close();
+}
+
+quint16 CSBmsMetricsServer::serverPort() const
+{
+    return m_server.serverPort();
+}
+
+void CSBmsMetricsServer::onNewConnection()
+{
+    while (QTcpSocket* socket = m_server.nextPendingConnection()) {
+        connect(socket, &QTcpSocket::readyRead, this, &CSBmsMetricsServer::onReadyRead);
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+
+        /* drop clients that connect and never ask */
+        QTimer::singleShot(METRICS_REQUEST_TIMEOUT, socket, [socket]() { socket->abort(); });
+    }
+}
+
+void CSBmsMetricsServer::onReadyRead()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket) {
+        return;
+    }
+
+    if (!socket->canReadLine()) {
+        if (socket->bytesAvailable() > METRICS_MAX_REQUEST) {
+            socket->abort();
+        }
+        return;
+    }
+
+    /* only the request line matters, headers are ignored */
+    const QList<QByteArray> request = socket->readLine(METRICS_MAX_REQUEST).trimmed().split(' ');
+    disconnect(socket, &QTcpSocket::readyRead, this, &CSBmsMetricsServer::onReadyRead);
+
+    if (request.size() < 2 || request.at(0) != "GET") {
+        reply(socket, "405 Method Not Allowed", "GET only\n");
+        return;
+    }
+
+    const QByteArray path = request.at(1).split('?').first();
+    if (path != "/metrics" && path != "/") {
+        reply(socket, "404 Not Found", "Not found\n");
+        return;
+    }
+
+    reply(socket, "200 OK", m_metrics->render());
+}
+
+inline void CSBmsMetricsServer::reply(QTcpSocket* socket, const QByteArray& status, const QByteArray& body)
+{
+    QByteArray header;
+
+    header.append("HTTP/1.0 ").append(status).append("\r\n");
+    header.append("Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n");
+    header.append("Content-Length: ").append(QByteArray::number(body.size())).append("\r\n");
+    header.append("Connection: close\r\n\r\n");
+
+    socket->write(header);
+    socket->write(body);
+    socket->disconnectFromHost();
+}
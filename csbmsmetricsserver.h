@@ -0,0 +1,35 @@
+#pragma once
+#include <QHostAddress>
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <csbmsmetrics.h>
+
+/* Minimal HTTP/1.0 endpoint for a Prometheus scraper: GET /metrics
+ * answers the rendered registry, everything else 404. One request
+ * per connection, the connection is closed after the reply. Runs
+ * in the thread it lives in (the daemon's main thread); rendering
+ * reads atomics only and never waits on a device. */
+class CSBmsMetricsServer: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CSBmsMetricsServer(CSBmsMetrics* metrics, QObject* parent = nullptr);
+    ~CSBmsMetricsServer();
+
+    bool listen(const QHostAddress& address, quint16 port);
+    void close();
+    quint16 serverPort() const;
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+
+private:
+    CSBmsMetrics* m_metrics;
+    QTcpServer m_server;
+
+private:
+    inline void reply(QTcpSocket* socket, const QByteArray& status, const QByteArray& body);
+};
@@ -0,0 +1,368 @@
+#include <QDebug>
+#include <csbmsnativeport.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef Q_OS_LINUX
+#include <linux/serial.h>
+#endif
+
+static speed_t toSpeed(qint32 baudRate)
+{
+    switch (baudRate) {
+        case 1200:
+            return B1200;
+        case 2400:
+            return B2400;
+        case 4800:
+            return B4800;
+        case 9600:
+            return B9600;
+        case 19200:
+            return B19200;
+        case 38400:
+            return B38400;
+        case 57600:
+            return B57600;
+        case 115200:
+            return B115200;
+        default:
+            return B0;
+    }
+}
+
+CSBmsNativePort::CSBmsNativePort(QObject* parent)
+    : QIODevice(parent)
+    , m_portName()
+    , m_baudRate(QSerialPort::Baud9600)
+    , m_dataBits(QSerialPort::Data8)
+    , m_stopBits(QSerialPort::OneStop)
+    , m_parity(QSerialPort::NoParity)
+    , m_flowCtrl(QSerialPort::NoFlowControl)
+    , m_lowLatency(false)
+    , m_lowLatencyActive(false)
+    , m_fd(-1)
+    , m_notifier(nullptr)
+    , m_hangup(false)
+    , m_received(0)
+{
+}
+
+CSBmsNativePort::~CSBmsNativePort()
+{
+    close();
+}
+
+void CSBmsNativePort::setPortName(const QString& portName)
+{
+    m_portName = portName;
+}
+
+QString CSBmsNativePort::portName() const
+{
+    return m_portName;
+}
+
+void CSBmsNativePort::setBaudRate(qint32 baudRate)
+{
+    m_baudRate = baudRate;
+}
+
+void CSBmsNativePort::setDataBits(QSerialPort::DataBits dataBits)
+{
+    m_dataBits = dataBits;
+}
+
+void CSBmsNativePort::setStopBits(QSerialPort::StopBits stopBits)
+{
+    m_stopBits = stopBits;
+}
+
+void CSBmsNativePort::setParity(QSerialPort::Parity parity)
+{
+    m_parity = parity;
+}
+
+void CSBmsNativePort::setFlowControl(QSerialPort::FlowControl flowCtrl)
+{
+    m_flowCtrl = flowCtrl;
+}
+
+void CSBmsNativePort::setLowLatency(bool enable)
+{
+    m_lowLatency = enable;
+}
+
+bool CSBmsNativePort::isLowLatency() const
+{
+    return m_lowLatencyActive;
+}
+
+bool CSBmsNativePort::isSequential() const
+{
+    return true;
+}
+
+bool CSBmsNativePort::open(OpenMode mode)
+{
+    if (isOpen()) {
+        return true;
+    }
+
+    m_fd = ::open(m_portName.toLocal8Bit().constData(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (m_fd < 0) {
+        setErrorString(QString::fromLocal8Bit(strerror(errno)));
+        return false;
+    }
+
+    if (!configure()) {
+        setErrorString(QString::fromLocal8Bit(strerror(errno)));
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    /* stale bytes from before we opened */
+    tcflush(m_fd, TCIOFLUSH);
+
+    m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &CSBmsNativePort::onActivated);
+
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void CSBmsNativePort::close()
+{
+    if (!isOpen()) {
+        return;
+    }
+
+    QIODevice::close();
+
+    /* may run from the notifier's own activated() */
+    if (m_notifier) {
+        m_notifier->setEnabled(false);
+        m_notifier->deleteLater();
+        m_notifier = nullptr;
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_lowLatencyActive = false;
+    m_hangup = false;
+}
+
+/* raw 8N1 style line, non blocking reads (VMIN = VTIME = 0) */
+inline bool CSBmsNativePort::configure()
+{
+    struct termios tio;
+    const speed_t speed = toSpeed(m_baudRate);
+
+    if (speed == B0) {
+        errno = EINVAL;
+        return false;
+    }
+    if (tcgetattr(m_fd, &tio) < 0) {
+        return false;
+    }
+
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+    switch (m_dataBits) {
+        case QSerialPort::Data5: {
+            tio.c_cflag |= CS5;
+            break;
+        }
+        case QSerialPort::Data6: {
+            tio.c_cflag |= CS6;
+            break;
+        }
+        case QSerialPort::Data7: {
+            tio.c_cflag |= CS7;
+            break;
+        }
+        default: {
+            tio.c_cflag |= CS8;
+            break;
+        }
+    }
+
+    switch (m_parity) {
+        case QSerialPort::EvenParity: {
+            tio.c_cflag |= PARENB;
+            break;
+        }
+        case QSerialPort::OddParity: {
+            tio.c_cflag |= PARENB | PARODD;
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+
+    /* termios has no 1.5 stop bits, the UART uses 2 */
+    if (m_stopBits != QSerialPort::OneStop) {
+        tio.c_cflag |= CSTOPB;
+    }
+
+    tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+    if (m_flowCtrl == QSerialPort::HardwareControl) {
+        tio.c_cflag |= CRTSCTS;
+    }
+    else if (m_flowCtrl == QSerialPort::SoftwareControl) {
+        tio.c_iflag |= IXON | IXOFF;
+    }
+
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    if (tcsetattr(m_fd, TCSANOW, &tio) < 0) {
+        return false;
+    }
+
+    if (m_lowLatency) {
+        setAsyncLowLatency();
+    }
+    return true;
+}
+
+inline void CSBmsNativePort::setAsyncLowLatency()
+{
+#ifdef Q_OS_LINUX
+    struct serial_struct serial;
+
+    if (ioctl(m_fd, TIOCGSERIAL, &serial) < 0) {
+        qDebug() << "BMSDEV:" << m_portName << "has no ASYNC_LOW_LATENCY:" << strerror(errno);
+        return;
+    }
+
+    serial.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl(m_fd, TIOCSSERIAL, &serial) < 0) {
+        qDebug() << "BMSDEV: Unable to set ASYNC_LOW_LATENCY on" << m_portName << strerror(errno);
+        return;
+    }
+    m_lowLatencyActive = true;
+#endif
+}
+
+qint64 CSBmsNativePort::bytesAvailable() const
+{
+    int count = 0;
+
+    if (m_fd >= 0 && ioctl(m_fd, FIONREAD, &count) < 0) {
+        count = 0;
+    }
+    return count + QIODevice::bytesAvailable();
+}
+
+void CSBmsNativePort::onActivated()
+{
+    struct pollfd pfd = {m_fd, POLLIN, 0};
+
+    if (poll(&pfd, 1, 0) <= 0) {
+        return;
+    }
+
+    /* a hung up tty reports POLLIN | POLLHUP: hand over what is
+     * still buffered first */
+    m_received = 0;
+    if (pfd.revents & POLLIN) {
+        emit readyRead();
+    }
+    if (!isOpen()) {
+        return;
+    }
+
+    /* VMIN = 0 reads 0 both when idle and at end of file; readable
+     * but nothing read and nothing left means the other end is gone */
+    int pending = 0;
+    const bool eof = (pfd.revents & POLLIN) && m_received == 0 //
+                     && ioctl(m_fd, FIONREAD, &pending) == 0 && pending == 0;
+
+    /* the notifier would fire forever on a dead descriptor */
+    if (m_hangup || eof || (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))) {
+        setErrorString(tr("Serial line hangup"));
+        close();
+    }
+}
+
+/* EIO from read(): the reader is still inside read(), close once
+ * it is back (onActivated() or the queued call) */
+inline void CSBmsNativePort::hangup()
+{
+    if (m_hangup) {
+        return;
+    }
+
+    m_hangup = true;
+    if (m_notifier) {
+        m_notifier->setEnabled(false);
+    }
+    QMetaObject::invokeMethod(
+       this,
+       [this]() {
+           if (m_hangup) {
+               close();
+           }
+       },
+       Qt::QueuedConnection);
+}
+
+qint64 CSBmsNativePort::readData(char* data, qint64 maxSize)
+{
+    if (m_fd < 0 || m_hangup) {
+        return -1;
+    }
+
+    const ssize_t size = ::read(m_fd, data, maxSize);
+
+    if (size < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return 0;
+        }
+        setErrorString(QString::fromLocal8Bit(strerror(errno)));
+        if (errno == EIO) {
+            hangup();
+        }
+        return -1;
+    }
+
+    m_received += size;
+    return size;
+}
+
+qint64 CSBmsNativePort::writeData(const char* data, qint64 size)
+{
+    qint64 written = 0;
+
+    /* requests are tiny, the tty buffer takes them at once */
+    while (written < size) {
+        const ssize_t n = ::write(m_fd, data + written, size - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
+            }
+            setErrorString(QString::fromLocal8Bit(strerror(errno)));
+            return -1;
+        }
+        written += n;
+    }
+
+    if (written > 0) {
+        emit bytesWritten(written);
+    }
+    return written;
+}
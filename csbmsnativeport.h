@@ -0,0 +1,63 @@
+#pragma once
+#include <QIODevice>
+#include <QSerialPort>
+#include <QSocketNotifier>
+#include <QString>
+
+/* Serial port on a raw termios file descriptor. Unbuffered: the
+ * descriptor is read when the device reads, there is no internal
+ * buffer between the UART driver and the frame parser. Optional
+ * ASYNC_LOW_LATENCY asks the tty layer to push received bytes to
+ * the reader right away instead of on its own flush tick. */
+class CSBmsNativePort: public QIODevice
+{
+    Q_OBJECT
+
+public:
+    explicit CSBmsNativePort(QObject* parent = nullptr);
+    ~CSBmsNativePort();
+
+    void setPortName(const QString& portName);
+    QString portName() const;
+
+    void setBaudRate(qint32 baudRate);
+    void setDataBits(QSerialPort::DataBits dataBits);
+    void setStopBits(QSerialPort::StopBits stopBits);
+    void setParity(QSerialPort::Parity parity);
+    void setFlowControl(QSerialPort::FlowControl flowCtrl);
+    void setLowLatency(bool enable);
+
+    /* false when the driver refused ASYNC_LOW_LATENCY (e.g. a pty) */
+    bool isLowLatency() const;
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override;
+    qint64 bytesAvailable() const override;
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 size) override;
+
+private slots:
+    void onActivated();
+
+private:
+    QString m_portName;
+    qint32 m_baudRate;
+    QSerialPort::DataBits m_dataBits;
+    QSerialPort::StopBits m_stopBits;
+    QSerialPort::Parity m_parity;
+    QSerialPort::FlowControl m_flowCtrl;
+    bool m_lowLatency;
+    bool m_lowLatencyActive;
+    int m_fd;
+    QSocketNotifier* m_notifier;
+    bool m_hangup;
+    qint64 m_received; /* bytes read since the last activation */
+
+private:
+    inline bool configure();
+    inline void setAsyncLowLatency();
+    inline void hangup();
+};
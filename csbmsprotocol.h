@@ -0,0 +1,298 @@
+#pragma once
+#include <QtGlobal>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* fixed codes */
+static const quint8 BMS_PROTO_SOI_3E = 0x3e;
+static const quint8 BMS_PROTO_SOI_7E = 0x7e;
+static const quint8 BMS_PROTO_EOI = 0x0d;
+
+/* protocol version */
+static const quint8 BMS_PROTO_VER = 0x22;
+
+/* SX150 Lithium Iron Phosphate Battery Management System  */
+static const quint8 BMS_CID1_LIFEPO4 = 0x4a;
+
+/* function codes */
+static const quint8 BMS_CID2_FETCH_ANALOG_DATA = 0x41;
+static const quint8 BMS_CID2_FETCH_MANUFACTURER = 0x51;
+static const quint8 BMS_CID2_FETCH_DEVICE_ADDR = 0x50;
+static const quint8 BMS_CID2_FETCH_PROTO_VER = 0x4f;
+static const quint8 BMS_CID2_FETCH_TIME = 0x4d;
+
+/* Response frame layout (ASCII hex after SOI):
+ * SOI(1) VER(2) ADR(2) CID1(2) RTN(2) LENGTH(4) INFO(LENID) CHKSUM(4) EOI(1)
+ * LENID is 12 bit, so a frame never exceeds BMS_MAX_FRAME_SIZE bytes. */
+static const int BMS_FRAME_HEADER_SIZE = 13; /* SOI + VER..LENGTH */
+static const int BMS_FRAME_TRAILER_SIZE = 5; /* CHKSUM + EOI */
+static const int BMS_MAX_INFO_SIZE = 0x0fff;
+static const int BMS_MAX_FRAME_SIZE = BMS_FRAME_HEADER_SIZE + BMS_MAX_INFO_SIZE + BMS_FRAME_TRAILER_SIZE;
+
+/* field offsets within a response frame */
+static const int BMS_FRAME_VER_OFFSET = 1;
+static const int BMS_FRAME_ADR_OFFSET = 3;
+static const int BMS_FRAME_CID1_OFFSET = 5;
+static const int BMS_FRAME_RTN_OFFSET = 7;
+static const int BMS_FRAME_LENGTH_OFFSET = 9;
+
+/* Largest request we build: SOI + header (16) + LENGTH (8) +
+ * INFO (8) + CHKSUM (8) + EOI with every ASCII option set */
+static const int BMS_MAX_REQUEST_SIZE = 64;
+
+/* analog data record limits */
+static const int BMS_MAX_CELLS = 24;
+static const int BMS_MAX_TEMPS = 8;
+
+namespace CSBmsProtocol {
+
+inline bool isSoi(char c)
+{
+    return static_cast<quint8>(c) == BMS_PROTO_SOI_3E //
+           || static_cast<quint8>(c) == BMS_PROTO_SOI_7E;
+}
+
+/* ASCII hex digit to nibble, 0xff if not a hex digit */
+inline quint8 hexValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return static_cast<quint8>(c - '0');
+    }
+    if (c >= 'A' && c <= 'F') {
+        return static_cast<quint8>(c - 'A' + 10);
+    }
+    if (c >= 'a' && c <= 'f') {
+        return static_cast<quint8>(c - 'a' + 10);
+    }
+    return 0xff;
+}
+
+/* two ASCII hex digits to byte, -1 on invalid digits */
+inline int hexByte(const char* p)
+{
+    const quint8 hi = hexValue(p[0]);
+    const quint8 lo = hexValue(p[1]);
+    if ((hi | lo) & 0xf0) {
+        return -1;
+    }
+    return (hi << 4) | lo;
+}
+
+/* Request header fields go out as the ASCII codes of the hex digits
+ * ("3232" for VER 0x22), replies and legacy requests as plain ASCII
+ * hex ("22"). True if the header at 'p' (behind SOI) is coded. */
+inline bool isCodedHeader(const char* p)
+{
+    return p[0] == '3' && p[1] == '2' && p[2] == '3' && p[3] == '2';
+}
+
+/* One header byte of a request, plain (2 characters) or coded (4
+ * characters), -1 on invalid digits */
+inline int requestByte(const char* p, bool codes)
+{
+    if (!codes) {
+        return hexByte(p);
+    }
+
+    const int hi = hexByte(p);
+    const int lo = hexByte(p + 2);
+    if (hi < 0 || lo < 0) {
+        return -1;
+    }
+
+    const quint8 h = hexValue(static_cast<char>(hi));
+    const quint8 l = hexValue(static_cast<char>(lo));
+    if ((h | l) & 0xf0) {
+        return -1;
+    }
+    return (h << 4) | l;
+}
+
+/* Bulk ASCII hex to binary, 'count' bytes from 2 * 'count' digits
+ * into 'out'. Returns -1 when all digits were valid, otherwise the
+ * position of the first invalid character in 'in'; 'out' is filled
+ * up to that point. 16 digits per step with SSE2, 32 with NEON. */
+inline qint64 hexDecode(const char* in, qint64 count, quint8* out)
+{
+    qint64 i = 0;
+
+#if defined(__SSE2__)
+    const __m128i digitLo = _mm_set1_epi8('0' - 1);
+    const __m128i digitHi = _mm_set1_epi8('9' + 1);
+    const __m128i alphaLo = _mm_set1_epi8('a' - 1);
+    const __m128i alphaHi = _mm_set1_epi8('f' + 1);
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i nibble = _mm_set1_epi16(0x00f0);
+
+    for (; i + 8 <= count; i += 8) {
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i));
+        const __m128i l = _mm_or_si128(c, lower);
+
+        /* signed compares, bytes >= 0x80 fail both ranges */
+        const __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(c, digitLo), _mm_cmplt_epi8(c, digitHi));
+        const __m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(l, alphaLo), _mm_cmplt_epi8(l, alphaHi));
+        if (_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xffff) {
+            break;
+        }
+
+        const __m128i n = _mm_or_si128(_mm_and_si128(_mm_sub_epi8(c, _mm_set1_epi8('0')), isDigit), //
+                                       _mm_and_si128(_mm_sub_epi8(l, _mm_set1_epi8('a' - 10)), isAlpha));
+
+        /* 16 bit lane = lo << 8 | hi -> (hi << 4) | lo */
+        const __m128i b = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(n, 4), nibble), _mm_srli_epi16(n, 8));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(b, b));
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t lower = vdupq_n_u8(0x20);
+
+    for (; i + 16 <= count; i += 16) {
+        /* de-interleave high and low digits */
+        const uint8x16x2_t c = vld2q_u8(reinterpret_cast<const uint8_t*>(in + 2 * i));
+        uint8x16_t n[2];
+        uint8x16_t valid = vdupq_n_u8(0xff);
+
+        for (int k = 0; k < 2; k++) {
+            const uint8x16_t d = vsubq_u8(c.val[k], vdupq_n_u8('0'));
+            const uint8x16_t a = vsubq_u8(vorrq_u8(c.val[k], lower), vdupq_n_u8('a'));
+            const uint8x16_t isDigit = vcltq_u8(d, vdupq_n_u8(10));
+            const uint8x16_t isAlpha = vcltq_u8(a, vdupq_n_u8(6));
+            valid = vandq_u8(valid, vorrq_u8(isDigit, isAlpha));
+            n[k] = vorrq_u8(vandq_u8(d, isDigit), vandq_u8(vaddq_u8(a, vdupq_n_u8(10)), isAlpha));
+        }
+
+        const uint64x2_t v = vreinterpretq_u64_u8(valid);
+        if ((vgetq_lane_u64(v, 0) & vgetq_lane_u64(v, 1)) != ~0ULL) {
+            break;
+        }
+        vst1q_u8(out + i, vorrq_u8(vshlq_n_u8(n[0], 4), n[1]));
+    }
+#endif
+
+    /* tail, or the block holding the invalid digit */
+    for (; i < count; i++) {
+        const quint8 hi = hexValue(in[2 * i]);
+        const quint8 lo = hexValue(in[2 * i + 1]);
+        if ((hi | lo) & 0xf0) {
+            return 2 * i + (hi > 0x0f ? 0 : 1);
+        }
+        out[i] = static_cast<quint8>((hi << 4) | lo);
+    }
+
+    return -1;
+}
+
+/* nibble -> ASCII hex digit */
+static constexpr char HEX_DIGITS[16] = {
+   '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
+};
+
+/* nibble -> ASCII hex code of its ASCII hex digit, e.g. 0xA -> 'A' -> "41" */
+static constexpr char HEX_CODES[16][2] = {
+   {'3', '0'}, {'3', '1'}, {'3', '2'}, {'3', '3'}, {'3', '4'}, {'3', '5'}, {'3', '6'}, {'3', '7'},
+   {'3', '8'}, {'3', '9'}, {'4', '1'}, {'4', '2'}, {'4', '3'}, {'4', '4'}, {'4', '5'}, {'4', '6'},
+};
+
+/* Encoders write to 'out' and return the position behind the
+ * written characters. The caller provides the space. */
+
+inline char* putHex4(char* out, quint8 nibble)
+{
+    *out++ = HEX_DIGITS[nibble & 0x0f];
+    return out;
+}
+
+inline char* putHex8(char* out, quint8 value)
+{
+    *out++ = HEX_DIGITS[value >> 4];
+    *out++ = HEX_DIGITS[value & 0x0f];
+    return out;
+}
+
+inline char* putHex16(char* out, quint16 value)
+{
+    out = putHex8(out, value >> 8);
+    return putHex8(out, value & 0xff);
+}
+
+/* ASCII codes of the hex digit (2 characters per nibble) */
+inline char* putCode4(char* out, quint8 nibble)
+{
+    const char* code = HEX_CODES[nibble & 0x0f];
+    *out++ = code[0];
+    *out++ = code[1];
+    return out;
+}
+
+inline char* putCode8(char* out, quint8 value)
+{
+    out = putCode4(out, value >> 4);
+    return putCode4(out, value & 0x0f);
+}
+
+inline char* putCode16(char* out, quint16 value)
+{
+    out = putCode8(out, value >> 8);
+    return putCode8(out, value & 0xff);
+}
+
+/* LCHKSUM: sum of the three LENID nibbles modulo 16, negated plus 1 */
+inline quint8 lengthChecksum(quint16 lenid)
+{
+    const int sum = ((lenid >> 8) & 0x0f) + ((lenid >> 4) & 0x0f) + (lenid & 0x0f);
+    return static_cast<quint8>((~(sum % 16) + 1) & 0x0f);
+}
+
+/* plain byte sum, tail of the vector kernel and reference */
+inline quint32 byteSumScalar(const char* data, qint64 size)
+{
+    quint32 sum = 0;
+    for (qint64 i = 0; i < size; i++) {
+        sum += static_cast<quint8>(data[i]);
+    }
+    return sum;
+}
+
+/* Unsigned byte sum, 16 bytes per step where the CPU has vectors.
+ * A frame is at most ~4 KiB, so 32 bit never overflows. */
+inline quint32 byteSum(const char* data, qint64 size)
+{
+    qint64 i = 0;
+    quint32 sum = 0;
+
+#if defined(__SSE2__)
+    /* SAD against zero adds 8 bytes into each 64 bit half */
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    sum = static_cast<quint32>(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#elif defined(__ARM_NEON)
+    /* pairwise widen 8 -> 16 bit, accumulate into 32 bit lanes */
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= size; i += 16) {
+        const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i));
+        acc = vpadalq_u16(acc, vpaddlq_u8(v));
+    }
+    sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#endif
+
+    return sum + byteSumScalar(data + i, size - i);
+}
+
+/* CHKSUM: sum of the ASCII characters modulo 65536, negated plus 1.
+ * 'data' excludes SOI, EOI and CHKSUM. Returns 0 for an empty sum. */
+inline quint16 checksum(const char* data, qint64 size)
+{
+    const quint32 sum = byteSum(data, size);
+    if (!sum) {
+        return 0;
+    }
+    return static_cast<quint16>(~(sum % 65536) + 1);
+}
+
+} // namespace CSBmsProtocol
@@ -0,0 +1,208 @@
+#include <QDebug>
+#include <csbmsreplaydevice.h>
+#include <string.h>
+
+/* as fast as possible: bytes handed out per event loop turn */
+static const qint64 REPLAY_BATCH_SIZE = 64 * 1024;
+
+CSBmsReplayDevice::CSBmsReplayDevice(QObject* parent)
+    : QIODevice(parent)
+    , m_reader()
+    , m_next()
+    , m_hasNext(false)
+    , m_finished(false)
+    , m_waitForRequest(false)
+    , m_port(-1)
+    , m_pacing(PacedByRequests)
+    , m_realTime(true)
+    , m_rx()
+    , m_rxPos(0)
+    , m_timer(this)
+    , m_clock()
+    , m_base(0)
+    , m_records(0)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &CSBmsReplayDevice::onReplayTimer);
+}
+
+CSBmsReplayDevice::~CSBmsReplayDevice()
+{
+    close();
+}
+
+bool CSBmsReplayDevice::setCapture(const QString& fileName)
+{
+    return m_reader.open(fileName);
+}
+
+void CSBmsReplayDevice::setPort(int port)
+{
+    m_port = port;
+}
+
+void CSBmsReplayDevice::setPacing(Pacing pacing)
+{
+    m_pacing = pacing;
+}
+
+void CSBmsReplayDevice::setRealTime(bool realTime)
+{
+    m_realTime = realTime;
+}
+
+quint64 CSBmsReplayDevice::replayedRecords() const
+{
+    return m_records;
+}
+
+bool CSBmsReplayDevice::open(OpenMode mode)
+{
+    if (!m_reader.isOpen()) {
+        setErrorString(tr("No capture file"));
+        return false;
+    }
+
+    m_reader.rewind();
+    m_rx.clear();
+    m_rxPos = 0;
+    m_records = 0;
+    m_finished = false;
+    fetchNext();
+
+    if (!QIODevice::open(mode | QIODevice::Unbuffered)) {
+        return false;
+    }
+
+    m_waitForRequest = (m_pacing == PacedByRequests);
+    if (!m_waitForRequest && m_hasNext) {
+        m_base = m_next.timestamp;
+        m_clock.start();
+        schedule();
+    }
+    return true;
+}
+
+void CSBmsReplayDevice::close()
+{
+    m_timer.stop();
+    QIODevice::close();
+}
+
+bool CSBmsReplayDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 CSBmsReplayDevice::bytesAvailable() const
+{
+    return (m_rx.size() - m_rxPos) + QIODevice::bytesAvailable();
+}
+
+qint64 CSBmsReplayDevice::readData(char* data, qint64 maxSize)
+{
+    const qint64 size = qMin(maxSize, qint64(m_rx.size()) - m_rxPos);
+
+    memcpy(data, m_rx.constData() + m_rxPos, size);
+    m_rxPos += size;
+
+    if (m_rxPos == m_rx.size()) {
+        m_rx.clear();
+        m_rxPos = 0;
+    }
+    return size;
+}
+
+/* the device wrote a request: release the replies to the next
+ * captured request, on the captured timeline */
+qint64 CSBmsReplayDevice::writeData(const char* data, qint64 size)
+{
+    Q_UNUSED(data);
+
+    if (m_pacing != PacedByRequests || !m_hasNext) {
+        return size;
+    }
+
+    while (m_hasNext && m_next.type != CSBmsCapture::RecordTx) {
+        fetchNext();
+    }
+    if (!m_hasNext) {
+        schedule();
+        return size;
+    }
+
+    m_base = m_next.timestamp;
+    m_waitForRequest = false;
+    m_clock.start();
+    fetchNext();
+    schedule();
+
+    return size;
+}
+
+void CSBmsReplayDevice::onReplayTimer()
+{
+    const quint64 now = m_base + m_clock.nsecsElapsed();
+    const qint64 before = m_rx.size() - m_rxPos;
+
+    while (m_hasNext && !m_waitForRequest) {
+        if (m_next.type == CSBmsCapture::RecordTx) {
+            /* paced: the next replies belong to the next request */
+            if (m_pacing == PacedByRequests) {
+                m_waitForRequest = true;
+                break;
+            }
+            fetchNext();
+            continue;
+        }
+        if (m_realTime && m_next.timestamp > now) {
+            break;
+        }
+        if (!m_realTime && (m_rx.size() - m_rxPos) - before >= REPLAY_BATCH_SIZE) {
+            break;
+        }
+
+        m_rx.append(m_next.data, m_next.size);
+        m_records++;
+        fetchNext();
+    }
+
+    if (m_rx.size() - m_rxPos > before) {
+        emit readyRead();
+    }
+
+    schedule();
+}
+
+inline void CSBmsReplayDevice::fetchNext()
+{
+    while ((m_hasNext = m_reader.next(m_next))) {
+        if (m_port < 0 || m_next.port == m_port) {
+            break;
+        }
+    }
+}
+
+inline void CSBmsReplayDevice::schedule()
+{
+    if (!m_hasNext) {
+        if (!m_finished) {
+            m_finished = true;
+            emit finished();
+        }
+        return;
+    }
+    if (m_waitForRequest) {
+        return;
+    }
+
+    if (!m_realTime || m_next.type == CSBmsCapture::RecordTx) {
+        m_timer.start(0);
+        return;
+    }
+
+    const quint64 now = m_base + m_clock.nsecsElapsed();
+    const quint64 due = m_next.timestamp > now ? m_next.timestamp - now : 0;
+    m_timer.start(static_cast<int>(due / 1000000));
+}
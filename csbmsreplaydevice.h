@@ -0,0 +1,73 @@
+#pragma once
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QIODevice>
+#include <QTimer>
+#include <csbmscapture.h>
+
+/* Plays the RX side of a capture file back as a serial transport,
+ * see CSSuperVoltBmsDevice::setTransport(). Data goes through the
+ * same parser and transaction path as live traffic.
+ *
+ * PacedByRequests: every request written by the device releases the
+ * replies that followed the next captured TX record.
+ * FreeRunning: all RX records are played on their own timeline.
+ *
+ * With real time off everything is delivered as fast as possible. */
+class CSBmsReplayDevice: public QIODevice
+{
+    Q_OBJECT
+
+public:
+    enum Pacing {
+        PacedByRequests = 0,
+        FreeRunning,
+    };
+
+    explicit CSBmsReplayDevice(QObject* parent = nullptr);
+    ~CSBmsReplayDevice();
+
+    bool setCapture(const QString& fileName);
+
+    /* replay one port of a multi port capture, -1 = all */
+    void setPort(int port);
+    void setPacing(Pacing pacing);
+    void setRealTime(bool realTime);
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override;
+    qint64 bytesAvailable() const override;
+
+    quint64 replayedRecords() const;
+
+signals:
+    void finished();
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 size) override;
+
+private slots:
+    void onReplayTimer();
+
+private:
+    CSBmsCaptureReader m_reader;
+    CSBmsCaptureReader::TRecord m_next;
+    bool m_hasNext;
+    bool m_finished;
+    bool m_waitForRequest;
+    int m_port;
+    Pacing m_pacing;
+    bool m_realTime;
+    QByteArray m_rx;
+    qint64 m_rxPos;
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    quint64 m_base;
+    quint64 m_records;
+
+private:
+    inline void fetchNext();
+    inline void schedule();
+};
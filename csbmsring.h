@@ -0,0 +1,162 @@
+#pragma once
+#include <QtGlobal>
+#include <atomic>
+#include <type_traits>
+
+/* Lock free single producer / single consumer ring. The producer
+ * is the device's I/O thread, the consumer whoever drains at its
+ * own pace (UI, storage, exporters). Storage is allocated once in
+ * the constructor; push and pop never allocate or lock. Indexes
+ * run freely, the capacity is rounded up to a power of two. */
+
+/* producer and consumer indexes live on their own cache lines */
+static const int BMS_CACHE_LINE = 64;
+
+typedef struct {
+    quint64 written;   /* items accepted */
+    quint64 read;      /* items consumed */
+    quint64 dropped;   /* items lost to overflow */
+    quint64 overflows; /* pushes hitting a full ring */
+    quint64 highWater; /* max fill level seen by the producer */
+} TRingStatistics;
+
+inline quint64 ringCapacity(quint64 size)
+{
+    quint64 capacity = 2;
+    while (capacity < size) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+/* Fixed capacity ring of trivially copyable records, e.g. decoded
+ * TAnalogData. What happens to a record pushed into a full ring is up
+ * to the overflow policy. */
+template <typename T>
+class CSBmsFrameRing
+{
+    static_assert(std::is_trivially_copyable<T>::value, "records are copied while the producer may overwrite them");
+
+public:
+    enum Overflow {
+        DropNewest = 0,  /* reject the new record, keep the backlog */
+        OverwriteOldest, /* lose the oldest record, keep the latest */
+    };
+
+    explicit CSBmsFrameRing(quint64 capacity, Overflow overflow = DropNewest)
+        : m_capacity(ringCapacity(capacity))
+        , m_mask(m_capacity - 1)
+        , m_overflow(overflow)
+        , m_items(new T[m_capacity])
+        , m_head(0)
+        , m_dropped(0)
+        , m_overflows(0)
+        , m_highWater(0)
+        , m_tail(0)
+    {
+    }
+
+    ~CSBmsFrameRing()
+    {
+        delete[] m_items;
+    }
+
+    CSBmsFrameRing(const CSBmsFrameRing&) = delete;
+    CSBmsFrameRing& operator=(const CSBmsFrameRing&) = delete;
+
+    quint64 capacity() const
+    {
+        return m_capacity;
+    }
+
+    Overflow overflow() const
+    {
+        return m_overflow;
+    }
+
+    /* producer side, false when the record was rejected */
+    bool push(const T& item)
+    {
+        const quint64 head = m_head.load(std::memory_order_relaxed);
+        quint64 tail = m_tail.load(std::memory_order_acquire);
+
+        if (head - tail >= m_capacity) {
+            m_overflows.store(m_overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            if (m_overflow == DropNewest) {
+                m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            /* take the oldest from the consumer; if it popped first,
+             * the slot is free anyway */
+            if (m_tail.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                tail++;
+            }
+        }
+
+        const quint64 fill = head - tail + 1;
+        if (fill > m_highWater.load(std::memory_order_relaxed)) {
+            m_highWater.store(fill, std::memory_order_relaxed);
+        }
+
+        m_items[head & m_mask] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* consumer side */
+    bool pop(T& item)
+    {
+        quint64 tail = m_tail.load(std::memory_order_acquire);
+
+        for (;;) {
+            if (tail == m_head.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            item = m_items[tail & m_mask];
+            if (m_overflow == DropNewest) {
+                m_tail.store(tail + 1, std::memory_order_release);
+                return true;
+            }
+
+            /* fails when the producer took this record while it was
+             * copied, 'tail' is reloaded with the next oldest */
+            if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+    }
+
+    quint64 size() const
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    /* any thread, values are a snapshot; 'read' includes overwritten
+     * records */
+    TRingStatistics statistics() const
+    {
+        return {m_head.load(std::memory_order_relaxed), //
+                m_tail.load(std::memory_order_relaxed),
+                m_dropped.load(std::memory_order_relaxed),
+                m_overflows.load(std::memory_order_relaxed),
+                m_highWater.load(std::memory_order_relaxed)};
+    }
+
+private:
+    const quint64 m_capacity;
+    const quint64 m_mask;
+    const Overflow m_overflow;
+    T* m_items;
+
+    /* producer owned */
+    alignas(BMS_CACHE_LINE) std::atomic<quint64> m_head;
+    std::atomic<quint64> m_dropped;
+    std::atomic<quint64> m_overflows;
+    std::atomic<quint64> m_highWater;
+
+    /* consumer owned, moved by the producer only to overwrite */
+    alignas(BMS_CACHE_LINE) std::atomic<quint64> m_tail;
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include <QObject>
+#include <QString>
+#include <cssupervoltbmsdevice.h>
+
+/* Destination of polled results in daemon mode. Sinks live in the
+ * daemon (main) thread, results arrive there queued from the bus
+ * schedulers. 'bus' is the name of the configuration group. */
+class CSBmsSink: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CSBmsSink(QObject* parent = nullptr)
+        : QObject(parent)
+    {
+    }
+
+    virtual bool open() = 0;
+    virtual void close() = 0;
+
+    virtual void publish(const QString& bus, const CSSuperVoltBmsDevice::TResponse& rsp) = 0;
+    virtual void publishError(const QString& bus, quint8 address, quint8 cid2, CSSuperVoltBmsDevice::BmsError error) = 0;
+
+    /* called periodically, push buffered records out */
+    virtual void flush() = 0;
+};
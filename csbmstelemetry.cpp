@@ -0,0 +1,878 @@
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <algorithm>
+#include <csbmstelemetry.h>
+#include <limits>
+#include <string.h>
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+typedef CSSuperVoltBmsDevice::TAnalogData TAnalogData;
+
+/* ----------------------------------------------------------
+ *  Column encoding
+ * ---------------------------------------------------------- */
+
+static inline quint64 zigzag(qint64 value)
+{
+    return (quint64(value) << 1) ^ quint64(value >> 63);
+}
+
+static inline qint64 unzigzag(quint64 value)
+{
+    return qint64(value >> 1) ^ -qint64(value & 1);
+}
+
+static inline int bitWidth(quint64 value)
+{
+    int width = 0;
+    while (value) {
+        width++;
+        value >>= 1;
+    }
+    return width;
+}
+
+static inline uchar* putVarint(uchar* pos, quint64 value)
+{
+    while (value >= 0x80) {
+        *pos++ = uchar(value) | 0x80;
+        value >>= 7;
+    }
+    *pos++ = uchar(value);
+    return pos;
+}
+
+static inline const uchar* getVarint(const uchar* pos, quint64& value)
+{
+    int shift = 0;
+
+    value = 0;
+    while (shift < 64) {
+        const uchar c = *pos++;
+        value |= quint64(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            break;
+        }
+        shift += 7;
+    }
+    return pos;
+}
+
+typedef struct {
+    uchar* pos;
+    quint64 acc;
+    int bits;
+} TBitWriter;
+
+typedef struct {
+    const uchar* pos;
+    quint64 acc;
+    int bits;
+} TBitReader;
+
+/* LSB first, at most 32 bits per step so the accumulator can't overflow */
+static inline void putBits(TBitWriter& w, quint64 value, int width)
+{
+    while (width > 32) {
+        putBits(w, value & 0xffffffffULL, 32);
+        value >>= 32;
+        width -= 32;
+    }
+
+    w.acc |= value << w.bits;
+    w.bits += width;
+    while (w.bits >= 8) {
+        *w.pos++ = uchar(w.acc);
+        w.acc >>= 8;
+        w.bits -= 8;
+    }
+}
+
+static inline quint64 getBits(TBitReader& r, int width)
+{
+    if (width > 32) {
+        const quint64 low = getBits(r, 32);
+        return low | (getBits(r, width - 32) << 32);
+    }
+
+    while (r.bits < width) {
+        r.acc |= quint64(*r.pos++) << r.bits;
+        r.bits += 8;
+    }
+
+    const quint64 value = r.acc & ((quint64(1) << width) - 1);
+    r.acc >>= width;
+    r.bits -= width;
+    return value;
+}
+
+/* width byte, then 'count' values of that width */
+static inline uchar* putPacked(uchar* pos, const quint64* values, int count)
+{
+    quint64 all = 0;
+    for (int i = 0; i < count; i++) {
+        all |= values[i];
+    }
+
+    const int width = bitWidth(all);
+    *pos++ = uchar(width);
+    if (!width || !count) {
+        return pos;
+    }
+
+    TBitWriter w = {pos, 0, 0};
+    for (int i = 0; i < count; i++) {
+        putBits(w, values[i], width);
+    }
+    if (w.bits) {
+        *w.pos++ = uchar(w.acc);
+    }
+    return w.pos;
+}
+
+/* upper limit of an encoded column: varint, width, 64 bit values */
+static inline qint64 columnBound(int rows)
+{
+    return 10 + 1 + rows * 8;
+}
+
+/* ----------------------------------------------------------
+ *  Channels of an analog record
+ * ---------------------------------------------------------- */
+
+static inline qint32 channelValue(const TAnalogData& data, int channel)
+{
+    switch (channel) {
+        case CSBmsTelemetry::ChCurrent: {
+            return data.current;
+        }
+        case CSBmsTelemetry::ChVoltage: {
+            return qint32(data.voltage);
+        }
+        case CSBmsTelemetry::ChRemainCapacity: {
+            return qint32(data.remainCapacity);
+        }
+        case CSBmsTelemetry::ChTotalCapacity: {
+            return qint32(data.totalCapacity);
+        }
+        case CSBmsTelemetry::ChCycles: {
+            return data.cycles;
+        }
+        case CSBmsTelemetry::ChSoc: {
+            return data.soc;
+        }
+        default: {
+            const int index = channel - CSBmsTelemetry::ChFirstCell;
+            if (index < data.cellCount) {
+                return data.cellVoltage[index];
+            }
+            return data.temperature[index - data.cellCount];
+        }
+    }
+}
+
+static inline void setChannelValue(TAnalogData& data, int channel, qint32 value)
+{
+    switch (channel) {
+        case CSBmsTelemetry::ChCurrent: {
+            data.current = value;
+            break;
+        }
+        case CSBmsTelemetry::ChVoltage: {
+            data.voltage = quint32(value);
+            break;
+        }
+        case CSBmsTelemetry::ChRemainCapacity: {
+            data.remainCapacity = quint32(value);
+            break;
+        }
+        case CSBmsTelemetry::ChTotalCapacity: {
+            data.totalCapacity = quint32(value);
+            break;
+        }
+        case CSBmsTelemetry::ChCycles: {
+            data.cycles = quint16(value);
+            break;
+        }
+        case CSBmsTelemetry::ChSoc: {
+            data.soc = quint8(value);
+            break;
+        }
+        default: {
+            const int index = channel - CSBmsTelemetry::ChFirstCell;
+            if (index < data.cellCount) {
+                data.cellVoltage[index] = quint16(value);
+            }
+            else {
+                data.temperature[index - data.cellCount] = qint16(value);
+            }
+            break;
+        }
+    }
+}
+
+/* ----------------------------------------------------------
+ *  Store
+ * ---------------------------------------------------------- */
+
+CSBmsTelemetryStore::CSBmsTelemetryStore()
+    : m_directory()
+    , m_segmentSize(BMS_TELEMETRY_SEGMENT_SIZE)
+    , m_ports()
+    , m_portsFile()
+    , m_series()
+    , m_index()
+    , m_segment()
+    , m_map(nullptr)
+    , m_segmentNo(-1)
+    , m_readSegment()
+    , m_readMap(nullptr)
+    , m_readSegmentNo(-1)
+    , m_scratch()
+    , m_statistics()
+{
+}
+
+CSBmsTelemetryStore::~CSBmsTelemetryStore()
+{
+    close();
+}
+
+inline quint32 CSBmsTelemetryStore::seriesKey(quint16 port, quint8 address)
+{
+    return (quint32(port) << 8) | address;
+}
+
+inline QString CSBmsTelemetryStore::segmentName(qint32 segment) const
+{
+    return QStringLiteral("%1/seg-%2.svts").arg(m_directory).arg(segment, 8, 10, QChar('0'));
+}
+
+bool CSBmsTelemetryStore::open(const QString& directory, qint64 segmentSize)
+{
+    close();
+
+    if (!QDir().mkpath(directory)) {
+        qWarning() << "BMSTSDB: Unable to create" << directory;
+        return false;
+    }
+
+    m_directory = directory;
+    m_segmentSize = qMax<qint64>(65536, (segmentSize + 4095) & ~qint64(4095));
+    m_statistics = {};
+
+    if (!loadPorts()) {
+        m_directory.clear();
+        return false;
+    }
+
+    const QStringList segments = QDir(directory).entryList({"seg-*.svts"}, QDir::Files, QDir::Name);
+    qint32 last = -1;
+
+    foreach (const QString& name, segments) {
+        bool ok;
+        const qint32 segment = name.mid(4, 8).toInt(&ok);
+        if (ok && scanSegment(segment)) {
+            last = qMax(last, segment);
+        }
+    }
+
+    /* keep filling the last segment, a new one is created on demand */
+    if (last >= 0 && !openSegment(last)) {
+        m_segmentNo = last;
+    }
+
+    qDebug() << "BMSTSDB: Opened" << directory << m_statistics.segments << "segments" << m_statistics.blocks << "blocks";
+    return true;
+}
+
+void CSBmsTelemetryStore::close()
+{
+    if (m_directory.isEmpty()) {
+        return;
+    }
+
+    seal(0);
+    closeSegment();
+
+    if (m_readMap) {
+        m_readSegment.unmap(m_readMap);
+        m_readMap = nullptr;
+    }
+    m_readSegment.close();
+    m_readSegmentNo = -1;
+    m_segmentNo = -1;
+
+    m_portsFile.close();
+    m_ports.clear();
+    m_series.clear();
+    m_index.clear();
+    m_directory.clear();
+}
+
+bool CSBmsTelemetryStore::isOpen() const
+{
+    return !m_directory.isEmpty();
+}
+
+inline bool CSBmsTelemetryStore::loadPorts()
+{
+    m_portsFile.setFileName(m_directory + QStringLiteral("/ports"));
+    if (!m_portsFile.open(QIODevice::ReadWrite | QIODevice::Append | QIODevice::Text)) {
+        qWarning() << "BMSTSDB: Unable to open" << m_portsFile.fileName() << m_portsFile.errorString();
+        return false;
+    }
+
+    m_portsFile.seek(0);
+    m_ports = QString::fromUtf8(m_portsFile.readAll()).split('\n', Qt::SkipEmptyParts);
+    return true;
+}
+
+inline qint32 CSBmsTelemetryStore::portId(const QString& port)
+{
+    qint32 id = m_ports.indexOf(port);
+
+    if (id < 0) {
+        if (m_ports.size() > 0xffff) {
+            return -1;
+        }
+
+        m_portsFile.write(port.toUtf8() + '\n');
+        m_portsFile.flush();
+        m_ports.append(port);
+        id = m_ports.size() - 1;
+    }
+    return id;
+}
+
+/* rebuild the index from the block headers of a segment */
+inline bool CSBmsTelemetryStore::scanSegment(qint32 segment)
+{
+    QFile file(segmentName(segment));
+
+    if (!file.open(QIODevice::ReadOnly) || file.size() < qint64(sizeof(CSBmsTelemetry::TSegmentHeader))) {
+        return false;
+    }
+
+    const uchar* map = file.map(0, file.size());
+    if (!map) {
+        return false;
+    }
+
+    CSBmsTelemetry::TSegmentHeader header;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, BMS_TELEMETRY_MAGIC, sizeof(header.magic)) != 0 //
+        || header.version != BMS_TELEMETRY_VERSION
+        || header.used > quint64(file.size())) {
+        qWarning() << "BMSTSDB: Skipping" << file.fileName() << "not a telemetry segment";
+        file.unmap(const_cast<uchar*>(map));
+        return false;
+    }
+
+    quint64 offset = header.headerSize;
+    while (offset + sizeof(CSBmsTelemetry::TBlockHeader) <= header.used) {
+        CSBmsTelemetry::TBlockHeader block;
+        memcpy(&block, map + offset, sizeof(block));
+
+        if (block.magic != BMS_TELEMETRY_BLOCK_MAGIC || block.size < sizeof(block) || offset + block.size > header.used) {
+            qWarning() << "BMSTSDB: Broken block in" << file.fileName() << "at" << offset;
+            break;
+        }
+
+        m_index[seriesKey(block.port, block.address)].append({segment, quint32(offset), block.firstTime, block.lastTime});
+        m_statistics.blocks++;
+        offset += block.size;
+    }
+
+    m_statistics.segments++;
+    file.unmap(const_cast<uchar*>(map));
+    return true;
+}
+
+inline bool CSBmsTelemetryStore::createSegment(qint32 segment)
+{
+    closeSegment();
+
+    m_segment.setFileName(segmentName(segment));
+    if (!m_segment.open(QIODevice::ReadWrite | QIODevice::Truncate) || !m_segment.resize(m_segmentSize)) {
+        qWarning() << "BMSTSDB: Unable to create" << m_segment.fileName() << m_segment.errorString();
+        m_segment.close();
+        return false;
+    }
+
+    m_map = m_segment.map(0, m_segmentSize);
+    if (!m_map) {
+        qWarning() << "BMSTSDB: Unable to map" << m_segment.fileName() << m_segment.errorString();
+        m_segment.close();
+        return false;
+    }
+
+    CSBmsTelemetry::TSegmentHeader header = {};
+    memcpy(header.magic, BMS_TELEMETRY_MAGIC, sizeof(header.magic));
+    header.version = BMS_TELEMETRY_VERSION;
+    header.headerSize = sizeof(header);
+    header.segmentSize = m_segmentSize;
+    header.used = sizeof(header);
+    header.created = QDateTime::currentMSecsSinceEpoch();
+    memcpy(m_map, &header, sizeof(header));
+
+    m_segmentNo = segment;
+    m_statistics.segments++;
+    return true;
+}
+
+/* reopen the last segment for writing, false if it is full */
+inline bool CSBmsTelemetryStore::openSegment(qint32 segment)
+{
+    m_segment.setFileName(segmentName(segment));
+    if (!m_segment.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+
+    m_map = m_segment.map(0, m_segment.size());
+    if (!m_map) {
+        m_segment.close();
+        return false;
+    }
+
+    const CSBmsTelemetry::TSegmentHeader* header = reinterpret_cast<CSBmsTelemetry::TSegmentHeader*>(m_map);
+    if (header->used + columnBound(1) >= quint64(m_segment.size())) {
+        closeSegment();
+        return false;
+    }
+
+    m_segmentNo = segment;
+    return true;
+}
+
+inline void CSBmsTelemetryStore::closeSegment()
+{
+    if (m_map) {
+        sync();
+        m_segment.unmap(m_map);
+        m_map = nullptr;
+    }
+    m_segment.close();
+}
+
+void CSBmsTelemetryStore::sync()
+{
+#ifdef Q_OS_UNIX
+    if (m_map) {
+        msync(m_map, m_segment.size(), MS_ASYNC);
+    }
+#endif
+}
+
+/* the write segment or one read only mapping, swapped on demand */
+inline const uchar* CSBmsTelemetryStore::mapForRead(qint32 segment)
+{
+    if (segment == m_segmentNo && m_map) {
+        return m_map;
+    }
+    if (segment == m_readSegmentNo && m_readMap) {
+        return m_readMap;
+    }
+
+    if (m_readMap) {
+        m_readSegment.unmap(m_readMap);
+        m_readMap = nullptr;
+    }
+    m_readSegment.close();
+    m_readSegmentNo = -1;
+
+    m_readSegment.setFileName(segmentName(segment));
+    if (!m_readSegment.open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+    m_readMap = m_readSegment.map(0, m_readSegment.size());
+    if (!m_readMap) {
+        m_readSegment.close();
+        return nullptr;
+    }
+
+    m_readSegmentNo = segment;
+    return m_readMap;
+}
+
+bool CSBmsTelemetryStore::append(const QString& port, const TAnalogData& data)
+{
+    const quint8 cells = qMin<quint8>(data.cellCount, BMS_MAX_CELLS);
+    const quint8 temps = qMin<quint8>(data.tempCount, BMS_MAX_TEMPS);
+    const int channels = CSBmsTelemetry::channels(cells, temps);
+    qint32 values[CSBmsTelemetry::ChFirstCell + BMS_MAX_CELLS + BMS_MAX_TEMPS];
+    TAnalogData row = data;
+
+    row.cellCount = cells;
+    row.tempCount = temps;
+    for (int c = 0; c < channels; c++) {
+        values[c] = channelValue(row, c);
+    }
+    return appendValues(port, data.address, cells, temps, data.timestamp, values, channels);
+}
+
+bool CSBmsTelemetryStore::appendValues(const QString& port, quint8 address, quint8 cells, quint8 temps, qint64 time, const qint32* values, int channels)
+{
+    if (!isOpen() || channels <= 0 || channels > 0xff) {
+        return false;
+    }
+
+    const qint32 id = portId(port);
+    if (id < 0) {
+        return false;
+    }
+
+    const quint32 key = seriesKey(id, address);
+    TSeries& series = m_series[key];
+
+    /* a series runs forward in time, also across its blocks */
+    qint64 last = std::numeric_limits<qint64>::min();
+    if (series.rows > 0) {
+        last = series.time.at(series.rows - 1);
+    }
+    else {
+        auto index = m_index.constFind(key);
+        if (index != m_index.constEnd() && !index->isEmpty()) {
+            last = index->last().lastTime;
+        }
+    }
+    if (time < last) {
+        m_statistics.rejected++;
+        return false;
+    }
+
+    /* a block has one layout; a full one is still pending if its
+     * write failed */
+    if (series.rows > 0 //
+        && (series.rows == BMS_TELEMETRY_BLOCK_ROWS || series.cells != cells || series.temps != temps
+            || series.channels != channels)) {
+        if (!writeBlock(series)) {
+            return false;
+        }
+    }
+
+    if (series.rows == 0) {
+        series.port = id;
+        series.address = address;
+        series.cells = cells;
+        series.temps = temps;
+        series.channels = channels;
+        series.opened = time;
+        series.time.resize(BMS_TELEMETRY_BLOCK_ROWS);
+        series.values.resize(channels * BMS_TELEMETRY_BLOCK_ROWS);
+    }
+
+    const int row = series.rows++;
+    qint32* column = series.values.data() + row;
+
+    series.time[row] = time;
+    for (int c = 0; c < channels; c++, column += BMS_TELEMETRY_BLOCK_ROWS) {
+        *column = values[c];
+    }
+    m_statistics.rows++;
+
+    if (series.rows == BMS_TELEMETRY_BLOCK_ROWS) {
+        return writeBlock(series);
+    }
+    return true;
+}
+
+void CSBmsTelemetryStore::seal(qint64 maxAge)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    for (auto it = m_series.begin(); it != m_series.end(); it++) {
+        if (it->rows > 0 && (maxAge <= 0 || now - it->opened >= maxAge)) {
+            writeBlock(it.value());
+        }
+    }
+}
+
+/* encode the pending rows of a series straight into the map */
+inline bool CSBmsTelemetryStore::writeBlock(TSeries& series)
+{
+    const int rows = series.rows;
+    const int channels = series.channels;
+    const qint64 tableSize = CSBmsTelemetry::tableSize(channels);
+    const qint64 bound = sizeof(CSBmsTelemetry::TBlockHeader) + tableSize + (channels + 1) * columnBound(rows) + 8;
+
+    if (rows == 0) {
+        return true;
+    }
+
+    if (bound > m_segmentSize - qint64(sizeof(CSBmsTelemetry::TSegmentHeader))) {
+        qWarning() << "BMSTSDB: Segment too small for a block of" << rows << "rows";
+        return false;
+    }
+
+    CSBmsTelemetry::TSegmentHeader* segment = reinterpret_cast<CSBmsTelemetry::TSegmentHeader*>(m_map);
+    if (!m_map || segment->used + bound > quint64(m_segment.size())) {
+        if (!createSegment(m_segmentNo + 1)) {
+            return false;
+        }
+        segment = reinterpret_cast<CSBmsTelemetry::TSegmentHeader*>(m_map);
+    }
+
+    uchar* block = m_map + segment->used;
+    quint32* table = reinterpret_cast<quint32*>(block + sizeof(CSBmsTelemetry::TBlockHeader));
+    uchar* pos = block + sizeof(CSBmsTelemetry::TBlockHeader) + tableSize;
+    const qint64* time = series.time.constData();
+    quint64 packed[BMS_TELEMETRY_BLOCK_ROWS];
+
+    /* timestamps: first in the header, first delta, then delta-of-delta */
+    table[0] = pos - block;
+    if (rows > 1) {
+        pos = putVarint(pos, zigzag(time[1] - time[0]));
+        for (int i = 2; i < rows; i++) {
+            packed[i - 2] = zigzag((time[i] - time[i - 1]) - (time[i - 1] - time[i - 2]));
+        }
+        pos = putPacked(pos, packed, rows - 2);
+    }
+
+    /* values: first value, then deltas */
+    for (int c = 0; c < channels; c++) {
+        const qint32* values = series.values.constData() + c * BMS_TELEMETRY_BLOCK_ROWS;
+
+        table[c + 1] = pos - block;
+        pos = putVarint(pos, zigzag(values[0]));
+        for (int i = 1; i < rows; i++) {
+            packed[i - 1] = zigzag(qint64(values[i]) - values[i - 1]);
+        }
+        pos = putPacked(pos, packed, rows - 1);
+    }
+
+    CSBmsTelemetry::TBlockHeader header = {};
+    header.magic = BMS_TELEMETRY_BLOCK_MAGIC;
+    header.size = quint32(((pos - block) + 7) & ~qint64(7));
+    header.firstTime = time[0];
+    header.lastTime = time[rows - 1];
+    header.port = series.port;
+    header.rows = rows;
+    header.address = series.address;
+    header.cells = series.cells;
+    header.temps = series.temps;
+    header.channels = channels;
+    memcpy(block, &header, sizeof(header));
+
+    /* the block is complete, now it counts and the rows are free */
+    m_index[seriesKey(series.port, series.address)].append({m_segmentNo, quint32(segment->used), header.firstTime, header.lastTime});
+    segment->used += header.size;
+    series.rows = 0;
+
+    m_statistics.blocks++;
+    m_statistics.rawBytes += rows * (sizeof(qint64) + channels * sizeof(qint32));
+    m_statistics.storedBytes += header.size;
+    return true;
+}
+
+/* decode the selected columns of the rows within [from, to] */
+inline void CSBmsTelemetryStore::decodeBlock(const uchar* block, qint64 from, qint64 to, const TColumnSelect& select, const TRowVisitor& visit)
+{
+    CSBmsTelemetry::TBlockHeader header;
+    memcpy(&header, block, sizeof(header));
+
+    const int rows = header.rows;
+    if (!rows || rows > BMS_TELEMETRY_BLOCK_ROWS) {
+        return;
+    }
+
+    int columns[256];
+    const int count = select(header.cells, header.temps, header.channels, columns);
+    if (count <= 0) {
+        return;
+    }
+
+    const quint32* table = reinterpret_cast<const quint32*>(block + sizeof(header));
+    qint64 time[BMS_TELEMETRY_BLOCK_ROWS];
+    quint64 first;
+
+    /* timestamps */
+    time[0] = header.firstTime;
+    if (rows > 1) {
+        TBitReader r = {getVarint(block + table[0], first), 0, 0};
+        qint64 delta = unzigzag(first);
+        const int width = *r.pos++;
+
+        time[1] = time[0] + delta;
+        for (int i = 2; i < rows; i++) {
+            delta += unzigzag(getBits(r, width));
+            time[i] = time[i - 1] + delta;
+        }
+    }
+
+    int begin = 0;
+    int end = rows;
+    while (begin < rows && time[begin] < from) {
+        begin++;
+    }
+    while (end > begin && time[end - 1] > to) {
+        end--;
+    }
+    if (begin == end) {
+        return;
+    }
+
+    /* one column after the other into the scratch, row major */
+    m_scratch.resize(count * BMS_TELEMETRY_BLOCK_ROWS);
+    qint32* scratch = m_scratch.data();
+
+    for (int n = 0; n < count; n++) {
+        const int c = columns[n];
+        if (c < 0 || c >= header.channels) {
+            return;
+        }
+
+        TBitReader r = {getVarint(block + table[c + 1], first), 0, 0};
+        qint64 value = unzigzag(first);
+        const int width = *r.pos++;
+
+        for (int i = 0; i < end; i++) {
+            if (i > 0) {
+                value += unzigzag(getBits(r, width));
+            }
+            scratch[i * count + n] = qint32(value);
+        }
+    }
+
+    for (int i = begin; i < end; i++) {
+        visit(time[i], header.cells, header.temps, scratch + i * count);
+    }
+}
+
+inline void CSBmsTelemetryStore::collect(const TSeries& series, qint64 from, qint64 to, const TColumnSelect& select, const TRowVisitor& visit)
+{
+    int columns[256];
+    const int count = select(series.cells, series.temps, series.channels, columns);
+    qint32 values[256];
+
+    if (count <= 0) {
+        return;
+    }
+
+    for (int i = 0; i < series.rows; i++) {
+        if (series.time.at(i) < from || series.time.at(i) > to) {
+            continue;
+        }
+
+        for (int n = 0; n < count; n++) {
+            values[n] = series.values.at(columns[n] * BMS_TELEMETRY_BLOCK_ROWS + i);
+        }
+        visit(series.time.at(i), series.cells, series.temps, values);
+    }
+}
+
+void CSBmsTelemetryStore::scan(const QString& port, quint8 address, qint64 from, qint64 to, const TColumnSelect& select, const TRowVisitor& visit)
+{
+    const qint32 id = m_ports.indexOf(port);
+
+    if (id < 0) {
+        return;
+    }
+
+    const quint32 key = seriesKey(id, address);
+    auto index = m_index.constFind(key);
+    if (index != m_index.constEnd()) {
+        foreach (const TBlockRef& ref, index.value()) {
+            if (ref.lastTime < from || ref.firstTime > to) {
+                continue;
+            }
+
+            const uchar* map = mapForRead(ref.segment);
+            if (map) {
+                decodeBlock(map + ref.offset, from, to, select, visit);
+            }
+        }
+    }
+
+    /* rows not written yet */
+    auto it = m_series.constFind(key);
+    if (it != m_series.constEnd()) {
+        collect(it.value(), from, to, select, visit);
+    }
+}
+
+QVector<TAnalogData> CSBmsTelemetryStore::query(const QString& port, quint8 address, qint64 from, qint64 to)
+{
+    QVector<TAnalogData> out;
+
+    /* all channels, blocks of another layout (e.g. rollups) don't fit */
+    const TColumnSelect select = [](quint8 cells, quint8 temps, int channels, int* columns) {
+        if (channels != CSBmsTelemetry::channels(cells, temps)) {
+            return 0;
+        }
+        for (int c = 0; c < channels; c++) {
+            columns[c] = c;
+        }
+        return channels;
+    };
+
+    scan(port, address, from, to, select, [&out, address](qint64 time, quint8 cells, quint8 temps, const qint32* values) {
+        TAnalogData data;
+
+        memset(&data, 0, sizeof(data));
+        data.timestamp = time;
+        data.address = address;
+        data.cellCount = cells;
+        data.tempCount = temps;
+        for (int c = 0; c < CSBmsTelemetry::channels(cells, temps); c++) {
+            setChannelValue(data, c, values[c]);
+        }
+        out.append(data);
+    });
+    return out;
+}
+
+qint64 CSBmsTelemetryStore::lastTime(const QString& port, quint8 address) const
+{
+    const qint32 id = m_ports.indexOf(port);
+    qint64 last = -1;
+
+    if (id < 0) {
+        return last;
+    }
+
+    const quint32 key = seriesKey(id, address);
+    auto index = m_index.constFind(key);
+    if (index != m_index.constEnd()) {
+        foreach (const TBlockRef& ref, index.value()) {
+            last = qMax(last, ref.lastTime);
+        }
+    }
+
+    auto it = m_series.constFind(key);
+    if (it != m_series.constEnd() && it->rows > 0) {
+        last = qMax(last, it->time.at(it->rows - 1));
+    }
+    return last;
+}
+
+QStringList CSBmsTelemetryStore::ports() const
+{
+    return m_ports;
+}
+
+QList<quint8> CSBmsTelemetryStore::addresses(const QString& port) const
+{
+    QList<quint8> addresses;
+    const qint32 id = m_ports.indexOf(port);
+
+    if (id < 0) {
+        return addresses;
+    }
+
+    foreach (quint32 key, m_index.keys() + m_series.keys()) {
+        if ((key >> 8) == quint32(id) && !addresses.contains(quint8(key))) {
+            addresses.append(quint8(key));
+        }
+    }
+    std::sort(addresses.begin(), addresses.end());
+    return addresses;
+}
+
+CSBmsTelemetryStore::TStatistics CSBmsTelemetryStore::statistics() const
+{
+    return m_statistics;
+}
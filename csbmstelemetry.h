@@ -0,0 +1,200 @@
+#pragma once
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <cssupervoltbmsdevice.h>
+#include <functional>
+
+/* Columnar telemetry store of decoded analog data, append only.
+ *
+ * Directory: 'ports' (one port name per line, the line number is
+ *            the port id) and segments seg-NNNNNNNN.svts.
+ * Segment:   fixed size file, memory mapped. TSegmentHeader, then
+ *            blocks back to back, 'used' is the end of the last
+ *            complete block.
+ * Block:     up to BMS_TELEMETRY_BLOCK_ROWS rows of one series,
+ *            i.e. one (port, address). TBlockHeader, the column
+ *            offset table, then one column per channel: timestamps
+ *            first, then the channels in TChannel order.
+ *
+ * Timestamps: delta, then delta-of-delta. Values: delta per
+ * channel. Both zigzag encoded and bit packed with the widest
+ * value of the column (frame of reference), so a flat channel
+ * costs no bits per row and jittering cells only a few. Every
+ * column can be decoded on its own.
+ *
+ * Rows are collected per series in memory and written once, when
+ * the block is full or sealed by age; a series only runs forward in
+ * time, older rows are rejected. Nothing on disk is rewritten
+ * except the segment's 'used' field. The index of (port, address)
+ * to blocks with their time range is rebuilt from the block
+ * headers when the store is opened.
+ *
+ * Rows are generic underneath: a time and 'channels' values with a
+ * layout tag (cells, temps). Analog data is one such layout, the
+ * rollup tiers (CSBmsTelemetryRollup) store another.
+ *
+ * Not thread safe, use it from one thread (e.g. a daemon sink). */
+
+static const char BMS_TELEMETRY_MAGIC[8] = {'S', 'V', 'B', 'M', 'S', 'T', 'S', 'G'};
+static const quint32 BMS_TELEMETRY_VERSION = 1;
+static const quint32 BMS_TELEMETRY_BLOCK_MAGIC = 0x4b4c4253; /* "SBLK" */
+static const qint64 BMS_TELEMETRY_SEGMENT_SIZE = 8 * 1024 * 1024;
+static const int BMS_TELEMETRY_BLOCK_ROWS = 128;
+
+class CSBmsTelemetry
+{
+public:
+    /* fixed channels, cell voltages and temperatures follow */
+    enum TChannel : quint8 {
+        ChCurrent = 0,
+        ChVoltage,
+        ChRemainCapacity,
+        ChTotalCapacity,
+        ChCycles,
+        ChSoc,
+        ChFirstCell,
+    };
+
+    typedef struct {
+        char magic[8];
+        quint32 version;
+        quint32 headerSize;
+        quint64 segmentSize;
+        quint64 used;     /* bytes incl. header */
+        qint64 created;   /* ms since epoch */
+        quint64 reserved;
+    } TSegmentHeader;
+
+    typedef struct {
+        quint32 magic;
+        quint32 size;      /* bytes incl. header and padding */
+        qint64 firstTime;  /* ms since epoch */
+        qint64 lastTime;
+        quint16 port;
+        quint16 rows;
+        quint8 address;
+        quint8 cells;
+        quint8 temps;
+        quint8 channels;   /* analog data: ChFirstCell + cells + temps */
+    } TBlockHeader;
+
+    static_assert(sizeof(TSegmentHeader) == 48, "telemetry segment header layout");
+    static_assert(sizeof(TBlockHeader) == 32, "telemetry block header layout");
+
+    static inline int channels(int cells, int temps) { return ChFirstCell + cells + temps; }
+    static inline int cellChannel(int cell) { return ChFirstCell + cell; }
+    static inline int tempChannel(int cells, int temp) { return ChFirstCell + cells + temp; }
+
+    /* column offset table: channels + 1 entries (timestamps first)
+     * relative to the block start, padded to 8 bytes */
+    static inline qint64 tableSize(int channels) { return ((channels + 1) * 4 + 7) & ~qint64(7); }
+};
+
+class CSBmsTelemetryStore
+{
+public:
+    typedef struct {
+        quint64 rows;        /* rows appended since open */
+        quint64 rejected;    /* rows older than the last of their series */
+        quint64 blocks;      /* blocks on disk */
+        quint64 segments;
+        quint64 rawBytes;    /* time and values of the rows written, unencoded */
+        quint64 storedBytes; /* block bytes written */
+    } TStatistics;
+
+    /* where a block lives, kept per series in time order */
+    typedef struct {
+        qint32 segment;
+        quint32 offset;
+        qint64 firstTime;
+        qint64 lastTime;
+    } TBlockRef;
+
+    /* which columns of a block to decode: fills 'columns' with
+     * channel numbers (at most 256), returns how many; 0 skips */
+    typedef std::function<int(quint8 cells, quint8 temps, int channels, int* columns)> TColumnSelect;
+
+    /* one row, 'values' in the order of the selected columns */
+    typedef std::function<void(qint64 time, quint8 cells, quint8 temps, const qint32* values)> TRowVisitor;
+
+    CSBmsTelemetryStore();
+    ~CSBmsTelemetryStore();
+
+    bool open(const QString& directory, qint64 segmentSize = BMS_TELEMETRY_SEGMENT_SIZE);
+    void close();
+    bool isOpen() const;
+
+    /* false: the row is not stored (store closed, row older than the
+     * last of its series, no room for the pending block) or the block
+     * it completed could not be written yet; the pending rows are kept
+     * and written by the next append or seal */
+    bool append(const QString& port, const CSSuperVoltBmsDevice::TAnalogData& data);
+    bool appendValues(const QString& port, quint8 address, quint8 cells, quint8 temps, qint64 time, const qint32* values, int channels);
+
+    /* write blocks holding rows older than 'maxAge' ms, 0 = all */
+    void seal(qint64 maxAge = 0);
+
+    /* push the mapped segment to disk */
+    void sync();
+
+    /* rows of one series within [from, to], oldest first */
+    QVector<CSSuperVoltBmsDevice::TAnalogData> query(const QString& port, quint8 address, qint64 from, qint64 to);
+
+    /* visit rows of one series within [from, to], oldest first,
+     * decoding only the selected columns */
+    void scan(const QString& port, quint8 address, qint64 from, qint64 to, const TColumnSelect& select, const TRowVisitor& visit);
+
+    /* time of the newest row of a series, -1 if there is none */
+    qint64 lastTime(const QString& port, quint8 address) const;
+
+    QStringList ports() const;
+    QList<quint8> addresses(const QString& port) const;
+    TStatistics statistics() const;
+
+private:
+    /* rows of a series not written yet, column major */
+    typedef struct {
+        quint16 port;
+        quint8 address;
+        quint8 cells;
+        quint8 temps;
+        int channels;
+        int rows;
+        qint64 opened; /* ms since epoch of the first row */
+        QVector<qint64> time;
+        QVector<qint32> values; /* channel * BMS_TELEMETRY_BLOCK_ROWS + row */
+    } TSeries;
+
+    QString m_directory;
+    qint64 m_segmentSize;
+    QStringList m_ports;
+    QFile m_portsFile;
+    QHash<quint32, TSeries> m_series;
+    QHash<quint32, QVector<TBlockRef>> m_index;
+    QFile m_segment;
+    uchar* m_map;
+    qint32 m_segmentNo;
+    QFile m_readSegment;
+    uchar* m_readMap;
+    qint32 m_readSegmentNo;
+    QVector<qint32> m_scratch;
+    TStatistics m_statistics;
+
+private:
+    inline static quint32 seriesKey(quint16 port, quint8 address);
+    inline QString segmentName(qint32 segment) const;
+    inline qint32 portId(const QString& port);
+    inline bool loadPorts();
+    inline bool scanSegment(qint32 segment);
+    inline bool createSegment(qint32 segment);
+    inline bool openSegment(qint32 segment);
+    inline void closeSegment();
+    inline const uchar* mapForRead(qint32 segment);
+    inline bool writeBlock(TSeries& series);
+    inline void decodeBlock(const uchar* block, qint64 from, qint64 to, const TColumnSelect& select, const TRowVisitor& visit);
+    inline void collect(const TSeries& series, qint64 from, qint64 to, const TColumnSelect& select, const TRowVisitor& visit);
+};
@@ -0,0 +1,416 @@
+#include <QDebug>
+#include <csbmstelemetryrollup.h>
+#include <limits>
+#include <string.h>
+
+typedef CSSuperVoltBmsDevice::TAnalogData TAnalogData;
+
+/* rollup channels before the cells */
+static const int ROLLUP_FIXED = CSBmsTelemetryRollup::MtCell;
+static const int ROLLUP_MAX_CHANNELS = ROLLUP_FIXED + BMS_MAX_CELLS + BMS_MAX_TEMPS;
+static const int ROLLUP_MAX_COLUMNS = 1 + 3 * ROLLUP_MAX_CHANNELS;
+
+static_assert(ROLLUP_MAX_COLUMNS <= 0xff, "rollup row exceeds the block channels");
+
+static inline int rollupChannels(int cells, int temps)
+{
+    return ROLLUP_FIXED + cells + temps;
+}
+
+CSBmsTelemetryRollup::CSBmsTelemetryRollup()
+    : m_directory()
+    , m_stores()
+    , m_series()
+{
+}
+
+CSBmsTelemetryRollup::~CSBmsTelemetryRollup()
+{
+    close();
+}
+
+qint64 CSBmsTelemetryRollup::interval(TResolution resolution)
+{
+    switch (resolution) {
+        case Second: {
+            return BMS_ROLLUP_SECOND;
+        }
+        case Minute: {
+            return BMS_ROLLUP_MINUTE;
+        }
+        default: {
+            return BMS_ROLLUP_HOUR;
+        }
+    }
+}
+
+bool CSBmsTelemetryRollup::open(const QString& directory, CSBmsTelemetryStore* raw, qint64 segmentSize)
+{
+    close();
+
+    if (!m_stores[Minute].open(directory + QStringLiteral("/1m"), segmentSize) //
+        || !m_stores[Hour].open(directory + QStringLiteral("/1h"), segmentSize)) {
+        m_stores[Minute].close();
+        m_stores[Hour].close();
+        return false;
+    }
+
+    m_directory = directory;
+    if (raw && raw->isOpen()) {
+        backfill(raw);
+    }
+    return true;
+}
+
+void CSBmsTelemetryRollup::close()
+{
+    if (m_directory.isEmpty()) {
+        return;
+    }
+
+    /* open buckets are dropped, open() rebuilds them from the raw rows */
+    m_stores[Minute].close();
+    m_stores[Hour].close();
+    m_series.clear();
+    m_directory.clear();
+}
+
+bool CSBmsTelemetryRollup::isOpen() const
+{
+    return !m_directory.isEmpty();
+}
+
+inline CSBmsTelemetryRollup::TSeries& CSBmsTelemetryRollup::series(const QString& port, quint8 address)
+{
+    QHash<quint8, TSeries>& addresses = m_series[port];
+
+    auto it = addresses.find(address);
+    if (it == addresses.end()) {
+        TSeries series;
+        for (int r = 0; r < ResolutionCount; r++) {
+            series.bucket[r].start = -1;
+            series.bucket[r].count = 0;
+            series.bucket[r].cells = 0;
+            series.bucket[r].temps = 0;
+            series.next[r] = 0;
+        }
+        it = addresses.insert(address, series);
+    }
+    return it.value();
+}
+
+/* replay raw rows newer than what the stored tiers hold */
+inline void CSBmsTelemetryRollup::backfill(CSBmsTelemetryStore* raw)
+{
+    const CSBmsTelemetryStore::TColumnSelect select = [](quint8 cells, quint8 temps, int channels, int* columns) {
+        if (channels != CSBmsTelemetry::channels(cells, temps)) {
+            return 0;
+        }
+        for (int c = 0; c < channels; c++) {
+            columns[c] = c;
+        }
+        return channels;
+    };
+    quint64 rows = 0;
+
+    foreach (const QString& port, raw->ports()) {
+        foreach (quint8 address, raw->addresses(port)) {
+            TSeries& s = series(port, address);
+            qint64 from = std::numeric_limits<qint64>::max();
+
+            for (int r = Minute; r < ResolutionCount; r++) {
+                const qint64 last = m_stores[r].lastTime(port, address);
+                s.next[r] = last < 0 ? 0 : last + interval(TResolution(r));
+                from = qMin(from, s.next[r]);
+            }
+            s.next[Second] = raw->lastTime(port, address) - BMS_ROLLUP_RECENT * BMS_ROLLUP_SECOND;
+
+            raw->scan(port, address, from, std::numeric_limits<qint64>::max(), select, [&](qint64 time, quint8 cells, quint8 temps, const qint32* values) {
+                add(port, address, time, cells, temps, values);
+                rows++;
+            });
+        }
+    }
+
+    qDebug() << "BMSROLLUP: Opened" << m_directory << "replayed" << rows << "rows";
+}
+
+void CSBmsTelemetryRollup::append(const QString& port, const TAnalogData& data)
+{
+    const quint8 cells = qMin<quint8>(data.cellCount, BMS_MAX_CELLS);
+    const quint8 temps = qMin<quint8>(data.tempCount, BMS_MAX_TEMPS);
+    qint32 values[CSBmsTelemetry::ChFirstCell + BMS_MAX_CELLS + BMS_MAX_TEMPS];
+
+    if (!isOpen()) {
+        return;
+    }
+
+    values[CSBmsTelemetry::ChCurrent] = data.current;
+    values[CSBmsTelemetry::ChVoltage] = qint32(data.voltage);
+    values[CSBmsTelemetry::ChRemainCapacity] = qint32(data.remainCapacity);
+    values[CSBmsTelemetry::ChTotalCapacity] = qint32(data.totalCapacity);
+    values[CSBmsTelemetry::ChCycles] = data.cycles;
+    values[CSBmsTelemetry::ChSoc] = data.soc;
+    for (int i = 0; i < cells; i++) {
+        values[CSBmsTelemetry::cellChannel(i)] = data.cellVoltage[i];
+    }
+    for (int i = 0; i < temps; i++) {
+        values[CSBmsTelemetry::tempChannel(cells, i)] = data.temperature[i];
+    }
+
+    add(port, data.address, data.timestamp, cells, temps, values);
+}
+
+/* one raw row, 'values' in CSBmsTelemetry channel order, into every tier */
+inline void CSBmsTelemetryRollup::add(const QString& port, quint8 address, qint64 time, quint8 cells, quint8 temps, const qint32* values)
+{
+    const int channels = rollupChannels(cells, temps);
+    qint32 sample[ROLLUP_MAX_CHANNELS];
+
+    memcpy(sample, values, CSBmsTelemetry::ChFirstCell * sizeof(qint32));
+    memcpy(sample + ROLLUP_FIXED, values + CSBmsTelemetry::ChFirstCell, (cells + temps) * sizeof(qint32));
+
+    qint32 cellMin = cells ? sample[ROLLUP_FIXED] : 0;
+    qint32 cellMax = cellMin;
+    for (int i = 1; i < cells; i++) {
+        cellMin = qMin(cellMin, sample[ROLLUP_FIXED + i]);
+        cellMax = qMax(cellMax, sample[ROLLUP_FIXED + i]);
+    }
+
+    qint32 tempMin = temps ? sample[ROLLUP_FIXED + cells] : 0;
+    qint32 tempMax = tempMin;
+    for (int i = 1; i < temps; i++) {
+        tempMin = qMin(tempMin, sample[ROLLUP_FIXED + cells + i]);
+        tempMax = qMax(tempMax, sample[ROLLUP_FIXED + cells + i]);
+    }
+
+    sample[MtCellMin] = cellMin;
+    sample[MtCellMax] = cellMax;
+    sample[MtCellSpread] = cellMax - cellMin;
+    sample[MtTempMin] = tempMin;
+    sample[MtTempMax] = tempMax;
+
+    TSeries& s = series(port, address);
+
+    for (int r = 0; r < ResolutionCount; r++) {
+        const qint64 step = interval(TResolution(r));
+        const qint64 start = time - time % step;
+        TBucket& bucket = s.bucket[r];
+
+        /* late for this tier, its bucket is gone */
+        if (start < s.next[r]) {
+            continue;
+        }
+
+        if (bucket.count > 0 && (start != bucket.start || bucket.cells != cells || bucket.temps != temps)) {
+            closeBucket(port, address, s, r);
+        }
+
+        if (bucket.count == 0) {
+            bucket.start = start;
+            bucket.cells = cells;
+            bucket.temps = temps;
+            bucket.min.resize(channels);
+            bucket.max.resize(channels);
+            bucket.sum.resize(channels);
+            s.next[r] = start;
+        }
+
+        qint32* min = bucket.min.data();
+        qint32* max = bucket.max.data();
+        qint64* sum = bucket.sum.data();
+
+        if (bucket.count == 0) {
+            for (int c = 0; c < channels; c++) {
+                min[c] = sample[c];
+                max[c] = sample[c];
+                sum[c] = sample[c];
+            }
+        }
+        else {
+            for (int c = 0; c < channels; c++) {
+                min[c] = qMin(min[c], sample[c]);
+                max[c] = qMax(max[c], sample[c]);
+                sum[c] += sample[c];
+            }
+        }
+        bucket.count++;
+    }
+}
+
+inline void CSBmsTelemetryRollup::toRow(const TBucket& bucket, qint32* row)
+{
+    const qint64 count = bucket.count;
+
+    row[0] = qint32(bucket.count);
+    for (int c = 0; c < bucket.min.size(); c++) {
+        const qint64 sum = bucket.sum.at(c);
+
+        row[1 + 3 * c] = bucket.min.at(c);
+        row[2 + 3 * c] = bucket.max.at(c);
+        row[3 + 3 * c] = qint32((sum >= 0 ? sum + count / 2 : sum - count / 2) / count);
+    }
+}
+
+inline void CSBmsTelemetryRollup::closeBucket(const QString& port, quint8 address, TSeries& series, int resolution)
+{
+    TBucket& bucket = series.bucket[resolution];
+    const int columns = 1 + 3 * bucket.min.size();
+    qint32 row[ROLLUP_MAX_COLUMNS];
+
+    toRow(bucket, row);
+    bucket.count = 0;
+
+    if (resolution == Second) {
+        TRecent recent = {bucket.start, bucket.cells, bucket.temps, QVector<qint32>(columns)};
+
+        memcpy(recent.row.data(), row, columns * sizeof(qint32));
+        series.recent.append(recent);
+        while (series.recent.size() > BMS_ROLLUP_RECENT) {
+            series.recent.removeFirst();
+        }
+        return;
+    }
+
+    m_stores[resolution].appendValues(port, address, bucket.cells, bucket.temps, bucket.start, row, columns);
+}
+
+void CSBmsTelemetryRollup::seal(qint64 maxAge)
+{
+    m_stores[Minute].seal(maxAge < 0 ? BMS_ROLLUP_MINUTE_SEAL_AGE : maxAge);
+    m_stores[Hour].seal(maxAge < 0 ? BMS_ROLLUP_HOUR_SEAL_AGE : maxAge);
+}
+
+void CSBmsTelemetryRollup::sync()
+{
+    m_stores[Minute].sync();
+    m_stores[Hour].sync();
+}
+
+/* rollup channel of a metric in a pack layout, -1 if it has none */
+inline int CSBmsTelemetryRollup::column(TMetric metric, int index, quint8 cells, quint8 temps)
+{
+    switch (metric) {
+        case MtCell: {
+            return index >= 0 && index < cells ? ROLLUP_FIXED + index : -1;
+        }
+        case MtTemperature: {
+            return index >= 0 && index < temps ? ROLLUP_FIXED + cells + index : -1;
+        }
+        default: {
+            return metric < MtCell ? int(metric) : -1;
+        }
+    }
+}
+
+QVector<CSBmsTelemetryRollup::TPoint> CSBmsTelemetryRollup::query(const QString& port, quint8 address, TMetric metric, int index, qint64 from, qint64 to, int maxPoints, TResolution* used)
+{
+    QVector<TPoint> out;
+
+    if (!isOpen() || to < from) {
+        return out;
+    }
+
+    const TSeries* s = nullptr;
+    auto it = m_series.constFind(port);
+    if (it != m_series.constEnd()) {
+        auto series = it.value().constFind(address);
+        if (series != it.value().constEnd()) {
+            s = &series.value();
+        }
+    }
+
+    /* the finest tier that fits; seconds only as far back as they go */
+    int resolution = Hour;
+    for (int r = Second; r < Hour; r++) {
+        if (maxPoints > 0 && (to - from) / interval(TResolution(r)) + 1 > maxPoints) {
+            continue;
+        }
+        if (r == Second) {
+            const qint64 oldest = !s ? -1 : !s->recent.isEmpty() ? s->recent.first().time : s->bucket[Second].count ? s->bucket[Second].start : -1;
+            if (oldest < 0 || oldest > from) {
+                continue;
+            }
+        }
+        resolution = r;
+        break;
+    }
+    if (used) {
+        *used = TResolution(resolution);
+    }
+
+    const auto point = [&out, metric, index](qint64 time, quint8 cells, quint8 temps, const qint32* row) {
+        const int c = column(metric, index, cells, temps);
+        if (c >= 0) {
+            out.append({time, quint32(row[0]), row[1 + 3 * c], row[2 + 3 * c], row[3 + 3 * c]});
+        }
+    };
+
+    if (resolution == Second) {
+        foreach (const TRecent& recent, s->recent) {
+            if (recent.time >= from && recent.time <= to) {
+                point(recent.time, recent.cells, recent.temps, recent.row.constData());
+            }
+        }
+    }
+    else {
+        /* count and the three columns of the metric */
+        const CSBmsTelemetryStore::TColumnSelect select = [metric, index](quint8 cells, quint8 temps, int channels, int* columns) {
+            const int c = column(metric, index, cells, temps);
+            if (c < 0 || channels != 1 + 3 * rollupChannels(cells, temps)) {
+                return 0;
+            }
+            columns[0] = 0;
+            columns[1] = 1 + 3 * c;
+            columns[2] = 2 + 3 * c;
+            columns[3] = 3 + 3 * c;
+            return 4;
+        };
+
+        m_stores[resolution].scan(port, address, from, to, select, [&out](qint64 time, quint8, quint8, const qint32* values) {
+            out.append({time, quint32(values[0]), values[1], values[2], values[3]});
+        });
+    }
+
+    /* what the open bucket holds so far */
+    if (s && s->bucket[resolution].count > 0) {
+        const TBucket& bucket = s->bucket[resolution];
+        if (bucket.start >= from && bucket.start <= to) {
+            qint32 row[ROLLUP_MAX_COLUMNS];
+            toRow(bucket, row);
+            point(bucket.start, bucket.cells, bucket.temps, row);
+        }
+    }
+
+    if (maxPoints <= 0 || out.size() <= maxPoints) {
+        return out;
+    }
+
+    /* still too many: merge runs of buckets */
+    const int group = (out.size() + maxPoints - 1) / maxPoints;
+    int n = 0;
+
+    for (int i = 0; i < out.size(); i += group) {
+        TPoint merged = out.at(i);
+        qint64 sum = qint64(merged.mean) * merged.count;
+
+        for (int j = i + 1; j < qMin(i + group, out.size()); j++) {
+            const TPoint& p = out.at(j);
+            merged.count += p.count;
+            merged.min = qMin(merged.min, p.min);
+            merged.max = qMax(merged.max, p.max);
+            sum += qint64(p.mean) * p.count;
+        }
+        if (merged.count > 0) {
+            merged.mean = qint32(sum / qint64(merged.count));
+        }
+        out[n++] = merged;
+    }
+    out.resize(n);
+    return out;
+}
+
+CSBmsTelemetryStore::TStatistics CSBmsTelemetryRollup::statistics(TResolution resolution) const
+{
+    return m_stores[resolution].statistics();
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVector>
+#include <csbmstelemetry.h>
+
+/* Multi-resolution rollups of the telemetry store: min, max and mean
+ * per channel over 1 s, 1 min and 1 h buckets, computed while rows
+ * come in, so long ranges (e.g. the cell imbalance of a rack over 30
+ * days) are answered from a few hundred rollup rows instead of
+ * millions of raw ones.
+ *
+ * Rollup channels: the fixed channels of the analog data, then the
+ * derived cell min / max / spread and temperature min / max, then
+ * the cells and temperatures as in CSBmsTelemetry.
+ * Rollup row:      sample count, then min, max and mean of every
+ *                  rollup channel, stored as a row of 1 + 3 * channels
+ *                  values with the pack layout (cells, temps) as tag.
+ *
+ * The minute and hour tiers are CSBmsTelemetryStore directories
+ * (rollup/1m, rollup/1h below the raw store), the second tier is a
+ * ring of the last BMS_ROLLUP_RECENT buckets in memory only: stored,
+ * it would cost about as much as the raw rows it summarises.
+ *
+ * A bucket is written when a row of a later bucket arrives; open
+ * buckets are not written on close. Instead open() replays the raw
+ * rows after the newest stored bucket of each tier, which also
+ * rebuilds what a crash lost and fills the tiers of data recorded
+ * before rollups were enabled. Rows older than the open bucket of a
+ * tier are ignored by that tier.
+ *
+ * Not thread safe, use it from the thread of its raw store. */
+
+static const qint64 BMS_ROLLUP_SECOND = 1000;
+static const qint64 BMS_ROLLUP_MINUTE = 60 * BMS_ROLLUP_SECOND;
+static const qint64 BMS_ROLLUP_HOUR = 60 * BMS_ROLLUP_MINUTE;
+/* second buckets kept per series */
+static const int BMS_ROLLUP_RECENT = 120;
+/* stored tiers fill blocks for this long before they are sealed */
+static const qint64 BMS_ROLLUP_MINUTE_SEAL_AGE = BMS_ROLLUP_HOUR;
+static const qint64 BMS_ROLLUP_HOUR_SEAL_AGE = 24 * BMS_ROLLUP_HOUR;
+
+class CSBmsTelemetryRollup
+{
+public:
+    enum TResolution : quint8 {
+        Second = 0,
+        Minute,
+        Hour,
+        ResolutionCount,
+    };
+
+    /* what to query, 'index' selects the cell or temperature */
+    enum TMetric : quint8 {
+        MtCurrent = 0,
+        MtVoltage,
+        MtRemainCapacity,
+        MtTotalCapacity,
+        MtCycles,
+        MtSoc,
+        MtCellMin,
+        MtCellMax,
+        MtCellSpread,
+        MtTempMin,
+        MtTempMax,
+        MtCell,
+        MtTemperature,
+    };
+
+    typedef struct {
+        qint64 time; /* bucket start, ms since epoch */
+        quint32 count;
+        qint32 min;
+        qint32 max;
+        qint32 mean;
+    } TPoint;
+
+    CSBmsTelemetryRollup();
+    ~CSBmsTelemetryRollup();
+
+    /* 'raw' (open, may be null) is replayed into buckets not stored yet */
+    bool open(const QString& directory, CSBmsTelemetryStore* raw = nullptr, qint64 segmentSize = BMS_TELEMETRY_SEGMENT_SIZE);
+    void close();
+    bool isOpen() const;
+
+    void append(const QString& port, const CSSuperVoltBmsDevice::TAnalogData& data);
+
+    /* write blocks of the stored tiers, -1 = by their seal age, 0 = all */
+    void seal(qint64 maxAge = -1);
+    void sync();
+
+    /* buckets of one metric within [from, to], oldest first, of the
+     * finest resolution giving at most 'maxPoints' buckets (0 = no
+     * limit); beyond the hour tier buckets are merged. Open buckets
+     * are included with what they hold so far. */
+    QVector<TPoint> query(const QString& port, quint8 address, TMetric metric, int index, qint64 from, qint64 to, int maxPoints = 0, TResolution* used = nullptr);
+
+    CSBmsTelemetryStore::TStatistics statistics(TResolution resolution) const;
+
+    static qint64 interval(TResolution resolution);
+
+private:
+    typedef struct {
+        qint64 start; /* -1 = empty */
+        quint32 count;
+        quint8 cells;
+        quint8 temps;
+        QVector<qint32> min;
+        QVector<qint32> max;
+        QVector<qint64> sum;
+    } TBucket;
+
+    /* a closed second bucket, as a rollup row */
+    typedef struct {
+        qint64 time;
+        quint8 cells;
+        quint8 temps;
+        QVector<qint32> row;
+    } TRecent;
+
+    typedef struct {
+        TBucket bucket[ResolutionCount];
+        qint64 next[ResolutionCount]; /* earliest bucket start still accepted */
+        QList<TRecent> recent;
+    } TSeries;
+
+    QString m_directory;
+    CSBmsTelemetryStore m_stores[ResolutionCount]; /* Second unused */
+    QHash<QString, QHash<quint8, TSeries>> m_series;
+
+private:
+    inline TSeries& series(const QString& port, quint8 address);
+    inline void add(const QString& port, quint8 address, qint64 time, quint8 cells, quint8 temps, const qint32* values);
+    inline void closeBucket(const QString& port, quint8 address, TSeries& series, int resolution);
+    inline void backfill(CSBmsTelemetryStore* raw);
+    inline static void toRow(const TBucket& bucket, qint32* row);
+    inline static int column(TMetric metric, int index, quint8 cells, quint8 temps);
+};
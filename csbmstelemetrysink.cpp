@@ -0,0 +1,71 @@
+#include <csbmstelemetrysink.h>
+
+CSBmsTelemetrySink::CSBmsTelemetrySink(const QString& directory, qint64 segmentSize, int sealAge, QObject* parent)
+    : CSBmsSink(parent)
+    , m_directory(directory)
+    , m_segmentSize(segmentSize)
+    , m_sealAge(qMax(0, sealAge))
+    , m_store()
+    , m_rollup()
+{
+}
+
+CSBmsTelemetrySink::~CSBmsTelemetrySink()
+{
+    close();
+}
+
+bool CSBmsTelemetrySink::open()
+{
+    if (m_store.isOpen()) {
+        return true;
+    }
+    if (!m_store.open(m_directory, m_segmentSize)) {
+        return false;
+    }
+
+    /* after the raw store, open() replays what the tiers miss */
+    if (!m_rollup.open(m_directory + QStringLiteral("/rollup"), &m_store, m_segmentSize)) {
+        m_store.close();
+        return false;
+    }
+    return true;
+}
+
+void CSBmsTelemetrySink::close()
+{
+    m_rollup.close();
+    m_store.close();
+}
+
+void CSBmsTelemetrySink::publish(const QString& bus, const CSSuperVoltBmsDevice::TResponse& rsp)
+{
+    if (rsp.cid2 == BMS_CID2_FETCH_ANALOG_DATA || rsp.cid2 == BMS_CID2_FETCH_ANALOG_DATA + 1) {
+        m_store.append(bus, rsp.analog);
+        m_rollup.append(bus, rsp.analog);
+    }
+}
+
+void CSBmsTelemetrySink::publishError(const QString&, quint8, quint8, CSSuperVoltBmsDevice::BmsError)
+{
+}
+
+void CSBmsTelemetrySink::flush()
+{
+    if (m_sealAge > 0) {
+        m_store.seal(m_sealAge);
+    }
+    m_store.sync();
+    m_rollup.seal();
+    m_rollup.sync();
+}
+
+CSBmsTelemetryStore* CSBmsTelemetrySink::store()
+{
+    return &m_store;
+}
+
+CSBmsTelemetryRollup* CSBmsTelemetrySink::rollup()
+{
+    return &m_rollup;
+}
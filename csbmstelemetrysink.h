@@ -0,0 +1,37 @@
+#pragma once
+#include <QString>
+#include <csbmssink.h>
+#include <csbmstelemetry.h>
+#include <csbmstelemetryrollup.h>
+
+/* Feeds decoded analog data into a telemetry store. Other replies
+ * and errors are not stored. Blocks still filling are written on
+ * flush() once their first row is older than 'sealAge' ms, which
+ * bounds what a crash can lose. Rollups of the analog data live in
+ * 'rollup' below the directory, see CSBmsTelemetryRollup. */
+class CSBmsTelemetrySink: public CSBmsSink
+{
+    Q_OBJECT
+
+public:
+    explicit CSBmsTelemetrySink(const QString& directory, qint64 segmentSize, int sealAge, QObject* parent = nullptr);
+    ~CSBmsTelemetrySink();
+
+    bool open() override;
+    void close() override;
+
+    void publish(const QString& bus, const CSSuperVoltBmsDevice::TResponse& rsp) override;
+    void publishError(const QString& bus, quint8 address, quint8 cid2, CSSuperVoltBmsDevice::BmsError error) override;
+
+    void flush() override;
+
+    CSBmsTelemetryStore* store();
+    CSBmsTelemetryRollup* rollup();
+
+private:
+    QString m_directory;
+    qint64 m_segmentSize;
+    int m_sealAge;
+    CSBmsTelemetryStore m_store;
+    CSBmsTelemetryRollup m_rollup;
+};
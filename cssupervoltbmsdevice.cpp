@@ -1,23 +1,60 @@
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
+#include <QFileInfo>
 #include <QFileInfoList>
+#include <QLoggingCategory>
+#include <QMetaMethod>
 #include <QSerialPortInfo>
-#include <QThread>
+#include <csbmsmetrics.h>
 #include <cssupervoltbmsdevice.h>
 
+/* frame traces, off unless enabled by QT_LOGGING_RULES="bms.trace.debug=true" */
+Q_LOGGING_CATEGORY(lcBmsTrace, "bms.trace", QtWarningMsg)
+
 CSSuperVoltBmsDevice::CSSuperVoltBmsDevice(QObject* parent)
     : QObject(parent)
     , m_port(this)
+    , m_native(this)
+    , m_io(&m_port)
+    , m_capture(nullptr)
+    , m_capturePort(0)
+    , m_analogRing(nullptr)
+    , m_metrics(nullptr)
     , m_config()
-    , m_inputBuffer()
+    , m_parser()
+    , m_requestCache()
+    , m_infoCache()
+    , m_cacheStats()
+    , m_timeouts()
+    , m_queue()
+    , m_current()
+    , m_busy(false)
+    , m_responseTimer(this)
+    , m_sentTimer()
+    , m_gapTimer(this)
 {
     connect(&m_port, &QSerialPort::errorOccurred, this, &CSSuperVoltBmsDevice::onPortError);
-    connect(&m_port, &QSerialPort::aboutToClose, this, &CSSuperVoltBmsDevice::onAboutToClose);
-    connect(&m_port, &QSerialPort::readyRead, this, &CSSuperVoltBmsDevice::onReadyRead);
-    connect(&m_port, &QSerialPort::bytesWritten, this, &CSSuperVoltBmsDevice::onBytesWritten);
+    connectTransport(true);
+
+    m_responseTimer.setSingleShot(true);
+    m_responseTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_responseTimer, &QTimer::timeout, this, &CSSuperVoltBmsDevice::onResponseTimeout);
+
+    m_gapTimer.setSingleShot(true);
+    m_gapTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_gapTimer, &QTimer::timeout, this, &CSSuperVoltBmsDevice::onFrameGap);
 
     m_config.options = OPT_SOI_BYTE_3E;
     m_config.address = 1;
+
+    /* response deadlines in ms, analog data is the longest reply */
+    m_timeouts[BMS_CID2_FETCH_ANALOG_DATA] = 1000;
+    m_timeouts[BMS_CID2_FETCH_ANALOG_DATA + 1] = 1000;
+    m_timeouts[BMS_CID2_FETCH_MANUFACTURER] = 500;
+    m_timeouts[BMS_CID2_FETCH_DEVICE_ADDR] = 500;
+    m_timeouts[BMS_CID2_FETCH_PROTO_VER] = 500;
+    m_timeouts[BMS_CID2_FETCH_TIME] = 500;
 }
 
 CSSuperVoltBmsDevice::~CSSuperVoltBmsDevice()
@@ -25,71 +62,199 @@ CSSuperVoltBmsDevice::~CSSuperVoltBmsDevice()
     qDebug() << Q_FUNC_INFO;
 
     disconnect(&m_port);
+    connectTransport(false);
+    abortAll(NotOpenError);
 
     if (m_port.isOpen()) {
         m_port.flush();
         m_port.close();
     }
+    else if (m_io->isOpen()) {
+        m_io->close();
+    }
+}
+
+inline void CSSuperVoltBmsDevice::connectTransport(bool enable)
+{
+    if (enable) {
+        connect(m_io, &QIODevice::aboutToClose, this, &CSSuperVoltBmsDevice::onAboutToClose);
+        connect(m_io, &QIODevice::readyRead, this, &CSSuperVoltBmsDevice::onReadyRead);
+        connect(m_io, &QIODevice::bytesWritten, this, &CSSuperVoltBmsDevice::onBytesWritten);
+    }
+    else {
+        disconnect(m_io, &QIODevice::aboutToClose, this, &CSSuperVoltBmsDevice::onAboutToClose);
+        disconnect(m_io, &QIODevice::readyRead, this, &CSSuperVoltBmsDevice::onReadyRead);
+        disconnect(m_io, &QIODevice::bytesWritten, this, &CSSuperVoltBmsDevice::onBytesWritten);
+    }
 }
 
 void CSSuperVoltBmsDevice::onPortError(QSerialPort::SerialPortError error)
 {
-    if (error != QSerialPort::NoError) {
-        emit errorOccured(static_cast<BmsError>(UserErrorLast + error));
+    if (error == QSerialPort::NoError) {
+        return;
+    }
+
+    reportError(static_cast<BmsError>(UserErrorLast + error));
+
+    /* the device is gone (unplugged, revoked), QSerialPort stays open
+     * on it; close so 'disconnected' fires and the owner can reopen */
+    if (m_port.isOpen()
+        && (error == QSerialPort::ResourceError //
+            || error == QSerialPort::PermissionError
+            || error == QSerialPort::DeviceNotFoundError)) {
+        close();
     }
 }
 
 void CSSuperVoltBmsDevice::onAboutToClose()
 {
+    /* the transport may close on its own (native port hangup) */
+    abortAll(NotOpenError);
     emit disconnected();
 }
 
 void CSSuperVoltBmsDevice::onBytesWritten(qint64 size)
 {
-    qDebug() << "BMSDEV:" << size << "bytes written to device" << m_port.portName();
+    if (traceEnabled(TRACE_RAW_TX)) {
+        qCDebug(lcBmsTrace) << "BMSDEV:" << size << "bytes written to device" << m_config.portName;
+    }
+}
+
+void CSSuperVoltBmsDevice::onResponseTimeout()
+{
+    if (m_busy) {
+        reportError(TimeoutError);
+        finish(TimeoutError);
+        dispatch();
+    }
 }
 
 void CSSuperVoltBmsDevice::onReadyRead()
 {
-    while (m_port.bytesAvailable() > 0) {
-        m_inputBuffer.append(m_port.readAll());
-        QThread::yieldCurrentThread();
+    char chunk[512];
+    qint64 size;
+
+    while ((size = m_io->read(chunk, sizeof(chunk))) > 0) {
+        if (m_capture) {
+            m_capture->write(m_capturePort, CSBmsCapture::RecordRx, m_current.address, chunk, size);
+        }
+        if (m_metrics) {
+            m_metrics->countRx(size);
+        }
+        if (traceEnabled(TRACE_RAW_RX)) {
+            trace(tr("RCV> [%1] %2") //
+                     .arg(size)
+                     .arg(QString(QByteArray::fromRawData(chunk, size).toHex(' '))));
+        }
+        receive(chunk, size);
     }
 
-    emit message(tr("RCV> [%1] %2") //
-                    .arg(m_inputBuffer.size())
-                    .arg(QString(m_inputBuffer.toHex(' '))));
+    armFrameGap();
+}
 
-    if (m_inputBuffer.size() < 3) {
-        emit errorOccured(InvalidFormat);
+/* The line went quiet in the middle of a frame: the sender gave
+ * up or bytes were lost. Drop the fragment now instead of waiting
+ * for the response timeout. */
+void CSSuperVoltBmsDevice::onFrameGap()
+{
+    if (m_parser.pending() == 0) {
         return;
     }
 
-    qint64 size = m_inputBuffer.size();
+    if (traceEnabled(TRACE_ERRORS)) {
+        trace(tr("ERR> [%1] Frame gap after %2 bytes").arg(m_current.address).arg(m_parser.pending()));
+    }
 
-    if (
-       (m_inputBuffer.at(0) != BMS_PROTO_SOI_3E) && //
-       (m_inputBuffer.at(0) != BMS_PROTO_SOI_7E))   //
-    {
-        emit errorOccured(InvalidFormat);
-        return;
+    m_parser.reset();
+    reportError(InvalidFormat);
+    if (m_busy) {
+        finish(InvalidFormat);
+        dispatch();
     }
+}
+
+/* one shot per read burst, only while a frame is incomplete */
+inline void CSSuperVoltBmsDevice::armFrameGap()
+{
+    const qint64 gapNs = qint64(characterTimeNs() * m_config.frameGap);
 
-    if (m_inputBuffer.at(1) != BMS_PROTO_VER) {
-        emit errorOccured(InvalidVersion);
+    if (gapNs <= 0 || m_parser.pending() == 0) {
+        m_gapTimer.stop();
         return;
     }
 
-    if (m_inputBuffer.at(size - 1) != BMS_PROTO_EOI) {
-        emit errorOccured(InvalidFormat);
-        return;
+    /* QTimer has ms resolution, round up; never shorter than the
+     * chunk spacing of USB adapters and a busy event loop */
+    m_gapTimer.start(qMax(BMS_MIN_FRAME_GAP_MS, int((gapNs + 999999) / 1000000)));
+}
+
+/* push received bytes through the frame parser, handle every
+ * complete frame found in the chunk */
+inline void CSSuperVoltBmsDevice::receive(const char* data, qint64 size)
+{
+    const quint64 discarded = m_parser.discarded();
+    qint64 offset = 0;
+    bool complete;
+
+    while (offset < size) {
+        offset += m_parser.feed(data + offset, size - offset, &complete);
+        if (!complete) {
+            continue;
+        }
+
+        const QByteArray frame = m_parser.frame();
+        if (m_metrics) {
+            m_metrics->countFrame();
+        }
+        if (CSBmsProtocol::hexByte(frame.constData() + 1) != BMS_PROTO_VER) {
+            reportError(InvalidVersion);
+            continue;
+        }
+
+        /* corrupted on the line, the reply to our request is lost */
+        const BmsError error = verifyFrame(frame);
+        if (error != NoError) {
+            reportError(error);
+            if (m_busy) {
+                finish(error);
+                dispatch();
+            }
+            continue;
+        }
+
+        /* handle BMS response */
+        response(frame);
     }
 
-    /* handle BMS response */
-    response(m_inputBuffer);
+    /* garbage between frames or broken frames */
+    if (m_parser.discarded() != discarded) {
+        reportError(InvalidFormat);
+    }
+}
+
+/* The parser hands out frames whose size matches LENID and whose
+ * payload is ASCII hex. Left to check are LCHKSUM of the LENGTH
+ * field and CHKSUM over VER..INFO. */
+inline CSSuperVoltBmsDevice::BmsError CSSuperVoltBmsDevice::verifyFrame(const QByteArray& frame) const
+{
+    const char* data = frame.constData();
+    const qint64 size = frame.size();
+
+    const int hi = CSBmsProtocol::hexByte(data + BMS_FRAME_LENGTH_OFFSET);
+    const int lo = CSBmsProtocol::hexByte(data + BMS_FRAME_LENGTH_OFFSET + 2);
+    const quint16 lenid = ((hi << 8) | lo) & 0x0fff;
+    if ((hi >> 4) != CSBmsProtocol::lengthChecksum(lenid)) {
+        return InvalidLChecksum;
+    }
+
+    const char* chksum = data + size - BMS_FRAME_TRAILER_SIZE;
+    const int chi = CSBmsProtocol::hexByte(chksum);
+    const int clo = CSBmsProtocol::hexByte(chksum + 2);
+    if (((chi << 8) | clo) != CSBmsProtocol::checksum(data + 1, chksum - data - 1)) {
+        return InvalidChecksum;
+    }
 
-    /* reset input buffer */
-    m_inputBuffer.clear();
+    return NoError;
 }
 
 inline QString CSSuperVoltBmsDevice::resolveSymLink(const QString& portName)
@@ -108,7 +273,9 @@ inline QString CSSuperVoltBmsDevice::resolveSymLink(const QString& portName)
                 QString tgt = fi.symLinkTarget();
                 qDebug() << "BMSDEV: " << sym << " -> " << tgt;
                 if (sym.contains(portName)) {
-                    result = tgt.replace(devPath.absolutePath(), "").replace("/", "");
+                    /* keep sub directories, /dev/pts/3 -> pts/3 */
+                    const QString prefix = devPath.absolutePath() + "/";
+                    result = tgt.startsWith(prefix) ? tgt.mid(prefix.size()) : tgt;
                     qDebug() << "BMSDEV: Using device" << result << "for" << portName;
                     break;
                 }
@@ -123,217 +290,244 @@ inline bool CSSuperVoltBmsDevice::setupSerialPort(const QString& portName, QSeri
 {
     QSerialPortInfo spi;
     QString name = resolveSymLink(portName);
+    bool found = false;
+
     foreach (auto p, spi.availablePorts()) {
         if (p.portName().contains(name)) {
             port->setPort(p);
-            port->setBaudRate(m_config.baudRate);
-            port->setStopBits(m_config.stopBits);
-            port->setFlowControl(m_config.flowCtrl);
-            port->setParity(m_config.parity);
-            port->clearError();
-            return true;
+            found = true;
+            break;
         }
     }
-    return false;
+
+    /* pseudo terminals (e.g. the simulator) are not enumerated,
+     * accept an existing device node or a symlink to one */
+    if (!found) {
+        const QFileInfo fi(name.startsWith('/') ? name : QStringLiteral("/dev/") + name);
+        if (!fi.exists()) {
+            return false;
+        }
+        port->setPortName(fi.canonicalFilePath());
+    }
+
+    port->setBaudRate(m_config.baudRate);
+    port->setStopBits(m_config.stopBits);
+    port->setFlowControl(m_config.flowCtrl);
+    port->setParity(m_config.parity);
+    port->clearError();
+    return true;
 }
 
-/* convert byte to ASCII Hex representation of high and low nibble (split) */
-inline void CSSuperVoltBmsDevice::toAsciiHex8Bit(const quint8 value, QByteArray& result)
+/* Same name resolution as for QSerialPort, the native port takes
+ * a device path. */
+inline bool CSSuperVoltBmsDevice::setupNativePort(const QString& portName, CSBmsNativePort* port)
 {
-    char hex[3] = {};
-    /* add ASCII hex code in uppercase */
-    for (quint8 i = 0; i < 2; i++) {
-        quint8 nib = (i == 0 ? (value >> 4) & 0x0f : value & 0x0f);
-        snprintf(hex, 2, "%X", nib);
-        snprintf(hex, 3, "%02X", hex[0]);
-        result.append(hex);
+    const QString name = resolveSymLink(portName);
+    const QFileInfo fi(name.startsWith('/') ? name : QStringLiteral("/dev/") + name);
+
+    if (!fi.exists()) {
+        return false;
     }
+
+    port->setPortName(fi.canonicalFilePath());
+    port->setBaudRate(m_config.baudRate);
+    port->setDataBits(m_config.dataBits);
+    port->setStopBits(m_config.stopBits);
+    port->setParity(m_config.parity);
+    port->setFlowControl(m_config.flowCtrl);
+    port->setLowLatency(m_config.lowLatency);
+    return true;
 }
 
-inline void CSSuperVoltBmsDevice::toAsciiHex16Bit(const quint16 value, QByteArray& result)
+/* Switch between the built in ports as configured. A transport
+ * set by setTransport() is left alone. */
+inline void CSSuperVoltBmsDevice::selectBackend()
 {
-    /* high and low byte */
-    toAsciiHex8Bit((value >> 8) & 0x00ff, result);
-    toAsciiHex8Bit(value & 0x00ff, result);
+    if (m_io != &m_port && m_io != &m_native) {
+        return;
+    }
+
+    QIODevice* io = (m_config.backend == NativePort ? static_cast<QIODevice*>(&m_native) : &m_port);
+    if (io != m_io) {
+        connectTransport(false);
+        m_io = io;
+        connectTransport(true);
+    }
 }
 
-inline void CSSuperVoltBmsDevice::appendHeader(QByteArray& packet, quint8 cid2)
+/* Build a request frame in place on the caller's builder. LENGTH,
+ * INFO and CHKSUM encodings follow the OPT_ASCII_* options. */
+inline bool CSSuperVoltBmsDevice::buildRequest(CSBmsFrameBuilder& builder, quint8 address, quint8 cid2, quint16 length, quint16 info)
 {
-    /* ASCIIhex Protocol Version */
-    toAsciiHex8Bit(BMS_PROTO_VER, packet);
+    const bool asciiLength = (m_config.options & OPT_ASCII_LENGTH);
 
-    /* ASCIIhex Device address */
-    toAsciiHex8Bit(m_config.address, packet);
-
-    /* ASCIIhex CID1 -> Device identification code */
-    toAsciiHex8Bit(BMS_CID1_LIFEPO4, packet);
+    builder.appendStart(m_config.options & OPT_SOI_BYTE_3E ? BMS_PROTO_SOI_3E : BMS_PROTO_SOI_7E);
+    builder.appendHeader(address, cid2);
+    builder.appendLength(length, asciiLength);
+    if (length > 0) {
+        builder.appendInfo(info, asciiLength);
+    }
+    builder.appendChecksum(m_config.options & OPT_ASCII_CHKSUM);
+    builder.appendEnd();
 
-    /* ASCIIhex CID2 -> Control Identification Code */
-    toAsciiHex8Bit(cid2, packet);
+    if (!builder.isValid()) {
+        reportError(static_cast<BmsError>(builder.error()));
+        return false;
+    }
+    return true;
 }
 
-/* SOI as byte */
-inline void CSSuperVoltBmsDevice::appendStart(QByteArray& packet)
+/* A request frame depends on address, options, CID2, LENGTH and
+ * INFO only. Frames are built once and served from the cache on
+ * every further poll; the setters drop the cache. */
+inline const CSBmsFrameBuilder* CSSuperVoltBmsDevice::requestFrame(const TRequest& request)
 {
-    if (m_config.options & OPT_SOI_BYTE_3E) {
-        packet.append(BMS_PROTO_SOI_3E);
-        return;
+    const quint64 key = (quint64(request.address) << 48) //
+                        | (quint64(m_config.options & 0xff) << 40)
+                        | (quint64(request.cid2) << 32)
+                        | (quint64(request.length) << 16)
+                        | request.info;
+
+    auto it = m_requestCache.constFind(key);
+    if (it == m_requestCache.constEnd()) {
+        CSBmsFrameBuilder builder;
+        if (!buildRequest(builder, request.address, request.cid2, request.length, request.info)) {
+            return nullptr;
+        }
+        it = m_requestCache.insert(key, builder);
     }
 
-    packet.append(BMS_PROTO_SOI_7E);
+    return &it.value();
 }
 
-/* EOI as byte */
-inline void CSSuperVoltBmsDevice::appendEnd(QByteArray& packet)
+inline QFuture<CSSuperVoltBmsDevice::TResponse> CSSuperVoltBmsDevice::enqueue(quint8 address, quint8 cid2, quint16 length, quint16 info)
 {
-    packet.append(BMS_PROTO_EOI);
+    TRequest request = {address, cid2, length, info, timeout(cid2), QSharedPointer<QPromise<TResponse>>::create()};
+    QFuture<TResponse> future = request.promise->future();
+
+    request.promise->start();
+    m_queue.enqueue(request);
+
+    if (!m_busy) {
+        dispatch();
+    }
+
+    return future;
 }
 
-/* LENGTH consists of 2 bytes, composed of LENID and LCHKSUM.
- * LENID represents the number of ASCII bytes in the INFO item.
- * When LENID=0, INFO is empty, meaning there is no such item.
- * LENGTH is split into four ASCII bytes, with the high byte first
- * and the low byte last. The calculation of the
- * checksum is: D11D10D9D8 + D7D6D5D4 + D3D2D1D0, after summing, take
- * the modulo 16, negate it, and add 1.
- * The ASCII byte count of the INFO field is 18 (in decimal), which
- * is equivalent to LENID=000000010010B.
- * D11D10D9D8 + D7D6D5D4 + D3D2D1D0 = 0000B + 0001B + 0010B = 0011B.
- * The remainder modulo 16 is 0011B. The complement of 0011B plus 1
- * is 1101B, which is LCHKSUM. Therefore, LENGTH is 1101000000010010B,
- * which is equivalent to D012H.
- *
- * NOTE: Length CANNOT exceed 12bit !!!!!
- * NOTE: 4 bit reserved for LCHKSUM
- */
-inline bool CSSuperVoltBmsDevice::appendLength(QByteArray& packet, quint16 length)
+/* send the next queued request, at most one is on the bus */
+inline void CSSuperVoltBmsDevice::dispatch()
 {
-    qint16 chksum;
-    char hex[5];
+    while (!m_busy && !m_queue.isEmpty()) {
+        m_current = m_queue.dequeue();
 
-#if 0
-    /* test length: LCHKSUM: 0xD  LENID=0x012 -> LENGTH=0xD012 */
-    length = 18;
-#endif
-
-    /* check value bit size. */
-    if ((length & 0xf000) > 0) {
-        emit errorOccured(InvalidFormat);
-        return false;
-    }
+        if (!m_io->isOpen()) {
+            finish(NotOpenError);
+            continue;
+        }
 
-    /* no INFO field */
-    if (length == 0) {
-#if 0
-        length = packet.size() / 2;
-        length += 5; /* LENGTH(2) + CHKSUM(2) + EOI(1) */
-#endif
-        /* LENGTH field is zero */
-        if (m_config.options & OPT_ASCII_LENGTH) {
-            toAsciiHex16Bit(0, packet);
+        const CSBmsFrameBuilder* frame = requestFrame(m_current);
+        if (!frame) {
+            finish(InvalidFormat);
+            continue;
         }
-        else {
-            snprintf(hex, 5, "%04X", 0);
-            packet.append(hex);
+
+        /* drop a partial reply left over from the previous request */
+        m_parser.reset();
+        m_busy = true;
+        m_sentTimer.start();
+
+        if (!transmit(frame->view())) {
+            reportError(WriteError);
+            finish(WriteError);
+            continue;
         }
-        return true;
-    }
 
-    /* 0 = D11 D10 D9 D8 | 1 = D7 D6 D5 D4 | 2 = D3 D2 D1 D0 */
-    quint8 bits[3] = {
-       static_cast<quint8>((length >> 8) & 0x0f),
-       static_cast<quint8>((length >> 4) & 0x0f),
-       static_cast<quint8>(length & 0x000f),
-    };
-
-    chksum = bits[0] + bits[1] + bits[2];
-    chksum = (~(chksum % 16)) + 1;
-
-    if (m_config.options & OPT_ASCII_LENGTH) {
-        /* LCHKSUM 4 bit LSB */
-        snprintf(hex, 2, "%X", (chksum & 0x000f));
-        snprintf(hex, 3, "%02X", hex[0]);
-        packet.append(hex);
-        /* LENGTH 12 bit value */
-        snprintf(hex, 2, "%X", ((length >> 8) & 0x000f));
-        snprintf(hex, 3, "%02X", hex[0]);
-        packet.append(hex);
-        snprintf(hex, 2, "%X", ((length >> 4) & 0x000f));
-        snprintf(hex, 3, "%02X", hex[0]);
-        packet.append(hex);
-        snprintf(hex, 2, "%X", (length & 0x000f));
-        snprintf(hex, 3, "%02X", hex[0]);
-        packet.append(hex);
+        m_responseTimer.start(m_current.timeout);
     }
-    else {
-        /* LCHKSUM 4 bit LSB */
-        snprintf(hex, 2, "%X", (chksum & 0x000f));
-        packet.append(hex);
-        /* LENGTH 12 bit value */
-        snprintf(hex, 4, "%03X", length & 0x0fff);
-        packet.append(hex);
+}
+
+inline void CSSuperVoltBmsDevice::finish(const TResponse& response)
+{
+    QSharedPointer<QPromise<TResponse>> promise = m_current.promise;
+
+    if (m_metrics) {
+        m_metrics->observeLatency(response.address, response.cid2, response.latencyNs);
     }
 
-    return true;
+    /* a stale gap timeout must not hit the next request */
+    m_responseTimer.stop();
+    m_gapTimer.stop();
+    m_current = {};
+    m_busy = false;
+
+    promise->addResult(response);
+    promise->finish();
 }
 
-/* Add the INFO field. LENID must not be 0x00 ! */
-inline void CSSuperVoltBmsDevice::appendInfo(QByteArray& packet, quint16 info)
+inline void CSSuperVoltBmsDevice::finish(BmsError error, bool replied)
 {
-    char hex[5];
-    if (m_config.options & OPT_ASCII_LENGTH) {
-        toAsciiHex16Bit(info, packet);
+    QSharedPointer<QPromise<TResponse>> promise = m_current.promise;
+
+    /* the pack answered not as expected or is gone: maybe swapped */
+    if (error < UserErrorFirst || error == TimeoutError) {
+        invalidateInfo(m_current.address);
     }
-    else {
-        snprintf(hex, 5, "%04X", info);
-        packet.append(hex);
+
+    m_responseTimer.stop();
+    m_gapTimer.stop();
+    m_current = {};
+    m_busy = false;
+
+    promise->setException(CSBmsException(error, replied));
+    promise->finish();
+}
+
+inline void CSSuperVoltBmsDevice::invalidateInfo(quint8 address)
+{
+    for (auto it = m_infoCache.begin(); it != m_infoCache.end();) {
+        if (it.value().address == address) {
+            it = m_infoCache.erase(it);
+            m_cacheStats.invalidations++;
+        }
+        else {
+            it++;
+        }
     }
 }
 
-/* The calculation of CHKSUM is to add up the characters other
- * than SOI, EOI, and CHKSUM according to their ASCII values,
- * and then take the modulo 65536 of the sum, invert it, and add 1.
- * CHKSUM is transmitted as four separate ASCII codes, first the
- * high byte and then the low byte. */
-inline bool CSSuperVoltBmsDevice::appendChecksum(QByteArray& packet)
+/* fail the request on the bus and everything queued */
+inline void CSSuperVoltBmsDevice::abortAll(BmsError error)
 {
-    int size, chksum = 0;
+    QQueue<TRequest> queue;
 
-#if 0
-    /* test chksum: 0x02c5 ~+ 1 -> 0xFD3B */
-    packet = QStringLiteral("20014043E00200").toLocal8Bit();
-#endif
+    m_responseTimer.stop();
+    m_gapTimer.stop();
+    queue.swap(m_queue);
 
-    if (packet.isEmpty()) {
-        emit errorOccured(InvalidData);
-        return false;
+    if (m_busy) {
+        queue.prepend(m_current);
+        m_current = {};
+        m_busy = false;
     }
 
-    /* skip SOI byte */
-    size = packet.size();
-    for (int i = 1; i < size; i++) {
-        chksum += static_cast<quint8>(packet[i++]);
+    foreach (auto request, queue) {
+        request.promise->setException(CSBmsException(error));
+        request.promise->finish();
     }
-    if (!chksum) {
-        emit errorOccured(InvalidChecksum);
-        return false;
-    }
-    chksum = (~(chksum % 65536)) + 1;
+}
 
-    /* high and low byte */
-    if (m_config.options & OPT_ASCII_CHKSUM) {
-        toAsciiHex8Bit(((chksum >> 8) & 0x00ff), packet);
-        toAsciiHex8Bit((chksum & 0x00ff), packet);
-    }
-    else {
-        char hex[3];
-        snprintf(hex, 3, "%02X", (chksum >> 8) & 0x00ff);
-        packet.append(hex);
-        snprintf(hex, 3, "%02X", (chksum & 0x00ff));
-        packet.append(hex);
-    }
+/* replies that never change while the pack stays connected */
+bool CSSuperVoltBmsDevice::isStaticInfo(quint8 cid2)
+{
+    return cid2 == BMS_CID2_FETCH_MANUFACTURER //
+           || cid2 == BMS_CID2_FETCH_PROTO_VER
+           || cid2 == BMS_CID2_FETCH_DEVICE_ADDR;
+}
 
-    return true;
+static inline quint16 infoKey(quint8 address, quint8 cid2)
+{
+    return (quint16(address) << 8) | cid2;
 }
 
 static inline QString toMessage(const QByteArray& buffer)
@@ -358,24 +552,253 @@ static inline QString toMessage(const QByteArray& buffer)
 
 inline void CSSuperVoltBmsDevice::response(const QByteArray& buffer)
 {
-    qDebug() << "BMSDEV:RSP>" << buffer;
+    TResponse rsp = {};
+    rsp.address = CSBmsProtocol::hexByte(buffer.constData() + BMS_FRAME_ADR_OFFSET);
+    rsp.version = CSBmsProtocol::hexByte(buffer.constData() + BMS_FRAME_VER_OFFSET);
+
+    if (traceEnabled(TRACE_DECODED)) {
+        trace(tr("RESP> [%1:%2] %3") //
+                 .arg(rsp.address)
+                 .arg(buffer.size())
+                 .arg(toMessage(buffer)));
+    }
+
+    /* late reply to a timed out request or noise from another
+     * master, nobody is waiting for it */
+    if (!m_busy || rsp.address != m_current.address) {
+        if (traceEnabled(TRACE_ERRORS)) {
+            trace(tr("ERR> Unsolicited response from address %1").arg(rsp.address));
+        }
+        return;
+    }
+
+    rsp.cid2 = m_current.cid2;
+    rsp.latencyNs = m_sentTimer.nsecsElapsed();
+
+    /* RTN codes 0x01..0x06 map to our error codes */
+    const int rtn = CSBmsProtocol::hexByte(buffer.constData() + BMS_FRAME_RTN_OFFSET);
+    if (rtn != NoError) {
+        const BmsError error = (rtn < 0 ? InvalidFormat : static_cast<BmsError>(rtn));
+        reportError(error);
+        finish(error, rtn > 0);
+        dispatch();
+        return;
+    }
+    rsp.rtn = rtn;
+
+    switch (rsp.cid2) {
+        case BMS_CID2_FETCH_ANALOG_DATA:
+        case BMS_CID2_FETCH_ANALOG_DATA + 1: {
+            if (!decodeAnalogData(buffer, rsp.analog)) {
+                reportError(InvalidData);
+                finish(InvalidData);
+                dispatch();
+                return;
+            }
+            if (m_analogRing) {
+                m_analogRing->push(rsp.analog);
+            }
+            if (m_metrics) {
+                m_metrics->updatePack(rsp.analog);
+            }
+            emit analogDataReceived(rsp.analog);
+            break;
+        }
+        case BMS_CID2_FETCH_MANUFACTURER: {
+            if (!decodeManufacturer(buffer, rsp.manufacturer)) {
+                reportError(InvalidData);
+                finish(InvalidData);
+                dispatch();
+                return;
+            }
+            break;
+        }
+    }
+
+    /* the parser buffer is reused, keep our own copy */
+    rsp.frame = QByteArray(buffer.constData(), buffer.size());
+
+    if (isStaticInfo(rsp.cid2)) {
+        TResponse entry = rsp;
+        entry.cached = true;
+        entry.latencyNs = 0;
+        m_infoCache.insert(infoKey(rsp.address, rsp.cid2), entry);
+    }
+    finish(rsp);
+    dispatch();
+}
+
+/* Big endian reader over the decoded INFO field. A read past
+ * the end clears 'ok'. */
+typedef struct TByteCursor
+{
+    const quint8* pos;
+    const quint8* end;
+    bool ok;
+
+    inline quint32 read(int bytes)
+    {
+        quint32 value = 0;
+        if (!ok || (end - pos) < bytes) {
+            ok = false;
+            return 0;
+        }
+        for (int i = 0; i < bytes; i++) {
+            value = (value << 8) | *pos++;
+        }
+        return value;
+    }
+} TByteCursor;
+
+/* INFO layout of the analog data response:
+ * INFOFLAG(1) ADR(1) M(1) CELL(2)*M K(1) TEMP(2)*K CURRENT(2)
+ * VOLTAGE(2) REMAIN(2) P(1) TOTAL(2) CYCLES(2) [REMAIN(3) TOTAL(3)]
+ * Temperatures are 0.1 Kelvin, current and 16 bit capacities are
+ * in 10 mA / 10 mAh units. With P=4 the 24 bit capacities (mAh)
+ * follow and replace the 16 bit values. */
+bool CSSuperVoltBmsDevice::decodeAnalogData(const QByteArray& frame, TAnalogData& data)
+{
+    memset(&data, 0, sizeof(data));
+
+    if (frame.size() < BMS_FRAME_HEADER_SIZE + BMS_FRAME_TRAILER_SIZE) {
+        return false;
+    }
+
+    /* INFO to binary in one pass, no per field digit checks */
+    quint8 info[BMS_MAX_INFO_SIZE / 2];
+    const qint64 infoSize = (frame.size() - BMS_FRAME_HEADER_SIZE - BMS_FRAME_TRAILER_SIZE) / 2;
+    if (infoSize > qint64(sizeof(info))) {
+        return false;
+    }
+    if (CSBmsProtocol::hexDecode(frame.constData() + BMS_FRAME_HEADER_SIZE, infoSize, info) >= 0) {
+        return false;
+    }
+    TByteCursor bc = {info, info + infoSize, true};
+
+    data.timestamp = QDateTime::currentMSecsSinceEpoch();
+    data.infoFlag = bc.read(1);
+    data.address = bc.read(1);
 
-    emit message(tr("RESP> [%1:%2] %3") //
-                    .arg(m_config.address)
-                    .arg(buffer.size())
-                    .arg(toMessage(buffer)));
+    data.cellCount = bc.read(1);
+    if (data.cellCount > BMS_MAX_CELLS) {
+        return false;
+    }
+    for (int i = 0; i < data.cellCount; i++) {
+        data.cellVoltage[i] = bc.read(2);
+    }
+
+    data.tempCount = bc.read(1);
+    if (data.tempCount > BMS_MAX_TEMPS) {
+        return false;
+    }
+    for (int i = 0; i < data.tempCount; i++) {
+        data.temperature[i] = static_cast<qint16>(bc.read(2) - 2731);
+    }
+
+    data.current = static_cast<qint16>(bc.read(2)) * 10;
+    data.voltage = bc.read(2);
+    data.remainCapacity = bc.read(2) * 10;
+    const quint8 userDefined = bc.read(1);
+    data.totalCapacity = bc.read(2) * 10;
+    data.cycles = bc.read(2);
+    if (userDefined >= 4) {
+        data.remainCapacity = bc.read(3);
+        data.totalCapacity = bc.read(3);
+    }
+
+    if (!bc.ok) {
+        return false;
+    }
+
+    if (data.totalCapacity > 0) {
+        data.soc = static_cast<quint8>(qMin<quint64>(100, (data.remainCapacity * 100ULL) / data.totalCapacity));
+    }
+
+    return true;
+}
+
+/* copy 'size' ASCII characters, drop trailing blanks and NULs */
+static inline void copyText(char* out, const quint8* in, int size)
+{
+    memcpy(out, in, size);
+    out[size] = '\0';
+    for (int i = size - 1; i >= 0 && (out[i] == ' ' || out[i] == '\0'); i--) {
+        out[i] = '\0';
+    }
 }
 
-inline bool CSSuperVoltBmsDevice::transmit(const QByteArray& packet)
+/* INFO layout of the manufacturer response:
+ * BATTERY NAME(10) SOFTWARE VERSION(2) MANUFACTURER NAME(20) */
+bool CSSuperVoltBmsDevice::decodeManufacturer(const QByteArray& frame, TManufacturerInfo& info)
 {
-    qDebug() << "BMSDEV:SND>" << packet;
+    quint8 data[32];
 
-    emit message(tr("SND> [%1:%2] %3") //
-                    .arg(m_config.address)
-                    .arg(packet.size())
-                    .arg(toMessage(packet)));
+    memset(&info, 0, sizeof(info));
 
-    return m_port.write(packet) == packet.size();
+    const qint64 infoSize = (frame.size() - BMS_FRAME_HEADER_SIZE - BMS_FRAME_TRAILER_SIZE) / 2;
+    if (infoSize < qint64(sizeof(data))) {
+        return false;
+    }
+    if (CSBmsProtocol::hexDecode(frame.constData() + BMS_FRAME_HEADER_SIZE, sizeof(data), data) >= 0) {
+        return false;
+    }
+
+    copyText(info.batteryName, data, 10);
+    info.softwareMajor = data[10];
+    info.softwareMinor = data[11];
+    copyText(info.manufacturer, data + 12, 20);
+    return true;
+}
+
+inline bool CSSuperVoltBmsDevice::transmit(QByteArrayView packet)
+{
+    if (traceEnabled(TRACE_RAW_TX)) {
+        trace(tr("SND> [%1:%2] %3") //
+                 .arg(m_current.address)
+                 .arg(packet.size())
+                 .arg(toMessage(packet.toByteArray())));
+    }
+
+    if (m_capture) {
+        m_capture->write(m_capturePort, CSBmsCapture::RecordTx, m_current.address, packet.data(), packet.size());
+    }
+
+    if (m_metrics) {
+        m_metrics->countTx(packet.size());
+    }
+
+    return m_io->write(packet.data(), packet.size()) == packet.size();
+}
+
+/* A trace category is formatted only when it is selected in
+ * traceFlags and someone listens: a connected message() slot
+ * or the enabled bms.trace logging category. */
+inline bool CSSuperVoltBmsDevice::traceEnabled(uint category) const
+{
+    static const QMetaMethod messageSignal = QMetaMethod::fromSignal(&CSSuperVoltBmsDevice::message);
+
+    if (!(m_config.traceFlags & category)) {
+        return false;
+    }
+
+    return isSignalConnected(messageSignal) || lcBmsTrace().isDebugEnabled();
+}
+
+inline void CSSuperVoltBmsDevice::trace(const QString& text)
+{
+    qCDebug(lcBmsTrace).noquote() << "BMSDEV:" << text;
+    emit message(text);
+}
+
+inline void CSSuperVoltBmsDevice::reportError(BmsError error)
+{
+    if (traceEnabled(TRACE_ERRORS)) {
+        trace(tr("ERR> [%1] %2").arg(m_current.address).arg(error));
+    }
+    if (m_metrics) {
+        m_metrics->countError(error);
+    }
+    emit errorOccured(error);
 }
 
 /* ----------------------------------------------------------
@@ -390,36 +813,68 @@ const CSSuperVoltBmsDevice::TPortConfig& CSSuperVoltBmsDevice::config() const
 void CSSuperVoltBmsDevice::setConfig(const TPortConfig& newConfig)
 {
     m_config = newConfig;
+    m_config.frameGap = qMax<qreal>(0.0, m_config.frameGap);
+    m_requestCache.clear();
 }
 
 void CSSuperVoltBmsDevice::setOptions(uint options)
 {
-    m_config.options = options;
+    if (m_config.options != options) {
+        m_config.options = options;
+        m_requestCache.clear();
+    }
 }
 
 void CSSuperVoltBmsDevice::setAddress(uint address)
 {
-    m_config.address = address;
+    if (m_config.address != address) {
+        m_config.address = address;
+        m_requestCache.clear();
+    }
 }
 
 bool CSSuperVoltBmsDevice::open()
 {
-    if (m_port.isOpen()) {
+    if (m_io->isOpen()) {
+        return true;
+    }
+
+    /* another pack may sit on the bus after a reconnect */
+    clearInfoCache();
+
+    selectBackend();
+
+    if (m_io == &m_native) {
+        if (!setupNativePort(m_config.portName, &m_native)) {
+            reportError(DeviceNotFoundError);
+            return false;
+        }
+    }
+
+    if (m_io != &m_port) {
+        if (!m_io->open(QIODevice::ReadWrite)) {
+            qDebug() << "BMSDEV: Open failed:" << m_io->errorString();
+            reportError(OpenError);
+            return false;
+        }
+        m_parser.reset();
+        emit connected();
         return true;
     }
 
     if (!setupSerialPort(m_config.portName, &m_port)) {
-        emit errorOccured(DeviceNotFoundError);
+        reportError(DeviceNotFoundError);
         return false;
     }
 
     if (!m_port.open(QSerialPort::ReadWrite)) {
-        emit errorOccured(OpenError);
+        reportError(OpenError);
         return false;
     }
 
     /* clear buffers */
     m_port.flush();
+    m_parser.reset();
 
     emit connected();
     return true;
@@ -427,100 +882,171 @@ bool CSSuperVoltBmsDevice::open()
 
 void CSSuperVoltBmsDevice::close()
 {
+    abortAll(NotOpenError);
+
     if (m_port.isOpen()) {
         m_port.flush();
         m_port.close();
     }
+    else if (m_io->isOpen()) {
+        m_io->close();
+    }
 }
 
 bool CSSuperVoltBmsDevice::isOpen() const
 {
-    return m_port.isOpen();
+    return m_io->isOpen();
 }
 
-/* Fetch current date / time from BMS */
-void CSSuperVoltBmsDevice::fetchTime()
+void CSSuperVoltBmsDevice::setTransport(QIODevice* transport)
 {
-    QByteArray packet = {};
-
-    appendStart(packet);
-    appendHeader(packet, BMS_CID2_FETCH_TIME);
-    /* no INFO field LENID = 0x00 */
-    if (!appendLength(packet, 0)) {
-        return;
+    if (!transport) {
+        transport = &m_port;
     }
-    if (!appendChecksum(packet)) {
+    if (transport == m_io) {
         return;
     }
-    appendEnd(packet);
-    transmit(packet);
+
+    close();
+    connectTransport(false);
+    m_io = transport;
+    connectTransport(true);
 }
 
-void CSSuperVoltBmsDevice::fetchProtocolVersion()
+void CSSuperVoltBmsDevice::setCapture(CSBmsCaptureWriter* capture)
 {
-    QByteArray packet = {};
-
-    appendStart(packet);
-    appendHeader(packet, BMS_CID2_FETCH_PROTO_VER);
-    /* no INFO field LENID = 0x00 */
-    if (!appendLength(packet, 0)) {
-        return;
+    m_capture = capture;
+    if (m_capture) {
+        m_capturePort = m_capture->registerPort(m_config.portName);
     }
-    if (!appendChecksum(packet)) {
-        return;
-    }
-    appendEnd(packet);
-    transmit(packet);
 }
 
-void CSSuperVoltBmsDevice::fetchDeviceAddress()
+void CSSuperVoltBmsDevice::setAnalogRing(CSBmsFrameRing<TAnalogData>* ring)
 {
-    QByteArray packet = {};
+    m_analogRing = ring;
+}
 
-    appendStart(packet);
-    appendHeader(packet, BMS_CID2_FETCH_DEVICE_ADDR);
-    /* no INFO field LENID = 0x00 */
-    if (!appendLength(packet, 0)) {
-        return;
-    }
-    if (!appendChecksum(packet)) {
-        return;
-    }
-    appendEnd(packet);
-    transmit(packet);
+void CSSuperVoltBmsDevice::setMetrics(CSBmsPortMetrics* metrics)
+{
+    m_metrics = metrics;
 }
 
-void CSSuperVoltBmsDevice::fetchManufacturer()
+void CSSuperVoltBmsDevice::setFrameGap(qreal characters)
 {
-    QByteArray packet = {};
+    m_config.frameGap = qMax<qreal>(0.0, characters);
+}
 
-    appendStart(packet);
-    appendHeader(packet, BMS_CID2_FETCH_MANUFACTURER);
-    /* no INFO field LENID = 0x00 */
-    if (!appendLength(packet, 0)) {
-        return;
+qreal CSSuperVoltBmsDevice::frameGap() const
+{
+    return m_config.frameGap;
+}
+
+/* start bit + data bits + parity + stop bits at the baud rate,
+ * 0 when the port config has no baud rate (e.g. replay) */
+qint64 CSSuperVoltBmsDevice::characterTimeNs() const
+{
+    if (m_config.baudRate <= 0) {
+        return 0;
     }
-    if (!appendChecksum(packet)) {
-        return;
+
+    qreal bits = 1 + m_config.dataBits;
+    bits += (m_config.parity == QSerialPort::NoParity ? 0 : 1);
+    switch (m_config.stopBits) {
+        case QSerialPort::OneAndHalfStop: {
+            bits += 1.5;
+            break;
+        }
+        case QSerialPort::TwoStop: {
+            bits += 2;
+            break;
+        }
+        default: {
+            bits += 1;
+            break;
+        }
     }
-    appendEnd(packet);
-    transmit(packet);
+
+    return qint64(bits * 1e9 / m_config.baudRate);
 }
 
-void CSSuperVoltBmsDevice::fetchAnalogData(bool fixed)
+void CSSuperVoltBmsDevice::setTimeout(quint8 cid2, int msecs)
 {
-    QByteArray packet = {};
+    m_timeouts[cid2] = msecs;
+}
 
-    appendStart(packet);
-    appendHeader(packet, BMS_CID2_FETCH_ANALOG_DATA + (fixed ? 1 : 0));
-    /* INFO field exist: LENGTH(2) + INFO(2) + CHKSUM(2) + EOI(1) */
-    if (!appendLength(packet, 2)) {
-        return;
+int CSSuperVoltBmsDevice::timeout(quint8 cid2) const
+{
+    return m_timeouts.value(cid2, 1000);
+}
+
+CSSuperVoltBmsDevice::TCacheStatistics CSSuperVoltBmsDevice::infoCacheStatistics() const
+{
+    return m_cacheStats;
+}
+
+void CSSuperVoltBmsDevice::clearInfoCache()
+{
+    m_cacheStats.invalidations += m_infoCache.size();
+    m_infoCache.clear();
+}
+
+int CSSuperVoltBmsDevice::pendingRequests() const
+{
+    return m_queue.size() + (m_busy ? 1 : 0);
+}
+
+QFuture<CSSuperVoltBmsDevice::TResponse> CSSuperVoltBmsDevice::execute(quint8 address, quint8 cid2)
+{
+    if (isStaticInfo(cid2)) {
+        auto it = m_infoCache.constFind(infoKey(address, cid2));
+        if (it != m_infoCache.constEnd()) {
+            QPromise<TResponse> promise;
+            QFuture<TResponse> future = promise.future();
+
+            m_cacheStats.hits++;
+            promise.start();
+            promise.addResult(it.value());
+            promise.finish();
+            return future;
+        }
+        m_cacheStats.misses++;
     }
-    appendInfo(packet, 0x00ff);
-    if (!appendChecksum(packet)) {
-        return;
+
+    switch (cid2) {
+        case BMS_CID2_FETCH_ANALOG_DATA:
+        case BMS_CID2_FETCH_ANALOG_DATA + 1: {
+            /* INFO field exist: LENGTH(2) + INFO(2) + CHKSUM(2) + EOI(1) */
+            return enqueue(address, cid2, 2, 0x00ff);
+        }
+        default: {
+            /* no INFO field LENID = 0x00 */
+            return enqueue(address, cid2);
+        }
     }
-    appendEnd(packet);
-    transmit(packet);
+}
+
+/* Fetch current date / time from BMS */
+QFuture<CSSuperVoltBmsDevice::TResponse> CSSuperVoltBmsDevice::fetchTime()
+{
+    return execute(m_config.address, BMS_CID2_FETCH_TIME);
+}
+
+QFuture<CSSuperVoltBmsDevice::TResponse> CSSuperVoltBmsDevice::fetchProtocolVersion()
+{
+    return execute(m_config.address, BMS_CID2_FETCH_PROTO_VER);
+}
+
+QFuture<CSSuperVoltBmsDevice::TResponse> CSSuperVoltBmsDevice::fetchDeviceAddress()
+{
+    return execute(m_config.address, BMS_CID2_FETCH_DEVICE_ADDR);
+}
+
+QFuture<CSSuperVoltBmsDevice::TResponse> CSSuperVoltBmsDevice::fetchManufacturer()
+{
+    return execute(m_config.address, BMS_CID2_FETCH_MANUFACTURER);
+}
+
+QFuture<CSSuperVoltBmsDevice::TResponse> CSSuperVoltBmsDevice::fetchAnalogData(bool fixed)
+{
+    return execute(m_config.address, BMS_CID2_FETCH_ANALOG_DATA + (fixed ? 1 : 0));
 }
@@ -1,8 +1,26 @@
 #pragma once
+#include <QElapsedTimer>
+#include <QException>
+#include <QFuture>
+#include <QHash>
 #include <QObject>
+#include <QPromise>
+#include <QQueue>
 #include <QSerialPort>
+#include <QSharedPointer>
+#include <QTimer>
+#include <csbmscapture.h>
+#include <csbmsframebuilder.h>
+#include <csbmsframeparser.h>
+#include <csbmsnativeport.h>
+#include <csbmsring.h>
 #include <piplatesio/csiodevice.h>
 
+class CSBmsPortMetrics;
+
+/* shortest frame gap timeout in ms, see setFrameGap() */
+static const int BMS_MIN_FRAME_GAP_MS = 50;
+
 class CSSuperVoltBmsDevice: public QObject, public CSIoDevice
 {
     Q_OBJECT
@@ -38,6 +56,13 @@ public:
     };
     Q_ENUM(BmsError)
 
+    /* serial port implementation used by open() */
+    enum PortBackend {
+        QtSerialPort = 0,
+        NativePort, /* raw termios, see CSBmsNativePort */
+    };
+    Q_ENUM(PortBackend)
+
     typedef struct {
         QString portName;
         QSerialPort::BaudRate baudRate;
@@ -48,13 +73,71 @@ public:
         quint8 address;
         uint options;
         uint traceFlags;
+        PortBackend backend;
+        bool lowLatency; /* ASYNC_LOW_LATENCY, native backend only */
+        qreal frameGap;  /* character times, see setFrameGap() */
     } TPortConfig;
 
+    /* Decoded analog data response (CID2 0x41/0x42). Fixed layout,
+     * cell voltages and temperatures are contiguous arrays. */
+    typedef struct {
+        qint64 timestamp;                    /* ms since epoch */
+        quint16 cellVoltage[BMS_MAX_CELLS];  /* mV */
+        qint16 temperature[BMS_MAX_TEMPS];   /* 0.1 degree Celsius */
+        qint32 current;                      /* mA, negative = discharge */
+        quint32 voltage;                     /* mV */
+        quint32 remainCapacity;              /* mAh */
+        quint32 totalCapacity;               /* mAh */
+        quint16 cycles;
+        quint8 address;
+        quint8 infoFlag;
+        quint8 cellCount;
+        quint8 tempCount;
+        quint8 soc; /* % */
+        quint8 reserved;
+    } TAnalogData;
+
+    /* Decoded manufacturer response (CID2 0x51), strings are
+     * NUL terminated with trailing blanks removed */
+    typedef struct {
+        char batteryName[11];
+        char manufacturer[21];
+        quint8 softwareMajor;
+        quint8 softwareMinor;
+    } TManufacturerInfo;
+
+    /* Response handed to the caller of a request */
+    typedef struct {
+        quint8 address;
+        quint8 cid2;       /* requested function code */
+        quint8 version;
+        quint8 rtn;
+        bool cached;       /* served from the static info cache */
+        qint64 latencyNs;  /* request written to response complete */
+        QByteArray frame;  /* complete response frame */
+        TAnalogData analog; /* valid for analog data requests */
+        TManufacturerInfo manufacturer; /* valid for manufacturer requests */
+    } TResponse;
+
+    /* static info cache counters */
+    typedef struct {
+        quint64 hits;
+        quint64 misses;
+        quint64 invalidations;
+    } TCacheStatistics;
+
     static const quint8 OPT_SOI_BYTE_3E = 0x01;
     static const quint8 OPT_SOI_BYTE_7E = 0x02;
     static const quint8 OPT_ASCII_CHKSUM = 0x04;
     static const quint8 OPT_ASCII_LENGTH = 0x08;
 
+    /* trace categories, TPortConfig::traceFlags */
+    static const uint TRACE_RAW_RX = 0x01;
+    static const uint TRACE_RAW_TX = 0x02;
+    static const uint TRACE_DECODED = 0x04;
+    static const uint TRACE_ERRORS = 0x08;
+    static const uint TRACE_ALL = 0x0f;
+
     explicit CSSuperVoltBmsDevice(QObject* parent = nullptr);
 
     ~CSSuperVoltBmsDevice();
@@ -67,60 +150,148 @@ public:
     void setConfig(const TPortConfig& newConfig);
     void setOptions(uint options);
     void setAddress(uint address);
-    void fetchAnalogData(bool fixed = false);
-    void fetchManufacturer();
-    void fetchDeviceAddress();
-    void fetchProtocolVersion();
-    void fetchTime();
+    /* Use another transport than the serial port, e.g. a replay
+     * device. Set while closed; nullptr selects the serial port
+     * of TPortConfig::backend again. */
+    void setTransport(QIODevice* transport);
+
+    /* record raw RX/TX chunks, nullptr stops recording */
+    void setCapture(CSBmsCaptureWriter* capture);
+
+    /* Lock free tap of decoded analog records for a consumer on
+     * another thread. Owned by the caller, which is the only reader;
+     * nullptr disconnects. */
+    void setAnalogRing(CSBmsFrameRing<TAnalogData>* ring);
+
+    /* counters, latencies and pack gauges of this port, owned by
+     * a CSBmsMetrics registry; nullptr disconnects */
+    void setMetrics(CSBmsPortMetrics* metrics);
+
+    void setTimeout(quint8 cid2, int msecs);
+    int timeout(quint8 cid2) const;
+
+    /* Silence on the line, in character times at the configured
+     * baud rate / framing, that ends a partial frame. 0 disables and
+     * is the default. USB adapters deliver a reply in chunks up to
+     * their latency timer (16 ms on FTDI) apart, so the timer never
+     * fires before BMS_MIN_FRAME_GAP_MS. Same as TPortConfig::frameGap. */
+    void setFrameGap(qreal characters);
+    qreal frameGap() const;
+    qint64 characterTimeNs() const;
+
+    /* Requests are queued and sent one at a time, the bus is half
+     * duplex. The future resolves with the response or fails with a
+     * CSBmsException (TimeoutError, RTN error, NotOpenError, ...). */
+    QFuture<TResponse> execute(quint8 address, quint8 cid2);
+    QFuture<TResponse> fetchAnalogData(bool fixed = false);
+    QFuture<TResponse> fetchManufacturer();
+    QFuture<TResponse> fetchDeviceAddress();
+    QFuture<TResponse> fetchProtocolVersion();
+    QFuture<TResponse> fetchTime();
+    int pendingRequests() const;
+
+    /* Manufacturer, protocol version and device address replies
+     * don't change while connected. They are cached per address and
+     * served without bus traffic until the port is reopened or the
+     * address answers with a protocol error or times out. */
+    TCacheStatistics infoCacheStatistics() const;
+    void clearInfoCache();
+    static bool isStaticInfo(quint8 cid2);
+
+    static bool decodeAnalogData(const QByteArray& frame, TAnalogData& data);
+    static bool decodeManufacturer(const QByteArray& frame, TManufacturerInfo& info);
 
 signals:
     void connected();
     void disconnected();
     void errorOccured(CSSuperVoltBmsDevice::BmsError);
     void message(const QString&);
+    void analogDataReceived(const CSSuperVoltBmsDevice::TAnalogData&);
 
 private slots:
     void onPortError(QSerialPort::SerialPortError);
     void onAboutToClose();
     void onReadyRead();
     void onBytesWritten(qint64);
+    void onResponseTimeout();
+    void onFrameGap();
 
 private:
-    /* fixed codes */
-    static const quint8 BMS_PROTO_SOI_3E = 0x3e;
-    static const quint8 BMS_PROTO_SOI_7E = 0x7e;
-    static const quint8 BMS_PROTO_EOI = 0x0d;
-
-    /* protocol version */
-    static const quint8 BMS_PROTO_VER = 0x22;
-
-    /* SX150 Lithium Iron Phosphate Battery Management System  */
-    static const quint8 BMS_CID1_LIFEPO4 = 0x4a;
-
-    /* function codes */
-    static const quint8 BMS_CID2_FETCH_ANALOG_DATA = 0x41;
-    static const quint8 BMS_CID2_FETCH_MANUFACTURER = 0x51;
-    static const quint8 BMS_CID2_FETCH_DEVICE_ADDR = 0x50;
-    static const quint8 BMS_CID2_FETCH_PROTO_VER = 0x4f;
-    static const quint8 BMS_CID2_FETCH_TIME = 0x4d;
+    typedef struct {
+        quint8 address;
+        quint8 cid2;
+        quint16 length;
+        quint16 info;
+        int timeout;
+        QSharedPointer<QPromise<TResponse>> promise;
+    } TRequest;
 
     QSerialPort m_port;
+    CSBmsNativePort m_native;
+    QIODevice* m_io;
+    CSBmsCaptureWriter* m_capture;
+    quint16 m_capturePort;
+    CSBmsFrameRing<TAnalogData>* m_analogRing;
+    CSBmsPortMetrics* m_metrics;
     TPortConfig m_config;
-    QByteArray m_inputBuffer;
+    CSBmsFrameParser m_parser;
+    QHash<quint64, CSBmsFrameBuilder> m_requestCache;
+    QHash<quint16, TResponse> m_infoCache;
+    TCacheStatistics m_cacheStats;
+    QHash<quint8, int> m_timeouts;
+    QQueue<TRequest> m_queue;
+    TRequest m_current;
+    bool m_busy;
+    QTimer m_responseTimer;
+    QElapsedTimer m_sentTimer;
+    QTimer m_gapTimer;
 
 private:
+    inline void connectTransport(bool enable);
     inline QString resolveSymLink(const QString& portName);
     inline bool setupSerialPort(const QString& portName, QSerialPort* port);
+    inline bool setupNativePort(const QString& portName, CSBmsNativePort* port);
+    inline void selectBackend();
+    inline void receive(const char* data, qint64 size);
+    inline void armFrameGap();
+    inline BmsError verifyFrame(const QByteArray& frame) const;
     inline void response(const QByteArray& buffer);
-    inline void toAsciiHex8Bit(const quint8 value, QByteArray& result);
-    inline void toAsciiHex16Bit(const quint16 value, QByteArray& result);
-    inline void appendStart(QByteArray& packet);
-    inline void appendEnd(QByteArray& packet);
-    inline void appendHeader(QByteArray& packet, quint8 cid2);
-    inline bool appendLength(QByteArray& packet, quint16 length);
-    inline void appendInfo(QByteArray& packet, quint16 info);
-    inline bool appendChecksum(QByteArray& packet);
-    inline bool transmit(const QByteArray& packet);
+    inline bool buildRequest(CSBmsFrameBuilder& builder, quint8 address, quint8 cid2, quint16 length, quint16 info);
+    inline const CSBmsFrameBuilder* requestFrame(const TRequest& request);
+    inline QFuture<TResponse> enqueue(quint8 address, quint8 cid2, quint16 length = 0, quint16 info = 0);
+    inline void dispatch();
+    inline void finish(const TResponse& response);
+    inline void finish(BmsError error, bool replied = false);
+    inline void abortAll(BmsError error);
+    inline void invalidateInfo(quint8 address);
+    inline bool transmit(QByteArrayView packet);
+    inline bool traceEnabled(uint category) const;
+    inline void trace(const QString& text);
+    inline void reportError(BmsError error);
 };
+
+/* Failure of a queued request, carried by the request's QFuture */
+class CSBmsException: public QException
+{
+public:
+    explicit CSBmsException(CSSuperVoltBmsDevice::BmsError error, bool replied = false)
+        : m_error(error)
+        , m_replied(replied)
+    {
+    }
+
+    void raise() const override { throw *this; }
+    CSBmsException* clone() const override { return new CSBmsException(*this); }
+    CSSuperVoltBmsDevice::BmsError error() const { return m_error; }
+    /* the error is the RTN of a valid reply, not a line or local error */
+    bool replied() const { return m_replied; }
+
+private:
+    CSSuperVoltBmsDevice::BmsError m_error;
+    bool m_replied;
+};
+
 Q_DECLARE_METATYPE(CSSuperVoltBmsDevice::BmsError)
 Q_DECLARE_METATYPE(CSSuperVoltBmsDevice::TPortConfig)
+Q_DECLARE_METATYPE(CSSuperVoltBmsDevice::TAnalogData)
+Q_DECLARE_METATYPE(CSSuperVoltBmsDevice::TResponse)
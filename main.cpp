@@ -1,11 +1,48 @@
 #include "mainwindow.h"
 
 #include <QApplication>
+#include <QCoreApplication>
+#include <QDir>
 #include <QLocale>
+#include <QStandardPaths>
 #include <QTranslator>
+#include <csbmsdaemon.h>
+#include <string.h>
+
+/* BMSSuperVolt --daemon [config]: headless, no display stack */
+static int runDaemon(int argc, char* argv[], int arg)
+{
+    QCoreApplication a(argc, argv);
+    QString configFile;
+
+    if (arg + 1 < argc) {
+        configFile = QString::fromLocal8Bit(argv[arg + 1]);
+    }
+    else {
+        configFile = QStringLiteral("%1%2%3") //
+                        .arg(
+                           QStandardPaths::writableLocation( //
+                              QStandardPaths::AppConfigLocation),
+                           QDir::separator(),
+                           "svbmsd.conf");
+    }
+
+    CSBmsDaemon daemon(configFile);
+    if (!daemon.start()) {
+        return 1;
+    }
+
+    return a.exec();
+}
 
 int main(int argc, char* argv[])
 {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--daemon") == 0) {
+            return runDaemon(argc, argv, i);
+        }
+    }
+
     QApplication a(argc, argv);
 
     QTranslator translator;
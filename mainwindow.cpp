@@ -6,7 +6,6 @@
 #include <QSerialPort>
 #include <QSerialPortInfo>
 #include <QStandardPaths>
-#include <QTextCursor>
 #include <mainwindow.h>
 
 Q_DECLARE_METATYPE(QSerialPortInfo)
@@ -15,6 +14,16 @@ Q_DECLARE_METATYPE(QSerialPort::DataBits)
 Q_DECLARE_METATYPE(QSerialPort::StopBits)
 Q_DECLARE_METATYPE(QSerialPort::Parity)
 
+/* lines kept in the log view and pending between two repaints */
+static const int LOG_MAX_LINES = 5000;
+/* at most one log repaint per frame interval (ms) */
+static const int LOG_FLUSH_INTERVAL = 16;
+/* analog records buffered between two drains; a lagging UI loses
+ * the oldest, the latest values always get through */
+static const int ANALOG_RING_SIZE = 256;
+/* analog record drain interval (ms) */
+static const int ANALOG_DRAIN_INTERVAL = 100;
+
 static inline const QString configFile()
 {
     return QStringLiteral("%1%2%3") //
@@ -30,17 +39,50 @@ MainWindow::MainWindow(QWidget* parent)
     , ui(new Ui::MainWindow)
     , m_settings(configFile(), QSettings::IniFormat, this)
     , m_config()
-    , m_bms(this)
+    , m_ioThreads(0, this)
+    , m_bms(nullptr)
+    , m_connected(false)
+    , m_analogRing(ANALOG_RING_SIZE, CSBmsFrameRing<CSSuperVoltBmsDevice::TAnalogData>::OverwriteOldest)
+    , m_analogTimer(this)
+    , m_analogDropped(0)
+    , m_chart(nullptr)
+    , m_logRing(LOG_MAX_LINES)
+    , m_logHead(0)
+    , m_logCount(0)
+    , m_logTimer(this)
 {
     ui->setupUi(this);
+    ui->edLogView->setMaximumBlockCount(LOG_MAX_LINES);
+
+    /* charts above the log, fed by the analog drain */
+    m_chart = new CSBmsLiveChart(ui->centralwidget);
+    m_chart->setMinimumHeight(240);
+    ui->verticalLayout_3->insertWidget(ui->verticalLayout_3->indexOf(ui->groupBox_3), m_chart, 1);
+
+    m_logTimer.setSingleShot(true);
+    m_logTimer.setInterval(LOG_FLUSH_INTERVAL);
+    connect(&m_logTimer, &QTimer::timeout, this, &MainWindow::onLogFlush);
+
+    m_analogTimer.setInterval(ANALOG_DRAIN_INTERVAL);
+    connect(&m_analogTimer, &QTimer::timeout, this, &MainWindow::onAnalogDrain);
+
     initPortConfig();
     uiFillControls();
     onDisconnected();
 
-    connect(&m_bms, &CSSuperVoltBmsDevice::connected, this, &MainWindow::onConnected);
-    connect(&m_bms, &CSSuperVoltBmsDevice::disconnected, this, &MainWindow::onDisconnected);
-    connect(&m_bms, &CSSuperVoltBmsDevice::errorOccured, this, &MainWindow::onErrorOccured);
-    connect(&m_bms, &CSSuperVoltBmsDevice::message, this, &MainWindow::onMessage);
+    /* serial I/O runs on its own thread, signals arrive queued */
+    m_bms = m_ioThreads.createDevice(m_config);
+
+    connect(m_bms, &CSSuperVoltBmsDevice::connected, this, &MainWindow::onConnected);
+    connect(m_bms, &CSSuperVoltBmsDevice::disconnected, this, &MainWindow::onDisconnected);
+    connect(m_bms, &CSSuperVoltBmsDevice::errorOccured, this, &MainWindow::onErrorOccured);
+    connect(m_bms, &CSSuperVoltBmsDevice::message, this, &MainWindow::onMessage);
+
+    /* analog records bypass the event queue */
+    CSSuperVoltBmsDevice* bms = m_bms;
+    CSBmsFrameRing<CSSuperVoltBmsDevice::TAnalogData>* ring = &m_analogRing;
+    QMetaObject::invokeMethod(bms, [bms, ring]() { bms->setAnalogRing(ring); });
+    m_analogTimer.start();
 
     m_config.options |= CSSuperVoltBmsDevice::OPT_SOI_BYTE_3E;
     m_config.options |= CSSuperVoltBmsDevice::OPT_ASCII_CHKSUM;
@@ -50,7 +92,8 @@ MainWindow::MainWindow(QWidget* parent)
 
 MainWindow::~MainWindow()
 {
-    disconnect(&m_bms);
+    disconnect(m_bms);
+    m_ioThreads.shutdown();
     savePortConfig();
     delete ui;
 }
@@ -70,6 +113,10 @@ inline void MainWindow::initPortConfig()
     m_config.stopBits = cv<QSerialPort::StopBits>("stopBits", QSerialPort::OneStop);
     m_config.parity = cv<QSerialPort::Parity>("parity", QSerialPort::NoParity);
     m_config.flowCtrl = cv<QSerialPort::FlowControl>("flowCtrl", QSerialPort::NoFlowControl);
+    m_config.traceFlags = cv<uint>("traceFlags", CSSuperVoltBmsDevice::TRACE_ALL);
+    m_config.backend = cv<CSSuperVoltBmsDevice::PortBackend>("backend", CSSuperVoltBmsDevice::QtSerialPort);
+    m_config.lowLatency = m_settings.value("lowLatency", false).toBool();
+    m_config.frameGap = m_settings.value("frameGap", 0.0).toDouble();
     m_settings.endGroup();
 }
 
@@ -82,7 +129,10 @@ inline void MainWindow::savePortConfig()
     m_settings.setValue("stopBits", m_config.stopBits);
     m_settings.setValue("parity", m_config.parity);
     m_settings.setValue("flowCtrl", m_config.flowCtrl);
-    m_settings.setValue("flags", m_config.traceFlags);
+    m_settings.setValue("traceFlags", m_config.traceFlags);
+    m_settings.setValue("backend", m_config.backend);
+    m_settings.setValue("lowLatency", m_config.lowLatency);
+    m_settings.setValue("frameGap", m_config.frameGap);
     m_settings.endGroup();
     m_settings.sync();
 }
@@ -205,22 +255,56 @@ inline void MainWindow::uiFillControls()
     }
 }
 
+/* Lines are collected in a ring and appended in one go by the
+ * flush timer. If more than LOG_MAX_LINES arrive in between, the
+ * oldest are dropped; the view would discard them anyway. */
 inline void MainWindow::writeLog(const QString& message, bool reset)
 {
-    QTextDocument* doc;
-    if ((doc = ui->textBrowser->document())) {
-        if (reset) {
-            doc->setPlainText(message + "\n");
-        }
-        else {
-            doc->setPlainText(doc->toPlainText() + message + "\n");
+    if (reset) {
+        m_logHead = 0;
+        m_logCount = 0;
+        ui->edLogView->clear();
+    }
+
+    m_logRing[(m_logHead + m_logCount) % LOG_MAX_LINES] = message;
+    if (m_logCount < LOG_MAX_LINES) {
+        m_logCount++;
+    }
+    else {
+        m_logHead = (m_logHead + 1) % LOG_MAX_LINES;
+    }
+
+    if (!m_logTimer.isActive()) {
+        m_logTimer.start();
+    }
+}
+
+void MainWindow::onLogFlush()
+{
+    QString text;
+
+    if (!m_logCount) {
+        return;
+    }
+
+    for (int i = 0; i < m_logCount; i++) {
+        QString& line = m_logRing[(m_logHead + i) % LOG_MAX_LINES];
+        if (i > 0) {
+            text.append(QChar('\n'));
         }
-        ui->textBrowser->moveCursor(QTextCursor::Down);
+        text.append(line);
+        line.clear();
     }
+    m_logHead = 0;
+    m_logCount = 0;
+
+    /* one block per line, the view trims to its block limit */
+    ui->edLogView->appendPlainText(text);
 }
 
 void MainWindow::onConnected()
 {
+    m_connected = true;
     writeLog(QStringLiteral("BMS connected."), true);
 
     ui->cbxSerialPort->setEnabled(false);
@@ -235,6 +319,7 @@ void MainWindow::onConnected()
 
 void MainWindow::onDisconnected()
 {
+    m_connected = false;
     writeLog(QStringLiteral("BMS disconnected."));
     ui->cbxSerialPort->setEnabled(true);
     ui->cbxBaudRate->setEnabled(true);
@@ -256,6 +341,37 @@ void MainWindow::onMessage(const QString& message)
     writeLog(message);
 }
 
+void MainWindow::onAnalogDrain()
+{
+    CSSuperVoltBmsDevice::TAnalogData data;
+
+    while (m_analogRing.pop(data)) {
+        showAnalogData(data);
+        m_chart->append(data);
+    }
+
+    const quint64 dropped = m_analogRing.statistics().dropped;
+    if (dropped != m_analogDropped) {
+        writeLog(tr("BMS: %1 analog records dropped, UI too slow.").arg(dropped - m_analogDropped));
+        m_analogDropped = dropped;
+    }
+}
+
+inline void MainWindow::showAnalogData(const CSSuperVoltBmsDevice::TAnalogData& data)
+{
+    QString cells;
+    for (int i = 0; i < data.cellCount; i++) {
+        cells.append(QStringLiteral(" %1").arg(data.cellVoltage[i]));
+    }
+
+    writeLog(tr("BMS #%1: %2 mV %3 mA SOC %4% cells [mV]:%5") //
+                .arg(data.address)
+                .arg(data.voltage)
+                .arg(data.current)
+                .arg(data.soc)
+                .arg(cells));
+}
+
 void MainWindow::on_cbxSerialPort_activated(int index)
 {
     QSerialPortInfo spi;
@@ -289,16 +405,20 @@ void MainWindow::on_cbxParity_activated(int index)
 
 void MainWindow::on_btnOpen_clicked()
 {
-    if (!m_bms.isOpen()) {
-        m_bms.setConfig(m_config);
-        m_bms.open();
+    if (!m_connected) {
+        const CSSuperVoltBmsDevice::TPortConfig config = m_config;
+        CSSuperVoltBmsDevice* bms = m_bms;
+        QMetaObject::invokeMethod(bms, [bms, config]() {
+            bms->setConfig(config);
+            bms->open();
+        });
     }
 }
 
 void MainWindow::on_btnClose_clicked()
 {
-    if (m_bms.isOpen()) {
-        m_bms.close();
+    if (m_connected) {
+        QMetaObject::invokeMethod(m_bms, &CSSuperVoltBmsDevice::close);
     }
 }
 
@@ -351,44 +471,52 @@ void MainWindow::on_cbxFuncions_activated(int)
 
 void MainWindow::on_btnExecFunc_clicked()
 {
-    if (!m_bms.isOpen()) {
+    if (!m_connected) {
         onErrorOccured(CSSuperVoltBmsDevice::NotOpenError);
         return;
     }
 
-    m_bms.setOptions(m_config.options);
-    m_bms.setAddress(m_config.address);
-
-    switch (ui->cbxFuncions->currentIndex()) {
-        case 0: {
-            m_bms.fetchTime();
-            break;
-        }
-        case 1: {
-            m_bms.fetchProtocolVersion();
-            break;
-        }
-        case 2: {
-            m_bms.fetchDeviceAddress();
-            break;
-        }
-        case 3: {
-            m_bms.fetchManufacturer();
-            break;
+    const uint options = m_config.options;
+    const uint address = m_config.address;
+    const int function = ui->cbxFuncions->currentIndex();
+    CSSuperVoltBmsDevice* bms = m_bms;
+
+    /* executed in the device thread */
+    QMetaObject::invokeMethod(bms, [bms, options, address, function]() {
+        bms->setOptions(options);
+        bms->setAddress(address);
+
+        switch (function) {
+            case 0: {
+                bms->fetchTime();
+                break;
+            }
+            case 1: {
+                bms->fetchProtocolVersion();
+                break;
+            }
+            case 2: {
+                bms->fetchDeviceAddress();
+                break;
+            }
+            case 3: {
+                bms->fetchManufacturer();
+                break;
+            }
+            case 4: {
+                bms->fetchAnalogData(false);
+                break;
+            }
+            case 5: {
+                bms->fetchAnalogData(true);
+                break;
+            }
+            case 6: {
+                break;
+            }
+            case 7: {
+                break;
+            }
         }
-        case 4: {
-            m_bms.fetchAnalogData(false);
-            break;
-        }
-        case 5: {
-            m_bms.fetchAnalogData(true);
-            break;
-        }
-        case 6: {
-            break;
-        }
-        case 7: {
-            break;
-        }
-    }
+    });
 }
@@ -2,6 +2,10 @@
 #include <QMainWindow>
 #include <QSerialPort>
 #include <QSettings>
+#include <QTimer>
+#include <QVector>
+#include <csbmsiothreadpool.h>
+#include <csbmslivechart.h>
 #include <cssupervoltbmsdevice.h>
 
 QT_BEGIN_NAMESPACE
@@ -25,6 +29,8 @@ private slots:
     void onDisconnected();
     void onErrorOccured(CSSuperVoltBmsDevice::BmsError);
     void onMessage(const QString& message);
+    void onAnalogDrain();
+    void onLogFlush();
 
     void on_btnOpen_clicked();
     void on_btnClose_clicked();
@@ -49,7 +55,21 @@ private:
     Ui::MainWindow* ui;
     QSettings m_settings;
     CSSuperVoltBmsDevice::TPortConfig m_config;
-    CSSuperVoltBmsDevice m_bms;
+    CSBmsIoThreadPool m_ioThreads;
+    CSSuperVoltBmsDevice* m_bms;
+    bool m_connected;
+
+    /* decoded records from the device thread, drained by timer */
+    CSBmsFrameRing<CSSuperVoltBmsDevice::TAnalogData> m_analogRing;
+    QTimer m_analogTimer;
+    quint64 m_analogDropped;
+    CSBmsLiveChart* m_chart;
+
+    /* log lines not yet shown, bounded ring */
+    QVector<QString> m_logRing;
+    int m_logHead;
+    int m_logCount;
+    QTimer m_logTimer;
 
 private:
     inline void uiFillControls();
@@ -60,4 +80,5 @@ private:
     inline T cv(const QString& key, const uint def);
 
     inline void writeLog(const QString& message, bool reset = false);
+    inline void showAnalogData(const CSSuperVoltBmsDevice::TAnalogData& data);
 };
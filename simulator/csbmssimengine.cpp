@@ -0,0 +1,244 @@
+#include "csbmssimengine.h"
+#include <QDateTime>
+#include <QRandomGenerator>
+#include <string.h>
+
+/* largest INFO we produce, in bytes before hex encoding */
+static const int SIM_MAX_INFO = 128;
+
+CSBmsSimEngine::CSBmsSimEngine()
+    : m_config()
+    , m_stats()
+    , m_packs()
+{
+    m_config.cellCount = 16;
+    m_config.tempCount = 4;
+    m_config.options = OPT_ASCII_CHKSUM | OPT_ASCII_LENGTH;
+    m_config.addresses << 1;
+    resetPacks();
+}
+
+void CSBmsSimEngine::setConfig(const TConfig& config)
+{
+    m_config = config;
+    m_config.cellCount = qBound(0, m_config.cellCount, BMS_MAX_CELLS);
+    m_config.tempCount = qBound(0, m_config.tempCount, BMS_MAX_TEMPS);
+    resetPacks();
+}
+
+const CSBmsSimEngine::TConfig& CSBmsSimEngine::config() const
+{
+    return m_config;
+}
+
+const CSBmsSimEngine::TStatistics& CSBmsSimEngine::statistics() const
+{
+    return m_stats;
+}
+
+inline void CSBmsSimEngine::resetPacks()
+{
+    QRandomGenerator* rnd = QRandomGenerator::global();
+
+    m_packs.clear();
+    foreach (quint8 address, m_config.addresses) {
+        TPack pack = {};
+        for (int i = 0; i < BMS_MAX_CELLS; i++) {
+            pack.cellVoltage[i] = 3280 + rnd->bounded(40);
+        }
+        for (int i = 0; i < BMS_MAX_TEMPS; i++) {
+            pack.temperature[i] = 2731 + 200 + rnd->bounded(80);
+        }
+        pack.total = 10000; /* 100 Ah */
+        pack.remain = 5000 + rnd->bounded(5000);
+        pack.cycles = rnd->bounded(500);
+        m_packs.insert(address, pack);
+    }
+}
+
+bool CSBmsSimEngine::respond(const char* frame, qint64 size, QByteArray& reply)
+{
+    QRandomGenerator* rnd = QRandomGenerator::global();
+    quint8 info[SIM_MAX_INFO];
+    int infoSize = 0;
+    quint8 rtn = 0x00;
+
+    m_stats.requests++;
+
+    /* SOI + VER + ADR + CID1 + CID2 + LENGTH + CHKSUM + EOI */
+    if (size < 18 || !CSBmsProtocol::isSoi(frame[0]) || static_cast<quint8>(frame[size - 1]) != BMS_PROTO_EOI) {
+        m_stats.invalid++;
+        return false;
+    }
+
+    const bool codes = CSBmsProtocol::isCodedHeader(frame + 1);
+    const int width = (codes ? 4 : 2);
+    const int address = CSBmsProtocol::requestByte(frame + 1 + width, codes);
+    const int cid1 = CSBmsProtocol::requestByte(frame + 1 + 2 * width, codes);
+    const int cid2 = CSBmsProtocol::requestByte(frame + 1 + 3 * width, codes);
+
+    if (address < 0 || !m_packs.contains(address)) {
+        /* not one of ours, a real pack stays silent too */
+        return false;
+    }
+
+    if (m_config.dropRate > 0.0 && rnd->generateDouble() < m_config.dropRate) {
+        m_stats.dropped++;
+        return false;
+    }
+
+    /* CHKSUM covers everything between SOI and CHKSUM */
+    const bool asciiChksum = codes && (m_config.options & OPT_ASCII_CHKSUM);
+    const int chksumSize = (asciiChksum ? 8 : 4);
+    const char* chksum = frame + size - 1 - chksumSize;
+    const int hi = CSBmsProtocol::requestByte(chksum, asciiChksum);
+    const int lo = CSBmsProtocol::requestByte(chksum + chksumSize / 2, asciiChksum);
+    const quint16 expected = CSBmsProtocol::checksum(frame + 1, chksum - frame - 1);
+
+    if (hi < 0 || lo < 0 || ((hi << 8) | lo) != expected) {
+        rtn = 0x02; /* CHKSUM error */
+    }
+    else if (cid1 != BMS_CID1_LIFEPO4) {
+        rtn = 0x04; /* CID2 invalid */
+    }
+    else {
+        switch (cid2) {
+            case BMS_CID2_FETCH_ANALOG_DATA:
+            case BMS_CID2_FETCH_ANALOG_DATA + 1: {
+                infoSize = analogInfo(address, info);
+                break;
+            }
+            case BMS_CID2_FETCH_MANUFACTURER: {
+                infoSize = manufacturerInfo(info);
+                break;
+            }
+            case BMS_CID2_FETCH_TIME: {
+                infoSize = timeInfo(info);
+                break;
+            }
+            case BMS_CID2_FETCH_DEVICE_ADDR:
+            case BMS_CID2_FETCH_PROTO_VER: {
+                /* answered by ADR / VER of the header */
+                break;
+            }
+            default: {
+                rtn = 0x04;
+                break;
+            }
+        }
+    }
+
+    reply.resize(BMS_FRAME_HEADER_SIZE + SIM_MAX_INFO * 2 + BMS_FRAME_TRAILER_SIZE);
+    reply.resize(buildReply(reply.data(), frame[0], address, rtn, info, infoSize));
+
+    if (m_config.corruptRate > 0.0 && rnd->generateDouble() < m_config.corruptRate) {
+        /* never SOI or EOI, the frame must still look like one */
+        const int pos = 1 + rnd->bounded(static_cast<int>(reply.size() - 2));
+        reply[pos] = static_cast<char>(reply[pos] ^ (1 << rnd->bounded(4)));
+        m_stats.corrupted++;
+    }
+
+    m_stats.replies++;
+    return true;
+}
+
+/* INFOFLAG ADR M CELL*M K TEMP*K CURRENT VOLTAGE REMAIN P TOTAL CYCLES,
+ * see CSSuperVoltBmsDevice::decodeAnalogData() */
+inline int CSBmsSimEngine::analogInfo(quint8 address, quint8* info)
+{
+    QRandomGenerator* rnd = QRandomGenerator::global();
+    TPack& pack = m_packs[address];
+    quint32 voltage = 0;
+    int n = 0;
+
+    /* slow random walk, discharging with some load noise */
+    pack.current = static_cast<qint16>(-500 + rnd->bounded(100));
+    if (pack.remain > 0) {
+        pack.remain--;
+    }
+
+    info[n++] = 0x00;
+    info[n++] = address;
+    info[n++] = m_config.cellCount;
+    for (int i = 0; i < m_config.cellCount; i++) {
+        pack.cellVoltage[i] = qBound(2800, pack.cellVoltage[i] + rnd->bounded(3) - 1, 3650);
+        voltage += pack.cellVoltage[i];
+        info[n++] = pack.cellVoltage[i] >> 8;
+        info[n++] = pack.cellVoltage[i] & 0xff;
+    }
+    info[n++] = m_config.tempCount;
+    for (int i = 0; i < m_config.tempCount; i++) {
+        pack.temperature[i] = qBound(2731, pack.temperature[i] + rnd->bounded(3) - 1, 2731 + 600);
+        info[n++] = pack.temperature[i] >> 8;
+        info[n++] = pack.temperature[i] & 0xff;
+    }
+    info[n++] = static_cast<quint16>(pack.current) >> 8;
+    info[n++] = static_cast<quint16>(pack.current) & 0xff;
+    info[n++] = (voltage >> 8) & 0xff;
+    info[n++] = voltage & 0xff;
+    info[n++] = pack.remain >> 8;
+    info[n++] = pack.remain & 0xff;
+    info[n++] = 0x02;
+    info[n++] = pack.total >> 8;
+    info[n++] = pack.total & 0xff;
+    info[n++] = pack.cycles >> 8;
+    info[n++] = pack.cycles & 0xff;
+
+    return n;
+}
+
+/* battery name (10), software version (2), manufacturer (20) */
+inline int CSBmsSimEngine::manufacturerInfo(quint8* info)
+{
+    static const char name[10] = {'S', 'X', '1', '5', '0', 'S', 'I', 'M', ' ', ' '};
+    static const char manufacturer[20] = {'S', 'u', 'p', 'e', 'r', 'V', 'o', 'l', 't', ' ', //
+                                          'S', 'i', 'm', 'u', 'l', 'a', 't', 'o', 'r', ' '};
+    int n = 0;
+
+    memcpy(info + n, name, sizeof(name));
+    n += sizeof(name);
+    info[n++] = 0x01;
+    info[n++] = 0x00;
+    memcpy(info + n, manufacturer, sizeof(manufacturer));
+    n += sizeof(manufacturer);
+
+    return n;
+}
+
+/* year (2) month day hour minute second */
+inline int CSBmsSimEngine::timeInfo(quint8* info)
+{
+    const QDateTime now = QDateTime::currentDateTime();
+    const int year = now.date().year();
+
+    info[0] = year >> 8;
+    info[1] = year & 0xff;
+    info[2] = now.date().month();
+    info[3] = now.date().day();
+    info[4] = now.time().hour();
+    info[5] = now.time().minute();
+    info[6] = now.time().second();
+
+    return 7;
+}
+
+/* SOI VER ADR CID1 RTN LENGTH INFO CHKSUM EOI, plain ASCII hex */
+inline qint64 CSBmsSimEngine::buildReply(char* out, char soi, quint8 address, quint8 rtn, const quint8* info, int infoSize)
+{
+    char* pos = out;
+    const quint16 lenid = infoSize * 2;
+
+    *pos++ = soi;
+    pos = CSBmsProtocol::putHex8(pos, BMS_PROTO_VER);
+    pos = CSBmsProtocol::putHex8(pos, address);
+    pos = CSBmsProtocol::putHex8(pos, BMS_CID1_LIFEPO4);
+    pos = CSBmsProtocol::putHex8(pos, rtn);
+    pos = CSBmsProtocol::putHex16(pos, (CSBmsProtocol::lengthChecksum(lenid) << 12) | lenid);
+    for (int i = 0; i < infoSize; i++) {
+        pos = CSBmsProtocol::putHex8(pos, info[i]);
+    }
+    pos = CSBmsProtocol::putHex16(pos, CSBmsProtocol::checksum(out + 1, pos - out - 1));
+    *pos++ = BMS_PROTO_EOI;
+
+    return pos - out;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <csbmsprotocol.h>
+
+/* Protocol side of the simulated SuperVolt BMS packs. Takes one
+ * request frame (SOI..EOI) as written by CSSuperVoltBmsDevice and
+ * builds the reply of the addressed pack. No I/O, no timing, so it
+ * serves the PTY simulator and in-process loopback benchmarks. */
+class CSBmsSimEngine
+{
+public:
+    /* request encoding, same bits as CSSuperVoltBmsDevice::OPT_* */
+    static const uint OPT_ASCII_CHKSUM = 0x04;
+    static const uint OPT_ASCII_LENGTH = 0x08;
+
+    typedef struct {
+        QList<quint8> addresses;
+        int cellCount;
+        int tempCount;
+        uint options;       /* how the requests are encoded */
+        double corruptRate; /* 0..1, flip one byte of the reply */
+        double dropRate;    /* 0..1, don't reply at all */
+    } TConfig;
+
+    typedef struct {
+        quint64 requests;
+        quint64 replies;
+        quint64 dropped;
+        quint64 corrupted;
+        quint64 invalid;
+    } TStatistics;
+
+    CSBmsSimEngine();
+
+    void setConfig(const TConfig& config);
+    const TConfig& config() const;
+    const TStatistics& statistics() const;
+
+    /* false: no reply goes out (unknown address, dropped, garbage) */
+    bool respond(const char* frame, qint64 size, QByteArray& reply);
+
+private:
+    typedef struct {
+        quint16 cellVoltage[BMS_MAX_CELLS]; /* mV */
+        quint16 temperature[BMS_MAX_TEMPS]; /* 0.1 K */
+        qint16 current;                     /* 10 mA */
+        quint16 remain;                     /* 10 mAh */
+        quint16 total;                      /* 10 mAh */
+        quint16 cycles;
+    } TPack;
+
+    TConfig m_config;
+    TStatistics m_stats;
+    QHash<quint8, TPack> m_packs;
+
+private:
+    inline void resetPacks();
+    inline int analogInfo(quint8 address, quint8* info);
+    inline int manufacturerInfo(quint8* info);
+    inline int timeInfo(quint8* info);
+    inline qint64 buildReply(char* out, char soi, quint8 address, quint8 rtn, const quint8* info, int infoSize);
+};
@@ -0,0 +1,178 @@
+#include "csbmssimulator.h"
+#include <QDebug>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTimer>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+/* a request never gets near this, drop the garbage */
+static const int SIM_MAX_REQUEST = 256;
+
+CSBmsSimulator::CSBmsSimulator(QObject* parent)
+    : QObject(parent)
+    , m_engine()
+    , m_master(-1)
+    , m_slave(-1)
+    , m_slaveName()
+    , m_linkName()
+    , m_notifier(nullptr)
+    , m_request()
+    , m_reply()
+    , m_latency(0)
+    , m_jitter(0)
+{
+}
+
+CSBmsSimulator::~CSBmsSimulator()
+{
+    close();
+}
+
+CSBmsSimEngine& CSBmsSimulator::engine()
+{
+    return m_engine;
+}
+
+void CSBmsSimulator::setLatency(int msecs, int jitterMsecs)
+{
+    m_latency = qMax(0, msecs);
+    m_jitter = qMax(0, jitterMsecs);
+}
+
+QString CSBmsSimulator::slaveName() const
+{
+    return m_slaveName;
+}
+
+bool CSBmsSimulator::open(const QString& linkName)
+{
+    struct termios tio;
+
+    close();
+
+    if ((m_master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+        qWarning() << "BMSSIM: posix_openpt:" << strerror(errno);
+        return false;
+    }
+    if (grantpt(m_master) < 0 || unlockpt(m_master) < 0) {
+        qWarning() << "BMSSIM: grantpt/unlockpt:" << strerror(errno);
+        close();
+        return false;
+    }
+
+    m_slaveName = QString::fromLocal8Bit(ptsname(m_master));
+
+    /* Keep a slave descriptor open, the master reads EIO while no
+     * slave is open. Raw mode, CR must not turn into LF. */
+    if ((m_slave = ::open(ptsname(m_master), O_RDWR | O_NOCTTY)) < 0) {
+        qWarning() << "BMSSIM: open" << m_slaveName << strerror(errno);
+        close();
+        return false;
+    }
+    if (tcgetattr(m_slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(m_slave, TCSANOW, &tio);
+    }
+
+    /* e.g. /dev/ttyBMS0, picked up by the device's symlink resolution */
+    if (!linkName.isEmpty()) {
+        QFile::remove(linkName);
+        if (!QFile::link(m_slaveName, linkName)) {
+            qWarning() << "BMSSIM: Unable to link" << linkName << "->" << m_slaveName;
+        }
+        else {
+            m_linkName = linkName;
+        }
+    }
+
+    m_notifier = new QSocketNotifier(m_master, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &CSBmsSimulator::onReadable);
+
+    qInfo().noquote() << "BMSSIM: Listening on" << m_slaveName //
+                      << (m_linkName.isEmpty() ? QString() : QStringLiteral("(%1)").arg(m_linkName));
+    return true;
+}
+
+void CSBmsSimulator::close()
+{
+    if (m_notifier) {
+        delete m_notifier;
+        m_notifier = nullptr;
+    }
+    if (!m_linkName.isEmpty()) {
+        QFile::remove(m_linkName);
+        m_linkName.clear();
+    }
+    if (m_slave >= 0) {
+        ::close(m_slave);
+        m_slave = -1;
+    }
+    if (m_master >= 0) {
+        ::close(m_master);
+        m_master = -1;
+    }
+    m_request.clear();
+}
+
+void CSBmsSimulator::onReadable()
+{
+    char chunk[512];
+    ssize_t size;
+
+    while ((size = ::read(m_master, chunk, sizeof(chunk))) > 0) {
+        request(chunk, size);
+    }
+}
+
+/* collect SOI..EOI, answer each complete request */
+inline void CSBmsSimulator::request(const char* data, qint64 size)
+{
+    for (qint64 i = 0; i < size; i++) {
+        const char c = data[i];
+
+        if (CSBmsProtocol::isSoi(c)) {
+            m_request.clear();
+        }
+        else if (m_request.isEmpty()) {
+            continue;
+        }
+
+        m_request.append(c);
+
+        if (static_cast<quint8>(c) == BMS_PROTO_EOI) {
+            if (m_engine.respond(m_request.constData(), m_request.size(), m_reply)) {
+                send(m_reply);
+            }
+            m_request.clear();
+        }
+        else if (m_request.size() > SIM_MAX_REQUEST) {
+            m_request.clear();
+        }
+    }
+}
+
+inline void CSBmsSimulator::send(const QByteArray& reply)
+{
+    int delay = m_latency;
+    if (m_jitter > 0) {
+        delay += QRandomGenerator::global()->bounded(-m_jitter, m_jitter + 1);
+    }
+
+    const int master = m_master;
+    auto write = [master, reply]() {
+        if (::write(master, reply.constData(), reply.size()) != reply.size()) {
+            qWarning() << "BMSSIM: Short write:" << strerror(errno);
+        }
+    };
+
+    if (delay <= 0) {
+        write();
+        return;
+    }
+    QTimer::singleShot(delay, Qt::PreciseTimer, this, write);
+}
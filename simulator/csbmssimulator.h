@@ -0,0 +1,47 @@
+#pragma once
+#include <QByteArray>
+#include <QObject>
+#include <QSocketNotifier>
+#include <QString>
+#include "csbmssimengine.h"
+
+/* Pseudo terminal front end of the simulator. The slave side is
+ * what the BMS device opens, optionally through a ttyBMSnn style
+ * symlink. Replies leave after latency +/- jitter, one at a time,
+ * like a half duplex RS485 bus. */
+class CSBmsSimulator: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CSBmsSimulator(QObject* parent = nullptr);
+    ~CSBmsSimulator();
+
+    CSBmsSimEngine& engine();
+
+    void setLatency(int msecs, int jitterMsecs);
+
+    bool open(const QString& linkName = QString());
+    void close();
+
+    QString slaveName() const;
+
+private slots:
+    void onReadable();
+
+private:
+    CSBmsSimEngine m_engine;
+    int m_master;
+    int m_slave;
+    QString m_slaveName;
+    QString m_linkName;
+    QSocketNotifier* m_notifier;
+    QByteArray m_request;
+    QByteArray m_reply;
+    int m_latency;
+    int m_jitter;
+
+private:
+    inline void request(const char* data, qint64 size);
+    inline void send(const QByteArray& reply);
+};
@@ -0,0 +1,89 @@
+#include "csbmssimulator.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QSocketNotifier>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* self pipe, a signal handler may only write() */
+static int g_signalFd[2] = {-1, -1};
+
+static void onSignal(int)
+{
+    const char c = 1;
+    if (::write(g_signalFd[0], &c, 1) < 0) {
+        _exit(1);
+    }
+}
+
+/* "1-16" or "1,2,5" */
+static QList<quint8> parseAddresses(const QString& text)
+{
+    QList<quint8> result;
+
+    foreach (const QString& part, text.split(',', Qt::SkipEmptyParts)) {
+        const QStringList range = part.split('-');
+        const int first = range.first().toInt();
+        const int last = range.last().toInt();
+        for (int a = first; a <= last && a <= 0xff; a++) {
+            result.append(static_cast<quint8>(a));
+        }
+    }
+
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("svbmssim");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Simulated SuperVolt BMS packs on a pseudo terminal");
+    parser.addHelpOption();
+    parser.addOptions({
+       {"link", "Create symlink <path> to the pty slave, e.g. /dev/ttyBMS0.", "path"},
+       {"addresses", "Pack addresses, e.g. 1-16 or 1,3,5 (default 1).", "list", "1"},
+       {"cells", "Cells per pack (default 16).", "count", "16"},
+       {"temps", "Temperature sensors per pack (default 4).", "count", "4"},
+       {"options", "Request encoding bits as the device's OPT_* (default 12).", "bits", "12"},
+       {"latency", "Reply latency in ms (default 20).", "ms", "20"},
+       {"jitter", "Latency jitter in ms (default 0).", "ms", "0"},
+       {"corrupt", "Rate of corrupted replies 0..1 (default 0).", "rate", "0"},
+       {"drop", "Rate of dropped replies 0..1 (default 0).", "rate", "0"},
+    });
+    parser.process(a);
+
+    CSBmsSimEngine::TConfig config;
+    config.addresses = parseAddresses(parser.value("addresses"));
+    config.cellCount = parser.value("cells").toInt();
+    config.tempCount = parser.value("temps").toInt();
+    config.options = parser.value("options").toUInt();
+    config.corruptRate = parser.value("corrupt").toDouble();
+    config.dropRate = parser.value("drop").toDouble();
+
+    CSBmsSimulator sim;
+    sim.engine().setConfig(config);
+    sim.setLatency(parser.value("latency").toInt(), parser.value("jitter").toInt());
+
+    if (!sim.open(parser.value("link"))) {
+        return 1;
+    }
+
+    /* leave through the event loop, so the symlink gets removed */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, g_signalFd) == 0) {
+        QSocketNotifier* notifier = new QSocketNotifier(g_signalFd[1], QSocketNotifier::Read, &a);
+        QObject::connect(notifier, &QSocketNotifier::activated, &a, &QCoreApplication::quit);
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+    }
+
+    const int rc = a.exec();
+
+    const CSBmsSimEngine::TStatistics& stats = sim.engine().statistics();
+    qInfo() << "BMSSIM: requests" << stats.requests << "replies" << stats.replies //
+            << "dropped" << stats.dropped << "corrupted" << stats.corrupted << "invalid" << stats.invalid;
+
+    return rc;
+}
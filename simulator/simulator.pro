@@ -0,0 +1,23 @@
+QT = core
+
+CONFIG += c++17
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = svbmssim
+
+INCLUDEPATH += \
+	..
+
+SOURCES += \
+	csbmssimengine.cpp \
+	csbmssimulator.cpp \
+	main.cpp
+
+HEADERS += \
+	../csbmsprotocol.h \
+	csbmssimengine.h \
+	csbmssimulator.h
+
+target.path = /usr/local/bin
+INSTALLS += target
@@ -0,0 +1,5 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+	tst_protocol.pro \
+	tst_telemetry.pro
@@ -0,0 +1,320 @@
+#include <QByteArray>
+#include <QObject>
+#include <QtTest>
+#include <csbmsframebuilder.h>
+#include <csbmsprotocol.h>
+#include <string.h>
+
+/* Frames as published for Pylontech compatible packs and the worked
+ * example of the protocol specification, without SOI and EOI:
+ * VER ADR CID1 CID2 LENGTH INFO CHKSUM */
+typedef struct {
+    const char* frame;
+    quint16 lenid;
+    quint16 chksum;
+} TKnownFrame;
+
+static const TKnownFrame KNOWN_FRAMES[] = {
+   {"20014642E00201FD35", 0x002, 0xfd35},  /* analog data of pack 1 */
+   {"20024642E00202FD33", 0x002, 0xfd33},  /* analog data of pack 2 */
+   {"1203400456ABCEFEFC71", 0x6ab, 0xfc71}, /* specification example */
+};
+
+/* same bits as CSSuperVoltBmsDevice::OPT_* */
+static const uint OPT_ASCII_CHKSUM = 0x04;
+static const uint OPT_ASCII_LENGTH = 0x08;
+
+/* Complete requests with SOI and EOI, as the previous snprintf
+ * encoder (benchmarks/bench_encoder.cpp) wrote them for every
+ * OPT_ASCII_* combination. Header fields are always coded, info < 0
+ * leaves INFO out. */
+typedef struct {
+    uint options;
+    quint8 soi;
+    quint8 address;
+    quint8 cid2;
+    quint16 length;
+    int info;
+    const char* frame;
+} TEncodedFrame;
+
+static const TEncodedFrame ENCODED_FRAMES[] = {
+   {0, 0x3e, 0x01, 0x41, 2, 0x00ff, ">3232303134413431E00200FFFB15\r"},
+   {0, 0x7e, 0x0b, 0x41, 2, 0x000b, "~3232304234413431E002000BFB2D\r"},
+   {0, 0x7e, 0x02, 0x4f, 0, -1, "~32323032344134460000FC11\r"},
+   {OPT_ASCII_CHKSUM, 0x3e, 0x01, 0x41, 2, 0x00ff, ">3232303134413431E00200FF46423135\r"},
+   {OPT_ASCII_CHKSUM, 0x7e, 0x0b, 0x41, 2, 0x000b, "~3232304234413431E002000B46423244\r"},
+   {OPT_ASCII_CHKSUM, 0x7e, 0x02, 0x4f, 0, -1, "~3232303234413446000046433131\r"},
+   {OPT_ASCII_LENGTH, 0x3e, 0x01, 0x41, 2, 0x00ff, ">32323031344134314530303230304646F9AA\r"},
+   {OPT_ASCII_LENGTH, 0x7e, 0x0b, 0x41, 2, 0x000b, "~32323042344134314530303230303042F9B3\r"},
+   {OPT_ASCII_LENGTH, 0x7e, 0x02, 0x4f, 0, -1, "~323230323441344630303030FB45\r"},
+   {OPT_ASCII_CHKSUM | OPT_ASCII_LENGTH, 0x3e, 0x01, 0x41, 2, 0x00ff, ">3232303134413431453030323030464646394141\r"},
+   {OPT_ASCII_CHKSUM | OPT_ASCII_LENGTH, 0x7e, 0x0b, 0x41, 2, 0x000b, "~3232304234413431453030323030304246394233\r"},
+   {OPT_ASCII_CHKSUM | OPT_ASCII_LENGTH, 0x7e, 0x02, 0x4f, 0, -1, "~32323032344134463030303046423435\r"},
+};
+
+/* longer than one vector step of every kernel, plus a tail */
+static const int TEST_MAX_LENGTH = 80;
+
+class TestProtocol: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void lengthChecksum();
+    void lengthChecksumFrames();
+    void checksumFrames();
+    void checksumEmpty();
+    void byteSumLengths();
+    void hexByte();
+    void hexDecodeLengths();
+    void hexDecodeInvalid();
+    void hexDecodeOddInput();
+    void putHex();
+    void putCode();
+    void builderFrames();
+    void builderHeader();
+};
+
+/* the specification's example: LENID 0x012 -> LCHKSUM 0xD */
+void TestProtocol::lengthChecksum()
+{
+    QCOMPARE(CSBmsProtocol::lengthChecksum(0x012), quint8(0xd));
+    QCOMPARE(CSBmsProtocol::lengthChecksum(0x000), quint8(0x0));
+    QCOMPARE(CSBmsProtocol::lengthChecksum(0x002), quint8(0xe));
+    QCOMPARE(CSBmsProtocol::lengthChecksum(0xfff), quint8(0x3));
+
+    /* the LENGTH word is always a multiple of 16 in its nibble sum */
+    for (int lenid = 0; lenid <= BMS_MAX_INFO_SIZE; lenid++) {
+        const int sum = CSBmsProtocol::lengthChecksum(lenid) + ((lenid >> 8) & 0xf) + ((lenid >> 4) & 0xf) + (lenid & 0xf);
+        QVERIFY2(sum % 16 == 0, qPrintable(QString::number(lenid, 16)));
+    }
+}
+
+void TestProtocol::lengthChecksumFrames()
+{
+    for (const TKnownFrame& known : KNOWN_FRAMES) {
+        const int hi = CSBmsProtocol::hexByte(known.frame + BMS_FRAME_LENGTH_OFFSET - 1);
+        const int lo = CSBmsProtocol::hexByte(known.frame + BMS_FRAME_LENGTH_OFFSET + 1);
+        QVERIFY(hi >= 0 && lo >= 0);
+        QCOMPARE(quint16(((hi << 8) | lo) & 0x0fff), known.lenid);
+        QCOMPARE(quint8(hi >> 4), CSBmsProtocol::lengthChecksum(known.lenid));
+    }
+}
+
+void TestProtocol::checksumFrames()
+{
+    for (const TKnownFrame& known : KNOWN_FRAMES) {
+        const qint64 size = strlen(known.frame) - 4;
+        QCOMPARE(CSBmsProtocol::checksum(known.frame, size), known.chksum);
+
+        /* what the device compares against */
+        const int chi = CSBmsProtocol::hexByte(known.frame + size);
+        const int clo = CSBmsProtocol::hexByte(known.frame + size + 2);
+        QCOMPARE(quint16((chi << 8) | clo), known.chksum);
+
+        /* a single flipped character is caught */
+        QByteArray broken(known.frame, size);
+        broken[2] = broken.at(2) ^ 0x01;
+        QVERIFY(CSBmsProtocol::checksum(broken.constData(), size) != known.chksum);
+    }
+}
+
+void TestProtocol::checksumEmpty()
+{
+    QCOMPARE(CSBmsProtocol::checksum("", 0), quint16(0));
+}
+
+/* the vector kernel against the byte loop for every length around
+ * the vector width, at every alignment, with bytes >= 0x80 */
+void TestProtocol::byteSumLengths()
+{
+    char buffer[TEST_MAX_LENGTH + 16];
+
+    for (int i = 0; i < int(sizeof(buffer)); i++) {
+        buffer[i] = char(0x80 + i * 37);
+    }
+
+    for (int offset = 0; offset < 16; offset++) {
+        for (int length = 0; length <= TEST_MAX_LENGTH; length++) {
+            quint32 expected = 0;
+            for (int i = 0; i < length; i++) {
+                expected += quint8(buffer[offset + i]);
+            }
+            QCOMPARE(CSBmsProtocol::byteSumScalar(buffer + offset, length), expected);
+            QCOMPARE(CSBmsProtocol::byteSum(buffer + offset, length), expected);
+        }
+    }
+
+    /* the largest frame does not overflow */
+    QByteArray frame(BMS_MAX_FRAME_SIZE, char(0xff));
+    QCOMPARE(CSBmsProtocol::byteSum(frame.constData(), frame.size()), quint32(BMS_MAX_FRAME_SIZE * 0xff));
+}
+
+void TestProtocol::hexByte()
+{
+    QCOMPARE(CSBmsProtocol::hexByte("00"), 0x00);
+    QCOMPARE(CSBmsProtocol::hexByte("4A"), 0x4a);
+    QCOMPARE(CSBmsProtocol::hexByte("4a"), 0x4a);
+    QCOMPARE(CSBmsProtocol::hexByte("fF"), 0xff);
+    QCOMPARE(CSBmsProtocol::hexByte("G0"), -1);
+    QCOMPARE(CSBmsProtocol::hexByte("0G"), -1);
+    QCOMPARE(CSBmsProtocol::hexByte("0\r"), -1);
+}
+
+/* every length through the vector steps and the scalar tail */
+void TestProtocol::hexDecodeLengths()
+{
+    QByteArray digits;
+    quint8 expected[TEST_MAX_LENGTH];
+    quint8 out[TEST_MAX_LENGTH];
+
+    for (int i = 0; i < TEST_MAX_LENGTH; i++) {
+        expected[i] = quint8(i * 73 + 5);
+        /* mixed case, both are valid */
+        const QByteArray pair = QByteArray::number(expected[i], 16).rightJustified(2, '0');
+        digits.append(i % 3 == 0 ? pair.toUpper() : pair);
+    }
+
+    for (int count = 0; count <= TEST_MAX_LENGTH; count++) {
+        memset(out, 0xee, sizeof(out));
+        QCOMPARE(CSBmsProtocol::hexDecode(digits.constData(), count, out), qint64(-1));
+        QVERIFY2(memcmp(out, expected, count) == 0, qPrintable(QString::number(count)));
+        if (count < TEST_MAX_LENGTH) {
+            QCOMPARE(out[count], quint8(0xee));
+        }
+    }
+}
+
+/* the position of the first invalid character, wherever it is, and
+ * the bytes before it decoded */
+void TestProtocol::hexDecodeInvalid()
+{
+    /* around the digit and letter ranges, and beyond ASCII */
+    static const char invalid[] = {'/', ':', '@', 'G', '`', 'g', ' ', '\r', '\0', char(0x80), char(0xc6)};
+    const int count = 40;
+    QByteArray digits(2 * count, '7');
+    quint8 out[count];
+
+    for (char c : invalid) {
+        for (int pos = 0; pos < 2 * count; pos++) {
+            QByteArray broken = digits;
+            broken[pos] = c;
+
+            memset(out, 0, sizeof(out));
+            QCOMPARE(CSBmsProtocol::hexDecode(broken.constData(), count, out), qint64(pos));
+            for (int i = 0; i < pos / 2; i++) {
+                QCOMPARE(out[i], quint8(0x77));
+            }
+        }
+    }
+
+    /* two invalid digits, the first one counts */
+    QByteArray twice = digits;
+    twice[21] = 'x';
+    twice[50] = 'x';
+    QCOMPARE(CSBmsProtocol::hexDecode(twice.constData(), count, out), qint64(21));
+}
+
+/* An odd number of digits: the caller decodes the pairs, the last
+ * digit is never read. Known INFO of an analog request. */
+void TestProtocol::hexDecodeOddInput()
+{
+    quint8 out[4] = {0, 0, 0, 0};
+
+    QCOMPARE(CSBmsProtocol::hexDecode("020", 1, out), qint64(-1));
+    QCOMPARE(out[0], quint8(0x02));
+    QCOMPARE(out[1], quint8(0x00));
+
+    /* the digit past 'count' pairs may be anything */
+    QCOMPARE(CSBmsProtocol::hexDecode("4A42E", 2, out), qint64(-1));
+    QCOMPARE(out[0], quint8(0x4a));
+    QCOMPARE(out[1], quint8(0x42));
+    QCOMPARE(CSBmsProtocol::hexDecode("4A4\r", 2, out), qint64(3));
+
+    QCOMPARE(CSBmsProtocol::hexDecode("", 0, out), qint64(-1));
+}
+
+void TestProtocol::putHex()
+{
+    char out[4];
+
+    QCOMPARE(CSBmsProtocol::putHex8(out, 0x00) - out, 2);
+    QCOMPARE(QByteArray(out, 2), QByteArray("00"));
+    QCOMPARE(CSBmsProtocol::putHex8(out, 0x4a) - out, 2);
+    QCOMPARE(QByteArray(out, 2), QByteArray("4A"));
+    QCOMPARE(CSBmsProtocol::putHex16(out, 0xd012) - out, 4);
+    QCOMPARE(QByteArray(out, 4), QByteArray("D012"));
+    QCOMPARE(CSBmsProtocol::putHex16(out, 0xfd35) - out, 4);
+    QCOMPARE(QByteArray(out, 4), QByteArray("FD35"));
+}
+
+/* the ASCII codes of the upper case digits, as the snprintf encoder
+ * wrote them: "%X" of the nibble, then "%02X" of that character */
+void TestProtocol::putCode()
+{
+    char out[8];
+
+    QCOMPARE(CSBmsProtocol::putCode8(out, 0x00) - out, 4);
+    QCOMPARE(QByteArray(out, 4), QByteArray("3030"));
+    QCOMPARE(CSBmsProtocol::putCode8(out, 0x22) - out, 4);
+    QCOMPARE(QByteArray(out, 4), QByteArray("3232"));
+    QCOMPARE(CSBmsProtocol::putCode8(out, 0x4a) - out, 4);
+    QCOMPARE(QByteArray(out, 4), QByteArray("3441"));
+    QCOMPARE(CSBmsProtocol::putCode8(out, 0xff) - out, 4);
+    QCOMPARE(QByteArray(out, 4), QByteArray("4646"));
+    QCOMPARE(CSBmsProtocol::putCode16(out, 0xd012) - out, 8);
+    QCOMPARE(QByteArray(out, 8), QByteArray("44303132"));
+}
+
+/* byte for byte what the snprintf encoder sent */
+void TestProtocol::builderFrames()
+{
+    CSBmsFrameBuilder builder;
+
+    for (const TEncodedFrame& known : ENCODED_FRAMES) {
+        const bool asciiLength = (known.options & OPT_ASCII_LENGTH);
+
+        builder.appendStart(known.soi);
+        builder.appendHeader(known.address, known.cid2);
+        builder.appendLength(known.length, asciiLength);
+        if (known.info >= 0) {
+            builder.appendInfo(quint16(known.info), asciiLength);
+        }
+        builder.appendChecksum(known.options & OPT_ASCII_CHKSUM);
+        builder.appendEnd();
+
+        QVERIFY2(builder.isValid(), known.frame);
+        QCOMPARE(builder.view().toByteArray(), QByteArray(known.frame));
+    }
+}
+
+/* what the simulator and the replay benchmark read back */
+void TestProtocol::builderHeader()
+{
+    CSBmsFrameBuilder builder;
+
+    for (const TEncodedFrame& known : ENCODED_FRAMES) {
+        builder.appendStart(known.soi);
+        builder.appendHeader(known.address, known.cid2);
+
+        const char* header = builder.data() + 1;
+        QVERIFY(CSBmsProtocol::isCodedHeader(header));
+        QCOMPARE(CSBmsProtocol::requestByte(header, true), int(BMS_PROTO_VER));
+        QCOMPARE(CSBmsProtocol::requestByte(header + 4, true), int(known.address));
+        QCOMPARE(CSBmsProtocol::requestByte(header + 8, true), int(BMS_CID1_LIFEPO4));
+        QCOMPARE(CSBmsProtocol::requestByte(header + 12, true), int(known.cid2));
+    }
+
+    /* plain headers of other masters */
+    QVERIFY(!CSBmsProtocol::isCodedHeader("20014642E00201FD35"));
+    QCOMPARE(CSBmsProtocol::requestByte("20014642", false), 0x20);
+    QCOMPARE(CSBmsProtocol::requestByte("0142", false), 0x01);
+
+    /* codes of something else than a hex digit */
+    QCOMPARE(CSBmsProtocol::requestByte("3G30", true), -1);
+    QCOMPARE(CSBmsProtocol::requestByte("2030", true), -1);
+}
+
+QTEST_APPLESS_MAIN(TestProtocol)
+#include "tst_protocol.moc"
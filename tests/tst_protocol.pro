@@ -0,0 +1,20 @@
+QT = core
+QT += testlib
+
+CONFIG += c++17
+CONFIG += console
+CONFIG += testcase
+CONFIG -= app_bundle
+
+TARGET = tst_protocol
+
+INCLUDEPATH += \
+	..
+
+SOURCES += \
+	../csbmsframebuilder.cpp \
+	tst_protocol.cpp
+
+HEADERS += \
+	../csbmsframebuilder.h \
+	../csbmsprotocol.h
@@ -0,0 +1,367 @@
+#include <QDir>
+#include <QObject>
+#include <QTemporaryDir>
+#include <QVector>
+#include <QtTest>
+#include <csbmstelemetry.h>
+#include <limits>
+#include <string.h>
+
+typedef CSSuperVoltBmsDevice::TAnalogData TAnalogData;
+
+static const QString TEST_PORT = QStringLiteral("BUS-0");
+static const qint64 TEST_ALL = std::numeric_limits<qint64>::max();
+
+/* smallest segment the store accepts */
+static const qint64 TEST_SEGMENT_SIZE = 65536;
+
+/* deterministic noise, the same rows on every run */
+static inline quint32 testNoise(quint32& state)
+{
+    state = state * 1664525 + 1013904223;
+    return state >> 8;
+}
+
+/* A row of one pack with every channel moving: negative current and
+ * temperatures, cells across the full 16 bit range when 'wide'. */
+static TAnalogData testRow(quint8 address, quint8 cells, quint8 temps, qint64 time, quint32& state, bool wide = false)
+{
+    TAnalogData data;
+
+    memset(&data, 0, sizeof(data));
+    data.timestamp = time;
+    data.address = address;
+    data.cellCount = cells;
+    data.tempCount = temps;
+    data.current = qint32(testNoise(state) % 200000) - 100000;
+    data.voltage = 48000 + testNoise(state) % 8000;
+    data.remainCapacity = testNoise(state) % 100000;
+    data.totalCapacity = 100000;
+    data.cycles = quint16(testNoise(state));
+    data.soc = quint8(testNoise(state) % 101);
+    for (int c = 0; c < cells; c++) {
+        data.cellVoltage[c] = quint16(wide ? testNoise(state) : 3200 + testNoise(state) % 200);
+    }
+    for (int t = 0; t < temps; t++) {
+        data.temperature[t] = qint16(int(testNoise(state) % 900) - 300);
+    }
+    return data;
+}
+
+/* Every field the store keeps; infoFlag and reserved are not
+ * stored, the address comes from the query. */
+static bool sameRow(const TAnalogData& a, const TAnalogData& b, QString& why)
+{
+    const qint64 fields[][2] = {
+       {a.timestamp, b.timestamp},
+       {a.address, b.address},
+       {a.cellCount, b.cellCount},
+       {a.tempCount, b.tempCount},
+       {a.current, b.current},
+       {a.voltage, b.voltage},
+       {a.remainCapacity, b.remainCapacity},
+       {a.totalCapacity, b.totalCapacity},
+       {a.cycles, b.cycles},
+       {a.soc, b.soc},
+    };
+    static const char* names[] = {"timestamp", "address", "cellCount", "tempCount", "current", "voltage", "remainCapacity", "totalCapacity", "cycles", "soc"};
+
+    for (int i = 0; i < int(sizeof(fields) / sizeof(fields[0])); i++) {
+        if (fields[i][0] != fields[i][1]) {
+            why = QStringLiteral("%1: %2 != %3").arg(QLatin1String(names[i])).arg(fields[i][0]).arg(fields[i][1]);
+            return false;
+        }
+    }
+    for (int c = 0; c < a.cellCount; c++) {
+        if (a.cellVoltage[c] != b.cellVoltage[c]) {
+            why = QStringLiteral("cell %1: %2 != %3").arg(c).arg(a.cellVoltage[c]).arg(b.cellVoltage[c]);
+            return false;
+        }
+    }
+    for (int t = 0; t < a.tempCount; t++) {
+        if (a.temperature[t] != b.temperature[t]) {
+            why = QStringLiteral("temperature %1: %2 != %3").arg(t).arg(a.temperature[t]).arg(b.temperature[t]);
+            return false;
+        }
+    }
+    return true;
+}
+
+class TestTelemetry: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void singleRowBlocks();
+    void layoutChange();
+    void timestampJumps();
+    void rejectOlderRows();
+    void segmentRollover();
+
+private:
+    void compareRows(CSBmsTelemetryStore& store, quint8 address, const QVector<TAnalogData>& expected);
+    void reopen(CSBmsTelemetryStore& store, const QString& directory);
+};
+
+/* the whole series against what was appended, row by row */
+void TestTelemetry::compareRows(CSBmsTelemetryStore& store, quint8 address, const QVector<TAnalogData>& expected)
+{
+    const QVector<TAnalogData> rows = store.query(TEST_PORT, address, 0, TEST_ALL);
+    QString why;
+
+    QCOMPARE(rows.size(), expected.size());
+    for (int i = 0; i < rows.size(); i++) {
+        QVERIFY2(sameRow(rows.at(i), expected.at(i), why), qPrintable(QStringLiteral("row %1, %2").arg(i).arg(why)));
+    }
+}
+
+/* everything pending is written by close(), the index is rebuilt
+ * from the block headers by open() */
+void TestTelemetry::reopen(CSBmsTelemetryStore& store, const QString& directory)
+{
+    store.close();
+    QVERIFY(!store.isOpen());
+    QVERIFY(store.open(directory, TEST_SEGMENT_SIZE));
+}
+
+/* sealed after every row: blocks without any delta */
+void TestTelemetry::singleRowBlocks()
+{
+    QTemporaryDir dir;
+    CSBmsTelemetryStore store;
+    QVector<TAnalogData> expected[2];
+    quint32 state = 1;
+
+    QVERIFY(dir.isValid());
+    QVERIFY(store.open(dir.path(), TEST_SEGMENT_SIZE));
+
+    for (int i = 0; i < 5; i++) {
+        for (quint8 address = 1; address <= 2; address++) {
+            const TAnalogData data = testRow(address, 16, 4, 1700000000000LL + i * 1000, state);
+            QVERIFY(store.append(TEST_PORT, data));
+            expected[address - 1].append(data);
+        }
+        store.seal(0);
+    }
+    QCOMPARE(store.statistics().blocks, quint64(10));
+
+    reopen(store, dir.path());
+    QCOMPARE(store.statistics().blocks, quint64(10));
+    compareRows(store, 1, expected[0]);
+    compareRows(store, 2, expected[1]);
+
+    /* and a single pending row next to them */
+    const TAnalogData data = testRow(1, 16, 4, 1700000010000LL, state);
+    QVERIFY(store.append(TEST_PORT, data));
+    expected[0].append(data);
+    compareRows(store, 1, expected[0]);
+
+    reopen(store, dir.path());
+    compareRows(store, 1, expected[0]);
+}
+
+/* cells and temps change within a series, inside a block and right
+ * after a full one */
+void TestTelemetry::layoutChange()
+{
+    QTemporaryDir dir;
+    CSBmsTelemetryStore store;
+    QVector<TAnalogData> expected;
+    qint64 time = 1700000000000LL;
+    quint32 state = 2;
+
+    static const quint8 layouts[][3] = {
+       /* cells, temps, rows */
+       {16, 4, 200},
+       {15, 4, 3},
+       {15, 2, BMS_TELEMETRY_BLOCK_ROWS},
+       {16, 4, 1},
+       {17, 3, 6}, /* same number of channels */
+       {BMS_MAX_CELLS, BMS_MAX_TEMPS, 40},
+       {0, 0, 5},
+       {16, 4, 20},
+    };
+
+    QVERIFY(dir.isValid());
+    QVERIFY(store.open(dir.path(), TEST_SEGMENT_SIZE));
+
+    for (const auto& layout : layouts) {
+        for (int i = 0; i < layout[2]; i++, time += 1000) {
+            const TAnalogData data = testRow(7, layout[0], layout[1], time, state);
+            QVERIFY(store.append(TEST_PORT, data));
+            expected.append(data);
+        }
+    }
+
+    /* pending rows and written blocks together */
+    compareRows(store, 7, expected);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    reopen(store, dir.path());
+    compareRows(store, 7, expected);
+}
+
+/* gaps far beyond 32 bit ms, equal timestamps and jumps back to a
+ * steady interval, so deltas and delta-of-deltas get wide */
+void TestTelemetry::timestampJumps()
+{
+    QTemporaryDir dir;
+    CSBmsTelemetryStore store;
+    QVector<TAnalogData> expected;
+    qint64 time = 0;
+    quint32 state = 3;
+
+    QVERIFY(dir.isValid());
+    QVERIFY(store.open(dir.path(), TEST_SEGMENT_SIZE));
+
+    for (int i = 0; i < 3 * BMS_TELEMETRY_BLOCK_ROWS + 17; i++) {
+        switch (i % 37) {
+            case 5: {
+                time += qint64(1) << 33;
+                break;
+            }
+            case 11: {
+                /* same time as the previous row */
+                break;
+            }
+            case 23: {
+                time += (qint64(1) << 52) + 12345;
+                break;
+            }
+            default: {
+                time += 1000 + testNoise(state) % 7;
+                break;
+            }
+        }
+
+        const TAnalogData data = testRow(3, 16, 4, time, state);
+        QVERIFY(store.append(TEST_PORT, data));
+        expected.append(data);
+    }
+
+    compareRows(store, 3, expected);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    reopen(store, dir.path());
+    compareRows(store, 3, expected);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    /* a range inside, bounds inclusive */
+    const qint64 from = expected.at(100).timestamp;
+    const qint64 to = expected.at(300).timestamp;
+    const QVector<TAnalogData> range = store.query(TEST_PORT, 3, from, to);
+    int first = 100;
+    int last = 300;
+    while (first > 0 && expected.at(first - 1).timestamp == from) {
+        first--;
+    }
+    while (last + 1 < expected.size() && expected.at(last + 1).timestamp == to) {
+        last++;
+    }
+    QCOMPARE(range.size(), last - first + 1);
+    QCOMPARE(range.first().timestamp, from);
+    QCOMPARE(range.last().timestamp, to);
+}
+
+/* a series only runs forward, across blocks and reopening */
+void TestTelemetry::rejectOlderRows()
+{
+    QTemporaryDir dir;
+    CSBmsTelemetryStore store;
+    QVector<TAnalogData> expected;
+    quint32 state = 4;
+
+    QVERIFY(dir.isValid());
+    QVERIFY(store.open(dir.path(), TEST_SEGMENT_SIZE));
+
+    for (int i = 0; i <= 10; i++) {
+        const TAnalogData data = testRow(1, 16, 4, 1000 + i, state);
+        QVERIFY(store.append(TEST_PORT, data));
+        expected.append(data);
+    }
+
+    /* older than the pending rows */
+    QVERIFY(!store.append(TEST_PORT, testRow(1, 16, 4, 1009, state)));
+    QCOMPARE(store.statistics().rejected, quint64(1));
+
+    /* older than the written block */
+    store.seal(0);
+    QVERIFY(!store.append(TEST_PORT, testRow(1, 16, 4, 999, state)));
+    QCOMPARE(store.statistics().rejected, quint64(2));
+
+    /* another series has its own time */
+    QVERIFY(store.append(TEST_PORT, testRow(2, 16, 4, 0, state)));
+
+    reopen(store, dir.path());
+    QCOMPARE(store.lastTime(TEST_PORT, 1), qint64(1010));
+    QVERIFY(!store.append(TEST_PORT, testRow(1, 16, 4, 1005, state)));
+    QCOMPARE(store.statistics().rejected, quint64(1));
+    QCOMPARE(store.statistics().rows, quint64(0));
+
+    /* the same time as the last row is fine */
+    const TAnalogData data = testRow(1, 16, 4, 1010, state);
+    QVERIFY(store.append(TEST_PORT, data));
+    expected.append(data);
+
+    reopen(store, dir.path());
+    compareRows(store, 1, expected);
+}
+
+/* blocks of noisy rows fill several segments, reopening continues
+ * in the last one */
+void TestTelemetry::segmentRollover()
+{
+    QTemporaryDir dir;
+    CSBmsTelemetryStore store;
+    QVector<TAnalogData> expected[2];
+    qint64 time = 1700000000000LL;
+    quint32 state = 5;
+
+    QVERIFY(dir.isValid());
+    QVERIFY(store.open(dir.path(), TEST_SEGMENT_SIZE));
+
+    for (int i = 0; store.statistics().segments < 3; i++, time += 1000) {
+        QVERIFY2(i < 100 * BMS_TELEMETRY_BLOCK_ROWS, "segments never fill");
+        for (quint8 address = 1; address <= 2; address++) {
+            const TAnalogData data = testRow(address, BMS_MAX_CELLS, BMS_MAX_TEMPS, time, state, true);
+            QVERIFY(store.append(TEST_PORT, data));
+            expected[address - 1].append(data);
+        }
+    }
+
+    compareRows(store, 1, expected[0]);
+    compareRows(store, 2, expected[1]);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    reopen(store, dir.path());
+    const QStringList segments = QDir(dir.path()).entryList({"seg-*.svts"}, QDir::Files, QDir::Name);
+    QCOMPARE(store.statistics().segments, quint64(segments.size()));
+    QVERIFY(segments.size() >= 3);
+    compareRows(store, 1, expected[0]);
+    compareRows(store, 2, expected[1]);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    /* more rows after reopening, into the last segment or a new one */
+    for (int i = 0; i < 2 * BMS_TELEMETRY_BLOCK_ROWS; i++, time += 1000) {
+        const TAnalogData data = testRow(1, BMS_MAX_CELLS, BMS_MAX_TEMPS, time, state, true);
+        QVERIFY(store.append(TEST_PORT, data));
+        expected[0].append(data);
+    }
+
+    reopen(store, dir.path());
+    compareRows(store, 1, expected[0]);
+    compareRows(store, 2, expected[1]);
+}
+
+QTEST_APPLESS_MAIN(TestTelemetry)
+#include "tst_telemetry.moc"
@@ -0,0 +1,21 @@
+QT = core
+QT += serialport
+QT += testlib
+
+CONFIG += c++17
+CONFIG += console
+CONFIG += testcase
+CONFIG -= app_bundle
+
+TARGET = tst_telemetry
+
+INCLUDEPATH += \
+	.. \
+	/usr/local/include
+
+SOURCES += \
+	../csbmstelemetry.cpp \
+	tst_telemetry.cpp
+
+HEADERS += \
+	../csbmstelemetry.h